@@ -0,0 +1,43 @@
+# Hot path microbenchmarks with JSON output: qmake benchmark.pro
+include(engine.pri)
+
+TARGET = swarm-bench
+
+SOURCES += \
+    benchmark.cpp \
+    flocker.cpp \
+    flockwidget.cpp \
+    target.cpp \
+    entity.cpp \
+    distancecache.cpp \
+    predator.cpp \
+    blast.cpp \
+    entityviewcache.cpp \
+    depthorder.cpp \
+    lodrenderer.cpp \
+    phasetimings.cpp \
+    spriteatlas.cpp \
+    tilerenderer.cpp \
+    softrasterizer.cpp
+
+HEADERS += \
+    flocker.h \
+    flockwidget.h \
+    target.h \
+    entity.h \
+    distancecache.h \
+    predator.h \
+    blast.h \
+    entityviewcache.h \
+    depthorder.h \
+    lodrenderer.h \
+    phasetimings.h \
+    spriteatlas.h \
+    tilerenderer.h \
+    softrasterizer.h
+
+QT += \
+    widgets
+
+CONFIG += console
+CONFIG -= app_bundle
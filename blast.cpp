@@ -2,54 +2,37 @@
 
 #include <QtGui/QPainter>
 
-namespace {
-const unsigned int maxRepeat = 1;
-const unsigned int lifetime  = 30;
-}
-
-Blast::Blast(unsigned int id, unsigned int type, QObject *parent) :
-  Entity(id, type, BlastEntity, parent),
-  m_done(false),
-  m_time(0),
-  m_repeat(0)
-{
-}
-
-Blast::~Blast()
-{
-}
-
-void Blast::draw(QPainter *p)
+void Blast::drawBatch(QPainter *p, Entity *const *views, int count)
 {
   p->save();
 
   // Device coordinates:
   const double width = p->device()->width();
   const double height = p->device()->height();
-  QPointF devPos (m_pos.x() * width, m_pos.y() * height);
 
-  double radius = (100 * m_time / lifetime) * (0.001 * m_pos.z()) + 0.035;
-  radius *= 0.5 * (width + height);
-
-  QColor color(m_color);
-  color.setAlpha(std::max(0, int(128 - (126 * m_time) / (lifetime))));
-  p->setPen(color);
   p->setBrush(Qt::NoBrush);
+  for (int i = 0; i < count; ++i) {
+    const Entity &view = *views[i];
+    const Eigen::Vector3d &pos = view.pos();
+    QPointF devPos (pos.x() * width, pos.y() * height);
+
+    const double radius = Blast::radius(view) * 0.5 * (width + height);
 
-  p->drawEllipse(devPos, radius, radius);
+    p->setPen(Blast::color(view));
+    p->drawEllipse(devPos, radius, radius);
+  }
 
   p->restore();
 }
 
-void Blast::takeStep(double t)
+double Blast::radius(const Entity &view)
 {
-  if (!m_done) {
-    if (m_repeat++ > maxRepeat) {
-      m_repeat = 0;
-      if (m_time++ > lifetime) {
-        m_time = lifetime;
-        m_done = true;
-      }
-    }
-  }
+  return (100 * view.progress()) * (0.001 * view.pos().z()) + 0.035;
+}
+
+QColor Blast::color(const Entity &view)
+{
+  QColor color(view.color());
+  color.setAlpha(std::max(0, int(128 - 126 * view.progress())));
+  return color;
 }
@@ -3,23 +3,19 @@
 
 #include "entity.h"
 
-class Blast : public Entity
+class QPainter;
+
+// Draws blast views as rings that grow and fade over their lifetime.
+class Blast
 {
-  Q_OBJECT
 public:
-  explicit Blast(unsigned int id, unsigned int type, QObject *parent = 0);
-  ~Blast();
-
-  bool done() const { return m_done; }
-
-public slots:
-  void draw(QPainter *p);
-  void takeStep(double t);
+  // Every view must be a blast.
+  static void drawBatch(QPainter *p, Entity *const *views, int count);
 
-private:
-  bool m_done;
-  unsigned int m_time;
-  unsigned int m_repeat;
+  // Radius of a blast view, as a fraction of the mean device side.
+  static double radius(const Entity &view);
+  // Pen color of a blast view, fading out as it grows.
+  static QColor color(const Entity &view);
 };
 
 #endif // BLAST_H
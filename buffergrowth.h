@@ -0,0 +1,33 @@
+#ifndef BUFFERGROWTH_H
+#define BUFFERGROWTH_H
+
+#include <QtCore/QVector>
+
+// Make room for size elements in a buffer that is refilled every step, so
+// that filling it that far doesn't reallocate. Buffers grow by at least half
+// again, and QVector keeps a reserved capacity through resize() and swap(),
+// so a population wandering around its high water mark soon stops
+// allocating. Returns 1 if the buffer had to grow, for allocation counts.
+template <typename T>
+inline int reserveGrowth(QVector<T> &buffer, int size)
+{
+  if (size <= buffer.capacity())
+    return 0;
+  buffer.reserve(qMax(size + size / 2, 2 * buffer.capacity()));
+  return 1;
+}
+
+// Resize a buffer of buffers to at least size elements. It never shrinks,
+// so elements past a smaller size keep their room for when it grows back.
+// Returns 1 if the outer buffer had to grow.
+template <typename T>
+inline int resizeGrowth(QVector<T> &buffer, int size)
+{
+  if (size <= buffer.size())
+    return 0;
+  const int grew = reserveGrowth(buffer, size);
+  buffer.resize(size);
+  return grew;
+}
+
+#endif // BUFFERGROWTH_H
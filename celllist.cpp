@@ -0,0 +1,118 @@
+#include "celllist.h"
+
+#include "buffergrowth.h"
+#include "workpool.h"
+
+namespace {
+// Smallest number of points worth handing to a separate thread.
+const int minChunkSize = 1024;
+} // end anon namespace
+
+struct CellList::CountFunctor
+{
+  CountFunctor(CellList &l, const double *x_, const double *y_,
+               const double *z_)
+    : list(l), x(x_), y(y_), z(z_) {}
+  CellList &list;
+  const double *x;
+  const double *y;
+  const double *z;
+
+  void operator()(int begin, int end) const
+  {
+    const int cells = list.numCells();
+    int *pointCell = list.m_pointCell.data();
+    for (int c = begin; c < end; ++c) {
+      BinChunk &chunk = list.m_chunks[c];
+      chunk.cellCounts.fill(0, cells);
+      int *counts = chunk.cellCounts.data();
+      for (int i = chunk.begin; i < chunk.end; ++i) {
+        const int cell = list.cellIndex(list.cellCoord(x[i]),
+                                        list.cellCoord(y[i]),
+                                        list.cellCoord(z[i]));
+        pointCell[i] = cell;
+        ++counts[cell];
+      }
+    }
+  }
+};
+
+struct CellList::ScatterFunctor
+{
+  ScatterFunctor(CellList &l) : list(l) {}
+  CellList &list;
+
+  void operator()(int begin, int end) const
+  {
+    const int *pointCell = list.m_pointCell.constData();
+    int *indices = list.m_indices.data();
+    for (int c = begin; c < end; ++c) {
+      BinChunk &chunk = list.m_chunks[c];
+      int *offsets = chunk.cellCounts.data();
+      for (int i = chunk.begin; i < chunk.end; ++i)
+        indices[offsets[pointCell[i]]++] = i;
+    }
+  }
+};
+
+CellList::CellList(double cellSize)
+  : m_numAllocations(0)
+{
+  this->setCellSize(cellSize);
+}
+
+void CellList::setCellSize(double size)
+{
+  m_cellsPerSide = static_cast<int>(std::ceil(1.0 / size));
+  if (m_cellsPerSide < 1)
+    m_cellsPerSide = 1;
+  m_cellSize = 1.0 / m_cellsPerSide;
+  m_invCellSize = m_cellsPerSide;
+
+  m_cellStart.fill(0, this->numCells() + 1);
+  m_indices.clear();
+  m_pointCell.clear();
+}
+
+void CellList::rebuild(const double *x, const double *y, const double *z,
+                       int count, WorkPool &pool)
+{
+  const int cells = this->numCells();
+  m_numAllocations += reserveGrowth(m_pointCell, count);
+  m_numAllocations += reserveGrowth(m_indices, count);
+  m_pointCell.resize(count);
+  m_indices.resize(count);
+
+  // One chunk per thread at most: each costs a histogram over every cell.
+  const int numChunks = qBound(1, count / minChunkSize, pool.numThreads());
+  m_numAllocations += resizeGrowth(m_chunks, numChunks);
+  for (int c = 0; c < numChunks; ++c) {
+    m_numAllocations += reserveGrowth(m_chunks[c].cellCounts, cells);
+    m_chunks[c].begin = static_cast<int>((static_cast<qint64>(count) * c) /
+                                         numChunks);
+    m_chunks[c].end = static_cast<int>((static_cast<qint64>(count) * (c + 1)) /
+                                       numChunks);
+  }
+
+  // Pass 1: bin points and histogram each chunk independently.
+  CountFunctor countPoints(*this, x, y, z);
+  pool.parallelFor(numChunks, countPoints);
+
+  // Convert the per-chunk histograms into write offsets. Chunks are laid out
+  // in order within each cell, which keeps each cell sorted by index.
+  int offset = 0;
+  for (int cell = 0; cell < cells; ++cell) {
+    m_cellStart[cell] = offset;
+    for (int c = 0; c < numChunks; ++c) {
+      int &slot = m_chunks[c].cellCounts[cell];
+      const int n = slot;
+      slot = offset;
+      offset += n;
+    }
+  }
+  m_cellStart[cells] = offset;
+
+  // Pass 2: scatter indices into their cells.
+  ScatterFunctor scatter(*this);
+  pool.parallelFor(numChunks, scatter);
+}
@@ -0,0 +1,155 @@
+#ifndef CELLLIST_H
+#define CELLLIST_H
+
+#include <QtCore/QVector>
+
+#include <cmath>
+
+class WorkPool;
+
+// Uniform grid over the unit cube used to limit pair searches to nearby
+// entities. Points are binned with a parallel counting sort, so a rebuild is
+// O(N) and the indices within each cell stay in ascending order.
+class CellList
+{
+public:
+  explicit CellList(double cellSize = 0.1);
+
+  double cellSize() const { return m_cellSize; }
+  void setCellSize(double size);
+
+  int cellsPerSide() const { return m_cellsPerSide; }
+  int numCells() const { return m_cellsPerSide * m_cellsPerSide *
+                                m_cellsPerSide; }
+  int numPoints() const { return m_indices.size(); }
+
+  // Bin count points, the i'th of which is at (x[i], y[i], z[i]), on pool.
+  // Points outside of the unit cube are clamped into the boundary cells.
+  void rebuild(const double *x, const double *y, const double *z, int count,
+               WorkPool &pool);
+  // Times rebuild() has had to grow its buffers since construction.
+  quint64 numAllocations() const { return m_numAllocations; }
+
+  int cellCoord(double v) const
+  {
+    const int c = static_cast<int>(v * m_invCellSize);
+    return c < 0 ? 0 : (c >= m_cellsPerSide ? m_cellsPerSide - 1 : c);
+  }
+
+  int cellIndex(int cx, int cy, int cz) const
+  {
+    return (cz * m_cellsPerSide + cy) * m_cellsPerSide + cx;
+  }
+
+  // Point indices ordered by cell.
+  const int * indices() const { return m_indices.constData(); }
+
+  // Indices of the points in cell, as a [begin, end) range.
+  const int * cellBegin(int cell) const
+  {
+    return m_indices.constData() + m_cellStart[cell];
+  }
+  const int * cellEnd(int cell) const
+  {
+    return m_indices.constData() + m_cellStart[cell + 1];
+  }
+
+  // Call f(index) for every point in the cells that may hold a point within
+  // radius of (x, y, z). The caller is responsible for the exact distance test.
+  template <typename Functor>
+  void forEachCandidate(double x, double y, double z, double radius,
+                        Functor &f) const;
+
+  // As forEachCandidate, but calls f(begin, end) with contiguous ranges of
+  // positions in indices() rather than with individual point indices.
+  template <typename Functor>
+  void forEachCandidateRange(double x, double y, double z, double radius,
+                             Functor &f) const;
+
+private:
+  // A contiguous range of points binned by one task. cellCounts holds the
+  // range's per-cell counts on the first pass, its write offsets on the
+  // second.
+  struct BinChunk
+  {
+    int begin;
+    int end;
+    QVector<int> cellCounts;
+  };
+  struct CountFunctor;
+  friend struct CountFunctor;
+  struct ScatterFunctor;
+  friend struct ScatterFunctor;
+
+  double m_cellSize;
+  double m_invCellSize;
+  int m_cellsPerSide;
+
+  // m_indices[m_cellStart[c] .. m_cellStart[c+1]) are the points in cell c
+  QVector<int> m_cellStart;
+  QVector<int> m_indices;
+  QVector<int> m_pointCell;
+  // Kept between rebuilds along with their histograms
+  QVector<BinChunk> m_chunks;
+  quint64 m_numAllocations;
+};
+
+template <typename Functor>
+void CellList::forEachCandidateRange(double x, double y, double z,
+                                     double radius, Functor &f) const
+{
+  if (m_indices.isEmpty())
+    return;
+
+  // The epsilon keeps radii that are an exact multiple of the cell size from
+  // rounding up to an extra ring of cells.
+  const int reach =
+      static_cast<int>(std::ceil(radius * m_invCellSize - 1e-9));
+  const int cx = cellCoord(x);
+  const int cy = cellCoord(y);
+  const int cz = cellCoord(z);
+
+  const int xMin = cx - reach < 0 ? 0 : cx - reach;
+  const int yMin = cy - reach < 0 ? 0 : cy - reach;
+  const int zMin = cz - reach < 0 ? 0 : cz - reach;
+  const int xMax = cx + reach >= m_cellsPerSide ? m_cellsPerSide - 1
+                                                : cx + reach;
+  const int yMax = cy + reach >= m_cellsPerSide ? m_cellsPerSide - 1
+                                                : cy + reach;
+  const int zMax = cz + reach >= m_cellsPerSide ? m_cellsPerSide - 1
+                                                : cz + reach;
+
+  for (int k = zMin; k <= zMax; ++k) {
+    for (int j = yMin; j <= yMax; ++j) {
+      // Cells along x are contiguous, so walk them as a single range.
+      f(m_cellStart[cellIndex(xMin, j, k)],
+        m_cellStart[cellIndex(xMax, j, k) + 1]);
+    }
+  }
+}
+
+namespace CellListPrivate {
+template <typename Functor>
+struct IndexAdaptor
+{
+  IndexAdaptor(const int *i, Functor &func) : indices(i), f(func) {}
+  const int *indices;
+  Functor &f;
+
+  void operator()(int begin, int end)
+  {
+    for (int k = begin; k < end; ++k)
+      f(indices[k]);
+  }
+};
+} // end namespace CellListPrivate
+
+template <typename Functor>
+void CellList::forEachCandidate(double x, double y, double z, double radius,
+                                Functor &f) const
+{
+  CellListPrivate::IndexAdaptor<Functor> adaptor(m_indices.constData(), f);
+  this->forEachCandidateRange(x, y, z, radius, adaptor);
+}
+
+#endif // CELLLIST_H
@@ -0,0 +1,73 @@
+#ifndef COUNTERRNG_H
+#define COUNTERRNG_H
+
+#include <QtCore/QtGlobal>
+
+// Counter-based random numbers in the style of SplitMix64. The n'th value of
+// a generator is a pure function of (seed, id, stream, n), so each entity can
+// draw its own numbers on any thread, in any order, and a seed always
+// reproduces the same world.
+class CounterRng
+{
+public:
+  // Independent sequences for each use, so adding draws to one doesn't shift
+  // another.
+  enum Stream {
+    PositionStream = 0,
+    DirectionStream,
+    RespawnStream,
+    BrushStream,
+    ClickStream
+  };
+
+  CounterRng(quint64 seed, quint64 id, quint32 stream, quint64 counter = 0)
+    : m_key(key(seed, id, stream)), m_counter(counter)
+  {
+  }
+
+  quint64 counter() const { return m_counter; }
+  void setCounter(quint64 counter) { m_counter = counter; }
+
+  quint64 next()
+  {
+    return mix(m_key + ++m_counter * golden());
+  }
+
+  // Uniform in [0, 1), with 53 random bits.
+  double uniform()
+  {
+    return (this->next() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  double uniform(double low, double high)
+  {
+    return low + (high - low) * this->uniform();
+  }
+
+  // Uniform in [0, n).
+  quint32 bounded(quint32 n)
+  {
+    return static_cast<quint32>(((this->next() >> 32) * n) >> 32);
+  }
+
+  // The SplitMix64 output function.
+  static quint64 mix(quint64 z)
+  {
+    z = (z ^ (z >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+  }
+
+  static quint64 key(quint64 seed, quint64 id, quint32 stream)
+  {
+    return mix(mix(mix(seed + golden()) + id) + stream);
+  }
+
+private:
+  static quint64 golden() { return Q_UINT64_C(0x9e3779b97f4a7c15); }
+
+  quint64 m_key;
+  quint64 m_counter;
+};
+
+#endif // COUNTERRNG_H
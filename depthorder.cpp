@@ -0,0 +1,145 @@
+#include "depthorder.h"
+
+#include <limits>
+
+#include "entitystore.h"
+
+namespace {
+// Updates that go straight to the counting sort after the insertion sort
+// gives up, before trying it again.
+const int bucketUpdates = 15;
+} // end anon namespace
+
+DepthOrder::DepthOrder()
+  : m_bucketUpdates(0),
+    m_lastShifts(0),
+    m_numBucketSorts(0)
+{
+}
+
+void DepthOrder::update(const EntityStore &store)
+{
+  const int numEntities = store.size();
+  const double *z = store.z();
+
+  for (int i = 0; i < numEntities; ++i) {
+    const quint32 slot = store.handle(i).slot;
+    if (static_cast<int>(slot) >= m_slotIndex.size())
+      m_slotIndex.resize(slot + 1);
+    m_slotIndex[slot] = i + 1;
+  }
+
+  // Keep the entries whose slot is still in use, in their old order, and
+  // pick up their new index and depth. A slot taken over by a new entity
+  // keeps the old one's place until the sort moves it.
+  int kept = 0;
+  for (int e = 0; e < m_entries.size(); ++e) {
+    Entry entry = m_entries[e];
+    if (static_cast<int>(entry.slot) >= m_slotIndex.size())
+      continue;
+    const int index = m_slotIndex[entry.slot] - 1;
+    if (index < 0)
+      continue;
+    m_slotIndex[entry.slot] = 0;
+    entry.index = index;
+    entry.z = z[index];
+    m_entries[kept++] = entry;
+  }
+  m_entries.resize(kept);
+
+  // New entities go on the end in store order.
+  for (int i = 0; i < numEntities; ++i) {
+    const quint32 slot = store.handle(i).slot;
+    if (m_slotIndex[slot] == 0)
+      continue;
+    m_slotIndex[slot] = 0;
+    Entry entry;
+    entry.z = z[i];
+    entry.index = i;
+    entry.slot = slot;
+    m_entries.push_back(entry);
+  }
+
+  const qint64 maxShifts = qint64(maxShiftsPerEntity()) * numEntities;
+  if (m_bucketUpdates > 0 || !this->insertionSort(maxShifts)) {
+    // Buckets hold about one entity each, so the insertion sort that
+    // finishes the job is short.
+    this->bucketSort();
+    this->insertionSort(std::numeric_limits<qint64>::max());
+    if (m_bucketUpdates > 0)
+      --m_bucketUpdates;
+    else
+      m_bucketUpdates = bucketUpdates;
+  }
+
+  m_order.resize(numEntities);
+  for (int e = 0; e < numEntities; ++e)
+    m_order[e] = m_entries[e].index;
+}
+
+void DepthOrder::clear()
+{
+  m_entries.clear();
+  m_order.clear();
+  m_slotIndex.clear();
+  m_bucketUpdates = 0;
+}
+
+bool DepthOrder::insertionSort(qint64 maxShifts)
+{
+  m_lastShifts = 0;
+  Entry *entries = m_entries.data();
+  const int count = m_entries.size();
+  for (int i = 1; i < count; ++i) {
+    if (!(entries[i].z < entries[i - 1].z))
+      continue;
+    const Entry entry = entries[i];
+    int j = i;
+    do {
+      entries[j] = entries[j - 1];
+      --j;
+    } while (j > 0 && entry.z < entries[j - 1].z);
+    entries[j] = entry;
+
+    m_lastShifts += i - j;
+    if (m_lastShifts > maxShifts)
+      return false;
+  }
+  return true;
+}
+
+void DepthOrder::bucketSort()
+{
+  ++m_numBucketSorts;
+  const int count = m_entries.size();
+  if (count < 2)
+    return;
+
+  const Entry *entries = m_entries.constData();
+  double zMin = entries[0].z;
+  double zMax = entries[0].z;
+  for (int e = 1; e < count; ++e) {
+    zMin = qMin(zMin, entries[e].z);
+    zMax = qMax(zMax, entries[e].z);
+  }
+  const double scale = zMax > zMin ? count / (zMax - zMin) : 0.;
+
+  // Stable counting sort, so entities sharing a bucket keep their previous
+  // order.
+  m_bucketStart.fill(0, count + 1);
+  int *start = m_bucketStart.data();
+  for (int e = 0; e < count; ++e)
+    ++start[qMin(count - 1, static_cast<int>((entries[e].z - zMin) * scale))
+            + 1];
+  for (int b = 0; b < count; ++b)
+    start[b + 1] += start[b];
+
+  m_scratch.resize(count);
+  Entry *sorted = m_scratch.data();
+  for (int e = 0; e < count; ++e) {
+    const int b =
+        qMin(count - 1, static_cast<int>((entries[e].z - zMin) * scale));
+    sorted[start[b]++] = entries[e];
+  }
+  m_entries.swap(m_scratch);
+}
@@ -0,0 +1,62 @@
+#ifndef DEPTHORDER_H
+#define DEPTHORDER_H
+
+#include <QtCore/QVector>
+
+class EntityStore;
+
+// Back to front draw order of the entities in an EntityStore, kept from
+// frame to frame. Entities are tracked by handle slot, so the order
+// survives the store's compactions, and since depths change little between
+// frames an insertion sort over the previous order is close to linear.
+// When entities move past too many others, as on the first frame or in a
+// dense crowd, it falls back to a counting sort on quantized depth, which
+// is linear however far they moved.
+class DepthOrder
+{
+public:
+  DepthOrder();
+
+  // Re-sort for the store's current entities and depths.
+  void update(const EntityStore &store);
+  void clear();
+
+  // Store indices in ascending z. Valid until the store changes.
+  const QVector<int>& order() const { return m_order; }
+
+  // Element moves made by the last update's insertion sort.
+  qint64 lastShifts() const { return m_lastShifts; }
+  // Updates that used the counting sort, since construction.
+  quint64 numBucketSorts() const { return m_numBucketSorts; }
+
+  // Insertion sort moves allowed per entity before falling back. After a
+  // fall back the next few updates go straight to the counting sort.
+  static int maxShiftsPerEntity() { return 8; }
+
+private:
+  struct Entry
+  {
+    double z;
+    int index;
+    quint32 slot;
+  };
+
+  // Returns false, leaving the entries partly sorted, once more than
+  // maxShifts moves have been made.
+  bool insertionSort(qint64 maxShifts);
+  void bucketSort();
+
+  QVector<Entry> m_entries;
+  QVector<int> m_order;
+  // Per handle slot: 1 + the store index of its entity in this update, or
+  // 0 once claimed by an entry.
+  QVector<int> m_slotIndex;
+  QVector<Entry> m_scratch;
+  QVector<int> m_bucketStart;
+
+  int m_bucketUpdates;
+  qint64 m_lastShifts;
+  quint64 m_numBucketSorts;
+};
+
+#endif // DEPTHORDER_H
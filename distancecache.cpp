@@ -1,9 +1,29 @@
 #include "distancecache.h"
 
-#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QVector>
 
 #include <math.h>
 
+#include "counterrng.h"
+
+namespace {
+// The top bits of a key's hash pick its shard, the low bits its slot.
+static const int shardBits = 6;
+static const int numShards = 1 << shardBits;
+static const int minShardSlots = 16;
+
+int slotsForCount(int count)
+{
+  // Keep the load factor at or below one half so probe runs stay short.
+  int numSlots = minShardSlots;
+  while (numSlots < 2 * count)
+    numSlots *= 2;
+  return numSlots;
+}
+} // end anon namespace
+
 struct CacheEntry
 {
   double vector[3];
@@ -14,8 +34,28 @@ struct CacheEntry
 class DistanceCachePrivate
 {
 public:
+  // A slot is occupied only if its epoch matches the cache's.
+  struct Slot
+  {
+    Slot() : key(0), epoch(0) {}
+    quint64 key;
+    quint32 epoch;
+    CacheEntry entry;
+  };
+
+  struct Shard
+  {
+    Shard() : count(0), countEpoch(0) {}
+    QMutex mutex;
+    QVector<Slot> table;
+    // Entries added in countEpoch
+    int count;
+    quint32 countEpoch;
+  };
+
   DistanceCachePrivate()
-    : calculateInverses(false)
+    : epoch(1),
+      calculateInverses(false)
   {
   }
 
@@ -30,17 +70,99 @@ public:
           (static_cast<quint64>(id2) << 32) | id1;
   }
 
-  inline const CacheEntry getCacheEntry(quint32 id1, quint32 id2) const
+  inline static quint64 hash(quint64 key)
+  {
+    return CounterRng::mix(key);
+  }
+
+  inline Shard& shardFor(quint64 h)
+  {
+    return shards[h >> (64 - shardBits)];
+  }
+
+  inline const Shard& shardFor(quint64 h) const
   {
-    return cache[getHashKey(id1, id2)];
+    return shards[h >> (64 - shardBits)];
   }
 
-  inline CacheEntry& getCacheEntry(quint32 id1, quint32 id2)
+  int shardCount(const Shard &shard) const
   {
-    return cache[getHashKey(id1, id2)];
+    return shard.countEpoch == epoch ? shard.count : 0;
   }
 
-  QHash<quint64, CacheEntry> cache;
+  // First slot holding key, or the empty slot where it belongs.
+  inline Slot* probe(Shard &shard, quint64 key, quint64 h) const
+  {
+    const int mask = shard.table.size() - 1;
+    Slot *entries = shard.table.data();
+    for (int i = static_cast<int>(h) & mask;; i = (i + 1) & mask) {
+      Slot &slot = entries[i];
+      if (slot.epoch != epoch || slot.key == key)
+        return &slot;
+    }
+  }
+
+  const CacheEntry* find(quint32 id1, quint32 id2) const
+  {
+    const quint64 key = getHashKey(id1, id2);
+    const quint64 h = hash(key);
+    const Shard &shard = shardFor(h);
+    if (shard.table.isEmpty())
+      return 0;
+
+    const int mask = shard.table.size() - 1;
+    const Slot *entries = shard.table.constData();
+    for (int i = static_cast<int>(h) & mask;; i = (i + 1) & mask) {
+      const Slot &slot = entries[i];
+      if (slot.epoch != epoch)
+        return 0;
+      if (slot.key == key)
+        return &slot.entry;
+    }
+  }
+
+  inline const CacheEntry& getCacheEntry(quint32 id1, quint32 id2) const
+  {
+    static const CacheEntry missing = { {0., 0., 0.}, 0., 0. };
+    const CacheEntry *entry = this->find(id1, id2);
+    return entry ? *entry : missing;
+  }
+
+  // Caller holds shard.mutex, or is the only thread touching the cache.
+  void rehash(Shard &shard, int numSlots)
+  {
+    QVector<Slot> old(numSlots);
+    old.swap(shard.table);
+    foreach (const Slot &slot, old) {
+      if (slot.epoch == epoch)
+        *this->probe(shard, slot.key, hash(slot.key)) = slot;
+    }
+  }
+
+  void insert(quint64 key, const CacheEntry &entry)
+  {
+    const quint64 h = hash(key);
+    Shard &shard = shardFor(h);
+    QMutexLocker locker(&shard.mutex);
+
+    if (shard.countEpoch != epoch) {
+      shard.count = 0;
+      shard.countEpoch = epoch;
+    }
+    if (2 * (shard.count + 1) > shard.table.size())
+      this->rehash(shard, slotsForCount(shard.count + 1));
+
+    Slot *slot = this->probe(shard, key, h);
+    if (slot->epoch != epoch) {
+      slot->key = key;
+      slot->epoch = epoch;
+      ++shard.count;
+    }
+    slot->entry = entry;
+  }
+
+  Shard shards[numShards];
+  quint32 epoch;
   bool calculateInverses;
 };
 
@@ -50,7 +172,12 @@ DistanceCache::DistanceCache(QObject *parent)
 {
 }
 
-Eigen::Vector3d DistanceCache::getVector(quint32 id_from, quint32 id_to)
+DistanceCache::~DistanceCache()
+{
+  delete d_ptr;
+}
+
+Eigen::Vector3d DistanceCache::getVector(quint32 id_from, quint32 id_to) const
 {
   Eigen::Vector3d r (this->getStoredVector(id_from, id_to));
   if (id_from > id_to)
@@ -59,18 +186,42 @@ Eigen::Vector3d DistanceCache::getVector(quint32 id_from, quint32 id_to)
   return r;
 }
 
-double DistanceCache::getDistance(quint32 id1, quint32 id2)
+double DistanceCache::getDistance(quint32 id1, quint32 id2) const
 {
   Q_D(const DistanceCache);
   return d->getCacheEntry(id1, id2).norm;
 }
 
-double DistanceCache::getInverseDistance(quint32 id1, quint32 id2)
+double DistanceCache::getInverseDistance(quint32 id1, quint32 id2) const
 {
   Q_D(const DistanceCache);
   return d->getCacheEntry(id1, id2).invNorm;
 }
 
+bool DistanceCache::lookup(quint32 id_from, quint32 id_to,
+                           Eigen::Vector3d *vector, double *distance) const
+{
+  Q_D(const DistanceCache);
+  const CacheEntry *entry = d->find(id_from, id_to);
+  if (!entry)
+    return false;
+
+  *vector = Eigen::Vector3d(entry->vector);
+  if (id_from > id_to)
+    *vector = -*vector;
+  *distance = entry->norm;
+  return true;
+}
+
+int DistanceCache::count() const
+{
+  Q_D(const DistanceCache);
+  int total = 0;
+  for (int s = 0; s < numShards; ++s)
+    total += d->shardCount(d->shards[s]);
+  return total;
+}
+
 bool DistanceCache::calculateInverseDistance() const
 {
   Q_D(const DistanceCache);
@@ -80,19 +231,39 @@ bool DistanceCache::calculateInverseDistance() const
 void DistanceCache::reset()
 {
   Q_D(DistanceCache);
-  return d->cache.clear();
+  if (++d->epoch != 0)
+    return;
+
+  // The epoch wrapped; stale slots could match again, so clear them.
+  for (int s = 0; s < numShards; ++s) {
+    DistanceCachePrivate::Shard &shard = d->shards[s];
+    shard.table.fill(DistanceCachePrivate::Slot());
+    shard.countEpoch = 0;
+  }
+  d->epoch = 1;
 }
 
 void DistanceCache::squeeze()
 {
   Q_D(DistanceCache);
-  return d->cache.squeeze();
+  for (int s = 0; s < numShards; ++s) {
+    DistanceCachePrivate::Shard &shard = d->shards[s];
+    const int numSlots = slotsForCount(d->shardCount(shard));
+    if (numSlots < shard.table.size())
+      d->rehash(shard, numSlots);
+  }
 }
 
 void DistanceCache::reserve(quint32 numIds)
 {
   Q_D(DistanceCache);
-  return d->cache.reserve(numIds);
+  const int perShard = static_cast<int>((numIds + numShards - 1) / numShards);
+  const int numSlots = slotsForCount(perShard);
+  for (int s = 0; s < numShards; ++s) {
+    DistanceCachePrivate::Shard &shard = d->shards[s];
+    if (numSlots > shard.table.size())
+      d->rehash(shard, numSlots);
+  }
 }
 
 void DistanceCache::addPosition(quint32 id1, const double vec1[3],
@@ -105,8 +276,8 @@ void DistanceCache::addPosition(quint32 id1, const double vec1[3],
   entry.vector[1] = vec2[1] - vec1[1];
   entry.vector[2] = vec2[2] - vec1[2];
 
-  // Reverse sign of vector if id2 > id1
-  if (id2 > id1) {
+  // Store the vector pointing from the smaller id to the larger
+  if (id1 > id2) {
     entry.vector[0] = -entry.vector[0];
     entry.vector[1] = -entry.vector[1];
     entry.vector[2] = -entry.vector[2];
@@ -117,11 +288,9 @@ void DistanceCache::addPosition(quint32 id1, const double vec1[3],
 
   entry.norm = sqrt(entry.norm);
 
-  if (d->calculateInverses) {
-    entry.invNorm = 1.0 / entry.norm;
-  }
+  entry.invNorm = d->calculateInverses ? 1.0 / entry.norm : 0.;
 
-  d->cache.insert(d->getHashKey(id1, id2), entry);
+  d->insert(d->getHashKey(id1, id2), entry);
 }
 
 void DistanceCache::setCalculateInverseDistanceOn()
@@ -136,7 +305,7 @@ void DistanceCache::setCalculateInverseDistanceOff()
   d->calculateInverses = false;
 }
 
-const double *DistanceCache::getStoredVector(quint32 id1, quint32 id2)
+const double *DistanceCache::getStoredVector(quint32 id1, quint32 id2) const
 {
   Q_D(const DistanceCache);
   return d->getCacheEntry(id1, id2).vector;
@@ -5,6 +5,11 @@
 
 #include <Eigen/Core>
 
+// Pairwise separation vectors keyed by entity id, stored in a flat
+// open-addressing table split into independently locked shards.
+// addPosition() may be called from several threads at once; lookups must
+// not overlap with insertions. reset() invalidates every entry in O(1) by
+// advancing an epoch, and keeps the storage for the next frame.
 class DistanceCachePrivate;
 class DistanceCache : public QObject
 {
@@ -12,10 +17,21 @@ class DistanceCache : public QObject
 public:
   // The highest id must fit in a quint32
   explicit DistanceCache(QObject *parent = 0);
+  ~DistanceCache();
 
-  Eigen::Vector3d getVector(quint32 id_from, quint32 id_to);
-  double getDistance(quint32 id1, quint32 id2);
-  double getInverseDistance(quint32 id1, quint32 id2);
+  // Points from id_from to id_to. Pairs that haven't been added since the
+  // last reset() read as zero.
+  Eigen::Vector3d getVector(quint32 id_from, quint32 id_to) const;
+  double getDistance(quint32 id1, quint32 id2) const;
+  double getInverseDistance(quint32 id1, quint32 id2) const;
+
+  // Fetch vector (id_from --> id_to) and distance in one probe. Returns false
+  // if the pair hasn't been added since the last reset().
+  bool lookup(quint32 id_from, quint32 id_to,
+              Eigen::Vector3d *vector, double *distance) const;
+
+  // Number of pairs added since the last reset()
+  int count() const;
 
   bool calculateInverseDistance() const;
 
@@ -26,6 +42,7 @@ public slots:
   // number of ids, not the highest id in the set.
   void reserve(quint32 numIds);
 
+  // Thread-safe with respect to other addPosition() calls.
   void addPosition(quint32 id1, const double vec1[3],
                    quint32 id2, const double vec2[3]);
 
@@ -36,7 +53,7 @@ protected:
   DistanceCachePrivate * const d_ptr;
 
   // @warning This vector always points from min(id1, id2) --> max(id1, id2)
-  const double* getStoredVector(quint32 id1, quint32 id2);
+  const double* getStoredVector(quint32 id1, quint32 id2) const;
 
 private:
   Q_DECLARE_PRIVATE(DistanceCache);
@@ -0,0 +1,33 @@
+# Simulation sources shared by the GUI and headless targets. These only
+# depend on QtCore and QtConcurrent.
+
+SOURCES += \
+    celllist.cpp \
+    flockengine.cpp \
+    entitystore.cpp \
+    pairkernel.cpp \
+    forcelaw.cpp \
+    trace.cpp \
+    verletlist.cpp \
+    workpool.cpp
+
+HEADERS += \
+    buffergrowth.h \
+    celllist.h \
+    counterrng.h \
+    flockengine.h \
+    entitystore.h \
+    interaction.h \
+    pairkernel.h \
+    pairkernelimpl.h \
+    forcelaw.h \
+    trace.h \
+    verletlist.h \
+    workpool.h
+
+QT += \
+    concurrent
+
+# Change these as needed...
+INCLUDEPATH += \
+    C:/Users/lonie/src/eigen/
@@ -1,14 +1,22 @@
 #include "entity.h"
 
-Entity::Entity(unsigned int id, unsigned int type,
-               EntityType eType, QObject *parent) :
-  QObject(parent),
-  m_id(id),
-  m_type(type),
-  m_eType(eType)
+Entity::Entity() :
+  m_id(0),
+  m_type(0),
+  m_eType(Invalid),
+  m_pos(0., 0., 0.),
+  m_direction(0., 0., 0.),
+  m_velocity(0.),
+  m_progress(0.),
+  m_cycle(0)
 {
 }
 
-Entity::~Entity()
+void Entity::reset(unsigned int id, unsigned int type, EntityType eType)
 {
+  m_id = id;
+  m_type = type;
+  m_eType = eType;
+  m_progress = 0.;
+  m_cycle = 0;
 }
@@ -3,15 +3,16 @@
 
 #include <Eigen/Core>
 
-#include <QtCore/QObject>
-
 #include <QtGui/QColor>
 
-class QPainter;
-
-class Entity : public QObject
+// Drawable view of one entity in the FlockEngine's EntityStore. The engine
+// owns the simulation state; views are refreshed from it before drawing.
+//
+// A view is a plain value with no virtual functions. Flocker, Predator,
+// Target and Blast draw batches of views of their own type, so drawing
+// dispatches once per batch rather than once per entity.
+class Entity
 {
-  Q_OBJECT
 public:
   enum EntityType {
     Invalid = 0,
@@ -21,9 +22,10 @@ public:
     BlastEntity,
   };
 
-  explicit Entity(unsigned int id, unsigned int type, EntityType eType,
-                  QObject *parent);
-  virtual ~Entity();
+  Entity();
+
+  // Reinitialize the view to show another entity.
+  void reset(unsigned int id, unsigned int type, EntityType eType);
 
   unsigned int id() const {return m_id;}
   unsigned int type() const {return m_type;}
@@ -39,9 +41,13 @@ public:
   const double & velocity() const {return m_velocity;}
   const QColor & color() const {return m_color;}
 
-public slots:
-  virtual void draw(QPainter *p) = 0;
-  virtual void takeStep(double t) = 0;
+  // Blasts: fraction of the lifetime that has passed, in [0, 1].
+  double progress() const {return m_progress;}
+  void setProgress(double p) {m_progress = p;}
+
+  // Predators: position in the brush cycle, advanced once per frame.
+  unsigned int & cycle() {return m_cycle;}
+  unsigned int cycle() const {return m_cycle;}
 
 protected:
   unsigned int m_id;
@@ -51,6 +57,8 @@ protected:
   Eigen::Vector3d m_direction;
   double m_velocity;
   QColor m_color;
+  double m_progress;
+  unsigned int m_cycle;
 };
 
 #endif // ENTITY_H
@@ -0,0 +1,368 @@
+#include "entitystore.h"
+
+#include "buffergrowth.h"
+#include "workpool.h"
+
+#include <algorithm>
+
+namespace {
+// Entities per block of the compaction pass
+const int compactBlockSize = 4096;
+} // end anon namespace
+
+// Copies the survivors of a range of blocks to their compacted positions:
+// the double buffered columns into the next frame, the rest into the given
+// arrays.
+struct EntityStore::CompactFunctor
+{
+  CompactFunctor(EntityStore &s, const int *o)
+    : store(s), offsets(o), id(0), type(0), kind(0), listSlot(0),
+      handleSlot(0)
+  {
+  }
+  EntityStore &store;
+  // First destination of each block
+  const int *offsets;
+  quint32 *id;
+  quint32 *type;
+  quint8 *kind;
+  qint32 *listSlot;
+  quint32 *handleSlot;
+
+  void operator()(int begin, int end) const
+  {
+    const EntityStore &s = store;
+    double *x = store.m_nextX.data();
+    double *y = store.m_nextY.data();
+    double *z = store.m_nextZ.data();
+    double *dx = store.m_nextDx.data();
+    double *dy = store.m_nextDy.data();
+    double *dz = store.m_nextDz.data();
+    double *velocity = store.m_nextVelocity.data();
+    quint32 *age = store.m_nextAge.data();
+    qint32 *slotIndex = store.m_slotIndex.data();
+
+    for (int block = begin; block < end; ++block) {
+      int to = offsets[block];
+      const int last = qMin(s.size(), (block + 1) * compactBlockSize);
+      for (int i = block * compactBlockSize; i < last; ++i) {
+        if (s.m_removed[i])
+          continue;
+        id[to] = s.m_id[i];
+        type[to] = s.m_type[i];
+        kind[to] = s.m_kind[i];
+        x[to] = s.m_x[i];
+        y[to] = s.m_y[i];
+        z[to] = s.m_z[i];
+        dx[to] = s.m_dx[i];
+        dy[to] = s.m_dy[i];
+        dz[to] = s.m_dz[i];
+        velocity[to] = s.m_velocity[i];
+        age[to] = s.m_age[i];
+        listSlot[to] = s.m_listSlot[i];
+        handleSlot[to] = s.m_handleSlot[i];
+        slotIndex[s.m_handleSlot[i]] = to;
+        ++to;
+      }
+    }
+  }
+};
+
+EntityStore::EntityStore()
+  : m_numAllocations(0)
+{
+  this->clear();
+}
+
+void EntityStore::clear()
+{
+  // Outstanding handles go stale
+  for (int i = 0; i < m_handleSlot.size(); ++i) {
+    if (!m_removed[i])
+      this->releaseSlot(m_handleSlot[i]);
+  }
+
+  m_id.clear();
+  m_type.clear();
+  m_kind.clear();
+  m_x.clear();
+  m_y.clear();
+  m_z.clear();
+  m_dx.clear();
+  m_dy.clear();
+  m_dz.clear();
+  m_velocity.clear();
+  m_age.clear();
+  m_listSlot.clear();
+  m_handleSlot.clear();
+  m_removed.clear();
+  m_removedIndices.clear();
+  m_nextX.clear();
+  m_nextY.clear();
+  m_nextZ.clear();
+  m_nextDx.clear();
+  m_nextDy.clear();
+  m_nextDz.clear();
+  m_nextVelocity.clear();
+  m_nextAge.clear();
+
+  for (int k = 0; k < NumKinds; ++k)
+    m_kindCounts[k] = 0;
+}
+
+void EntityStore::reserve(int size)
+{
+  // Every column and spare is reserved alike, so m_id speaks for them all.
+  if (size <= m_id.capacity())
+    return;
+
+  m_id.reserve(size);
+  m_type.reserve(size);
+  m_kind.reserve(size);
+  m_x.reserve(size);
+  m_y.reserve(size);
+  m_z.reserve(size);
+  m_dx.reserve(size);
+  m_dy.reserve(size);
+  m_dz.reserve(size);
+  m_velocity.reserve(size);
+  m_age.reserve(size);
+  m_listSlot.reserve(size);
+  m_handleSlot.reserve(size);
+  m_removed.reserve(size);
+  m_nextX.reserve(size);
+  m_nextY.reserve(size);
+  m_nextZ.reserve(size);
+  m_nextDx.reserve(size);
+  m_nextDy.reserve(size);
+  m_nextDz.reserve(size);
+  m_nextVelocity.reserve(size);
+  m_nextAge.reserve(size);
+  m_spareId.reserve(size);
+  m_spareType.reserve(size);
+  m_spareKind.reserve(size);
+  m_spareListSlot.reserve(size);
+  m_spareHandleSlot.reserve(size);
+  m_compactOffsets.reserve(size / compactBlockSize + 1);
+  m_removedIndices.reserve(size);
+  ++m_numAllocations;
+}
+
+void EntityStore::grow(int size)
+{
+  if (size > m_id.capacity())
+    this->reserve(qMax(size + size / 2, 2 * m_id.capacity()));
+}
+
+int EntityStore::add(quint32 id, quint32 type, Kind kind)
+{
+  this->grow(m_id.size() + 1);
+  m_id.push_back(id);
+  m_type.push_back(type);
+  m_kind.push_back(static_cast<quint8>(kind));
+  m_x.push_back(0.);
+  m_y.push_back(0.);
+  m_z.push_back(0.);
+  m_dx.push_back(0.);
+  m_dy.push_back(0.);
+  m_dz.push_back(0.);
+  m_velocity.push_back(0.);
+  m_age.push_back(0);
+  m_listSlot.push_back(-1);
+  m_handleSlot.push_back(this->acquireSlot(m_id.size() - 1));
+  m_removed.push_back(0);
+  m_nextX.push_back(0.);
+  m_nextY.push_back(0.);
+  m_nextZ.push_back(0.);
+  m_nextDx.push_back(0.);
+  m_nextDy.push_back(0.);
+  m_nextDz.push_back(0.);
+  m_nextVelocity.push_back(0.);
+  m_nextAge.push_back(0);
+
+  ++m_kindCounts[kind];
+  return m_id.size() - 1;
+}
+
+int EntityStore::addCopy(quint32 id, Kind kind, int source)
+{
+  const int i = this->add(id, m_type[source], kind);
+  m_x[i] = m_x[source];
+  m_y[i] = m_y[source];
+  m_z[i] = m_z[source];
+  m_dx[i] = m_dx[source];
+  m_dy[i] = m_dy[source];
+  m_dz[i] = m_dz[source];
+  m_velocity[i] = m_velocity[source];
+  return i;
+}
+
+int EntityStore::append(int count, quint32 firstId, Kind kind)
+{
+  const int first = m_id.size();
+  const int size = first + count;
+  this->grow(size);
+  m_id.resize(size);
+  m_type.resize(size);
+  m_kind.resize(size);
+  m_x.resize(size);
+  m_y.resize(size);
+  m_z.resize(size);
+  m_dx.resize(size);
+  m_dy.resize(size);
+  m_dz.resize(size);
+  m_velocity.resize(size);
+  m_age.resize(size);
+  m_listSlot.resize(size);
+  m_handleSlot.resize(size);
+  m_removed.resize(size);
+  m_nextX.resize(size);
+  m_nextY.resize(size);
+  m_nextZ.resize(size);
+  m_nextDx.resize(size);
+  m_nextDy.resize(size);
+  m_nextDz.resize(size);
+  m_nextVelocity.resize(size);
+  m_nextAge.resize(size);
+
+  // resize() value-initializes the rest.
+  for (int i = first; i < size; ++i) {
+    m_id[i] = firstId + (i - first);
+    m_kind[i] = static_cast<quint8>(kind);
+    m_listSlot[i] = -1;
+    m_handleSlot[i] = this->acquireSlot(i);
+  }
+
+  m_kindCounts[kind] += count;
+  return first;
+}
+
+void EntityStore::markRemoved(int index)
+{
+  Q_ASSERT(index >= 0 && index < m_id.size());
+  if (m_removed[index])
+    return;
+
+  m_removed[index] = 1;
+  m_removedIndices.push_back(index);
+  --m_kindCounts[m_kind[index]];
+  this->releaseSlot(m_handleSlot[index]);
+}
+
+void EntityStore::compact(WorkPool &pool)
+{
+  if (m_removedIndices.isEmpty())
+    return;
+
+  // Each block's survivors start after those of the blocks before it.
+  std::sort(m_removedIndices.begin(), m_removedIndices.end());
+  const int count = m_id.size();
+  const int numBlocks = (count + compactBlockSize - 1) / compactBlockSize;
+  m_compactOffsets.resize(numBlocks);
+  int *offsets = m_compactOffsets.data();
+  int removed = 0;
+  for (int block = 0; block < numBlocks; ++block) {
+    const int first = block * compactBlockSize;
+    while (removed < m_removedIndices.size() &&
+           m_removedIndices[removed] < first)
+      ++removed;
+    offsets[block] = first - removed;
+  }
+
+  const int size = count - m_removedIndices.size();
+  m_spareId.resize(size);
+  m_spareType.resize(size);
+  m_spareKind.resize(size);
+  m_spareListSlot.resize(size);
+  m_spareHandleSlot.resize(size);
+
+  CompactFunctor compact(*this, offsets);
+  compact.id = m_spareId.data();
+  compact.type = m_spareType.data();
+  compact.kind = m_spareKind.data();
+  compact.listSlot = m_spareListSlot.data();
+  compact.handleSlot = m_spareHandleSlot.data();
+  pool.parallelFor(numBlocks, compact);
+
+  m_id.swap(m_spareId);
+  m_type.swap(m_spareType);
+  m_kind.swap(m_spareKind);
+  m_listSlot.swap(m_spareListSlot);
+  m_handleSlot.swap(m_spareHandleSlot);
+  this->swapFrames();
+  m_x.resize(size);
+  m_y.resize(size);
+  m_z.resize(size);
+  m_dx.resize(size);
+  m_dy.resize(size);
+  m_dz.resize(size);
+  m_velocity.resize(size);
+  m_age.resize(size);
+  m_nextX.resize(size);
+  m_nextY.resize(size);
+  m_nextZ.resize(size);
+  m_nextDx.resize(size);
+  m_nextDy.resize(size);
+  m_nextDz.resize(size);
+  m_nextVelocity.resize(size);
+  m_nextAge.resize(size);
+  m_removed.fill(0, size);
+  m_removedIndices.resize(0);
+}
+
+EntityStore::Handle EntityStore::handle(int i) const
+{
+  Handle h;
+  h.slot = m_handleSlot[i];
+  h.generation = m_slotGeneration[h.slot];
+  return h;
+}
+
+int EntityStore::indexOf(const Handle &handle) const
+{
+  if (handle.slot >= static_cast<quint32>(m_slotIndex.size()) ||
+      m_slotGeneration[handle.slot] != handle.generation)
+    return -1;
+  return m_slotIndex[handle.slot];
+}
+
+quint32 EntityStore::acquireSlot(int index)
+{
+  quint32 slot;
+  if (m_freeSlots.isEmpty()) {
+    slot = m_slotIndex.size();
+    // The free list never holds more slots than the table.
+    if (reserveGrowth(m_slotIndex, slot + 1)) {
+      m_slotGeneration.reserve(m_slotIndex.capacity());
+      m_freeSlots.reserve(m_slotIndex.capacity());
+      ++m_numAllocations;
+    }
+    m_slotIndex.push_back(index);
+    m_slotGeneration.push_back(0);
+  }
+  else {
+    slot = m_freeSlots.last();
+    m_freeSlots.pop_back();
+    m_slotIndex[slot] = index;
+  }
+  return slot;
+}
+
+void EntityStore::releaseSlot(quint32 slot)
+{
+  m_slotIndex[slot] = -1;
+  ++m_slotGeneration[slot];
+  m_freeSlots.push_back(slot);
+}
+
+void EntityStore::swapFrames()
+{
+  m_x.swap(m_nextX);
+  m_y.swap(m_nextY);
+  m_z.swap(m_nextZ);
+  m_dx.swap(m_nextDx);
+  m_dy.swap(m_nextDy);
+  m_dz.swap(m_nextDz);
+  m_velocity.swap(m_nextVelocity);
+  m_age.swap(m_nextAge);
+}
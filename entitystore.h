@@ -0,0 +1,211 @@
+#ifndef ENTITYSTORE_H
+#define ENTITYSTORE_H
+
+#include <QtCore/QVector>
+
+#include <Eigen/Core>
+
+class WorkPool;
+
+// Contiguous structure-of-arrays storage for every simulated entity. Entities
+// are addressed by index, which is only stable between compactions. Removal
+// is in two steps: markRemoved() tombstones an entity in O(1), and
+// compact() later drops every tombstone in one parallel pass that keeps the
+// survivors in order. Handles refer to an entity across compactions and go
+// stale once it is removed.
+//
+// The state that changes every step (position, direction, velocity and
+// blast age) is double buffered. A step reads the current frame and writes
+// every entity's next frame, then swapFrames() makes it current. The next
+// frame's contents are undefined outside of a step.
+//
+// Columns only reallocate when the population outgrows them. Compaction
+// fills spare columns and swaps them in, so it doesn't allocate either.
+class EntityStore
+{
+public:
+  // Matches the values of Entity::EntityType.
+  enum Kind {
+    InvalidKind = 0,
+    FlockerKind,
+    PredatorKind,
+    TargetKind,
+    BlastKind,
+    NumKinds
+  };
+
+  // A slot in the handle table and the generation of its occupant. A
+  // default constructed handle is always stale.
+  struct Handle
+  {
+    Handle() : slot(~0u), generation(0) {}
+    quint32 slot;
+    quint32 generation;
+  };
+
+  EntityStore();
+
+  // Including tombstones
+  int size() const { return m_id.size(); }
+  bool isEmpty() const { return m_id.isEmpty(); }
+  // Excluding tombstones
+  int count(Kind kind) const { return m_kindCounts[kind]; }
+
+  void clear();
+  // Make room for size entities without reallocating.
+  void reserve(int size);
+  // Times the columns or the handle table have had to grow since
+  // construction.
+  quint64 numAllocations() const { return m_numAllocations; }
+
+  // Append a new entity with zeroed position, direction and velocity.
+  int add(quint32 id, quint32 type, Kind kind);
+  // Append a new entity that copies its state from the one at source.
+  int addCopy(quint32 id, Kind kind, int source);
+  // Append count zeroed entities of kind with ids firstId, firstId + 1, ...
+  // and type 0, and return the index of the first. The caller fills them in,
+  // in parallel if it likes.
+  int append(int count, quint32 firstId, Kind kind);
+
+  // Tombstone the entity at index. It keeps its index and state until the
+  // next compact(), but no longer counts and its handle goes stale. Marking
+  // it again does nothing.
+  void markRemoved(int index);
+  bool isRemoved(int i) const { return m_removed[i] != 0; }
+  int numRemoved() const { return m_removedIndices.size(); }
+  // Drop the tombstoned entities, keeping the others in order.
+  void compact(WorkPool &pool);
+
+  Handle handle(int i) const;
+  // The entity's current index, or -1 if the handle is stale.
+  int indexOf(const Handle &handle) const;
+
+  quint32 id(int i) const { return m_id[i]; }
+  quint32 type(int i) const { return m_type[i]; }
+  void setType(int i, quint32 type) { m_type[i] = type; }
+  Kind kind(int i) const { return static_cast<Kind>(m_kind[i]); }
+  // Flockers and predators are the entities that steer and interact.
+  bool isAgent(int i) const
+  {
+    return m_kind[i] == FlockerKind || m_kind[i] == PredatorKind;
+  }
+
+  Eigen::Vector3d pos(int i) const
+  {
+    return Eigen::Vector3d(m_x[i], m_y[i], m_z[i]);
+  }
+  void setPos(int i, const Eigen::Vector3d &p)
+  {
+    m_x[i] = p.x(); m_y[i] = p.y(); m_z[i] = p.z();
+  }
+
+  Eigen::Vector3d direction(int i) const
+  {
+    return Eigen::Vector3d(m_dx[i], m_dy[i], m_dz[i]);
+  }
+  void setDirection(int i, const Eigen::Vector3d &d)
+  {
+    m_dx[i] = d.x(); m_dy[i] = d.y(); m_dz[i] = d.z();
+  }
+
+  double & velocity(int i) { return m_velocity[i]; }
+  double velocity(int i) const { return m_velocity[i]; }
+
+  // Slot in the engine's Verlet neighbor lists, or -1 for entities added
+  // since they were built. Moves with the entity on removal.
+  int listSlot(int i) const { return m_listSlot[i]; }
+  void setListSlot(int i, int slot) { m_listSlot[i] = slot; }
+
+  // Steps a blast has lived, which sets its size and when it expires. Only
+  // blasts age; the other kinds stay at 0.
+  quint32 & age(int i) { return m_age[i]; }
+  quint32 age(int i) const { return m_age[i]; }
+
+  // Make the next frame current. Only swaps the buffers.
+  void swapFrames();
+
+  // Raw arrays for the hot loops.
+  double * x() { return m_x.data(); }
+  double * y() { return m_y.data(); }
+  double * z() { return m_z.data(); }
+  double * dx() { return m_dx.data(); }
+  double * dy() { return m_dy.data(); }
+  double * dz() { return m_dz.data(); }
+  double * velocities() { return m_velocity.data(); }
+  const double * x() const { return m_x.constData(); }
+  const double * y() const { return m_y.constData(); }
+  const double * z() const { return m_z.constData(); }
+  const double * dx() const { return m_dx.constData(); }
+  const double * dy() const { return m_dy.constData(); }
+  const double * dz() const { return m_dz.constData(); }
+  const double * velocities() const { return m_velocity.constData(); }
+  const quint32 * types() const { return m_type.constData(); }
+  const quint8 * kinds() const { return m_kind.constData(); }
+
+  // The next frame, for the step to write.
+  double * nextX() { return m_nextX.data(); }
+  double * nextY() { return m_nextY.data(); }
+  double * nextZ() { return m_nextZ.data(); }
+  double * nextDx() { return m_nextDx.data(); }
+  double * nextDy() { return m_nextDy.data(); }
+  double * nextDz() { return m_nextDz.data(); }
+  double * nextVelocities() { return m_nextVelocity.data(); }
+  quint32 * nextAges() { return m_nextAge.data(); }
+
+private:
+  quint32 acquireSlot(int index);
+  void releaseSlot(quint32 slot);
+  // reserve() with room to spare, for appending.
+  void grow(int size);
+
+  struct CompactFunctor;
+  friend struct CompactFunctor;
+
+  QVector<quint32> m_id;
+  QVector<quint32> m_type;
+  QVector<quint8> m_kind;
+  QVector<double> m_x;
+  QVector<double> m_y;
+  QVector<double> m_z;
+  QVector<double> m_dx;
+  QVector<double> m_dy;
+  QVector<double> m_dz;
+  QVector<double> m_velocity;
+  QVector<quint32> m_age;
+  QVector<qint32> m_listSlot;
+  QVector<quint32> m_handleSlot;
+  QVector<quint8> m_removed;
+
+  QVector<double> m_nextX;
+  QVector<double> m_nextY;
+  QVector<double> m_nextZ;
+  QVector<double> m_nextDx;
+  QVector<double> m_nextDy;
+  QVector<double> m_nextDz;
+  QVector<double> m_nextVelocity;
+  QVector<quint32> m_nextAge;
+
+  // compact() writes the survivors' single buffered columns here, then
+  // swaps them in.
+  QVector<quint32> m_spareId;
+  QVector<quint32> m_spareType;
+  QVector<quint8> m_spareKind;
+  QVector<qint32> m_spareListSlot;
+  QVector<quint32> m_spareHandleSlot;
+  // First destination of each compaction block
+  QVector<int> m_compactOffsets;
+
+  int m_kindCounts[NumKinds];
+  // Tombstones since the last compact()
+  QVector<int> m_removedIndices;
+
+  // Handle table: the index and generation of each slot's entity. Released
+  // slots advance their generation and are reused last in, first out.
+  QVector<qint32> m_slotIndex;
+  QVector<quint32> m_slotGeneration;
+  QVector<quint32> m_freeSlots;
+
+  quint64 m_numAllocations;
+};
+
+#endif // ENTITYSTORE_H
@@ -0,0 +1,199 @@
+#include "entityviewcache.h"
+
+#include <QtCore/QDebug>
+
+#include "entitystore.h"
+#include "flockengine.h"
+#include "predator.h"
+
+namespace {
+// An entity that moves further than this in one step was placed rather
+// than moved, like a respawned target, and isn't blended.
+const double maxBlendDistance = 0.1;
+} // end anon namespace
+
+EntityViewCache::EntityViewCache()
+  : m_numAllocations(0)
+{
+}
+
+EntityViewCache::~EntityViewCache()
+{
+  this->clear();
+}
+
+void EntityViewCache::sync(FlockEngine *engine)
+{
+  const EntityStore &store = engine->store();
+  const int numEntities = store.size();
+  const quint64 step = engine->stepCount();
+
+  // Grow the table up front; pointers into it must stay put below.
+  this->growSlots(store);
+
+  m_views.resize(numEntities);
+  m_viewSlots.resize(numEntities);
+  for (int i = 0; i < numEntities; ++i) {
+    bool created;
+    Slot &slot = this->recordEntity(engine, i, step, &created);
+    if (!created && store.kind(i) == EntityStore::PredatorKind)
+      Predator::advanceCycle(&slot.view);
+
+    Entity &view = slot.view;
+    view.pos() = slot.pos;
+    view.direction() = slot.direction;
+    view.velocity() = store.velocity(i);
+    if (store.kind(i) == EntityStore::BlastKind)
+      view.setProgress(engine->blastProgress(i));
+    m_views[i] = &view;
+    m_viewSlots[i] = store.handle(i).slot;
+  }
+}
+
+void EntityViewCache::recordStep(FlockEngine *engine)
+{
+  const EntityStore &store = engine->store();
+  const int numEntities = store.size();
+  const quint64 step = engine->stepCount();
+
+  // m_views may point into the table
+  const int capacity = m_slots.capacity();
+  this->growSlots(store);
+  if (m_slots.capacity() != capacity)
+    m_views.resize(0);
+
+  for (int i = 0; i < numEntities; ++i) {
+    bool created;
+    this->recordEntity(engine, i, step, &created);
+  }
+}
+
+void EntityViewCache::interpolate(double alpha)
+{
+  for (int i = 0; i < m_views.size(); ++i) {
+    const Slot &slot = m_slots[m_viewSlots[i]];
+    Entity &view = *m_views[i];
+    view.pos() = slot.lastPos + alpha * (slot.pos - slot.lastPos);
+    // Directions are unit vectors; blend and renormalize
+    const Eigen::Vector3d direction =
+        slot.lastDirection + alpha * (slot.direction - slot.lastDirection);
+    const double norm = direction.norm();
+    view.direction() = norm > 1e-6 ? Eigen::Vector3d(direction / norm)
+                                   : slot.direction;
+  }
+}
+
+void EntityViewCache::clear()
+{
+  m_slots.clear();
+  m_views.clear();
+  m_viewSlots.clear();
+}
+
+void EntityViewCache::growSlots(const EntityStore &store)
+{
+  const int numEntities = store.size();
+  quint32 maxSlot = 0;
+  for (int i = 0; i < numEntities; ++i)
+    maxSlot = qMax(maxSlot, store.handle(i).slot);
+  if (numEntities > 0 && static_cast<int>(maxSlot) >= m_slots.size()) {
+    const int capacity = m_slots.capacity();
+    m_slots.resize(maxSlot + 1);
+    if (m_slots.capacity() != capacity)
+      ++m_numAllocations;
+  }
+}
+
+EntityViewCache::Slot & EntityViewCache::recordEntity(FlockEngine *engine,
+                                                      int index,
+                                                      quint64 step,
+                                                      bool *created)
+{
+  const EntityStore &store = engine->store();
+  const EntityStore::Handle handle = store.handle(index);
+  Slot &slot = m_slots[handle.slot];
+  *created = !slot.used || slot.generation != handle.generation;
+  if (*created) {
+    this->initializeView(&slot.view, engine, index);
+    slot.generation = handle.generation;
+    slot.used = true;
+  }
+
+  if (*created || slot.step != step) {
+    // Only blend across a single step; after a gap, e.g. a reset, snap.
+    const bool advanced = !*created && slot.step + 1 == step &&
+        (store.pos(index) - slot.pos).squaredNorm() <
+        maxBlendDistance * maxBlendDistance;
+    slot.lastPos = advanced ? slot.pos : store.pos(index);
+    slot.lastDirection = advanced ? slot.direction : store.direction(index);
+    slot.pos = store.pos(index);
+    slot.direction = store.direction(index);
+    slot.step = step;
+  }
+  return slot;
+}
+
+void EntityViewCache::initializeView(Entity *view, FlockEngine *engine,
+                                     int index)
+{
+  const EntityStore &store = engine->store();
+  const unsigned int id = store.id(index);
+  const unsigned int type = store.type(index);
+
+  // EntityType values match EntityStore::Kind
+  const EntityStore::Kind kind = store.kind(index);
+  view->reset(id, type, static_cast<Entity::EntityType>(kind));
+
+  switch (kind) {
+  case EntityStore::PredatorKind:
+    view->color() = QColor(Qt::red);
+    Predator::startCycle(view);
+    break;
+  case EntityStore::FlockerKind:
+  case EntityStore::TargetKind:
+  case EntityStore::BlastKind:
+    view->color() = typeToColor(type, engine->numFlockerTypes());
+    break;
+  default:
+    Q_ASSERT(false);
+    break;
+  }
+}
+
+QColor EntityViewCache::typeToColor(unsigned int type,
+                                    unsigned int numTypes)
+{
+  static const unsigned int numColors = 12;
+  const unsigned int colorMod = (numTypes < numColors) ? numTypes : numColors;
+
+  switch (type % colorMod)
+  {
+  case 0:
+    return QColor(Qt::blue);
+  case 1:
+    return QColor(Qt::darkCyan);
+  case 2:
+    return QColor(Qt::green);
+  case 3:
+    return QColor(Qt::yellow);
+  case 4:
+    return QColor(Qt::white);
+  case 5:
+    return QColor(Qt::cyan);
+  case 6:
+    return QColor(Qt::magenta);
+  case 7:
+    return QColor(Qt::darkGray);
+  case 8:
+    return QColor(Qt::lightGray);
+  case 9:
+    return QColor(Qt::darkMagenta);
+  case 10:
+    return QColor(Qt::darkBlue);
+  case 11:
+    return QColor(Qt::darkGreen);
+  default:
+    qWarning() << "Unrecognized type:" << type;
+    return QColor();
+  }
+}
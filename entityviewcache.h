@@ -0,0 +1,83 @@
+#ifndef ENTITYVIEWCACHE_H
+#define ENTITYVIEWCACHE_H
+
+#include <QtCore/QVector>
+
+#include <QtGui/QColor>
+
+#include "entity.h"
+#include "entitystore.h"
+
+class FlockEngine;
+
+// Keeps one drawable Entity view per entity in a FlockEngine's store. Views
+// are held by value in a table indexed by store handle slot, so per-view
+// drawing state (e.g. the predator brush cycle) survives from frame to frame
+// and a slot's view is reused for the next entity to take the slot. The
+// table only allocates when the population outgrows it.
+//
+// Each slot also keeps the entity's state at the last two engine steps it
+// saw, so views can be drawn between steps with interpolate().
+class EntityViewCache
+{
+public:
+  EntityViewCache();
+  ~EntityViewCache();
+
+  // Create, refresh and retire views to mirror the engine's current state.
+  // Call once per frame; existing views also step their brush cycles.
+  void sync(FlockEngine *engine);
+  // Take the engine's current state as the latest step without touching
+  // the views. sync() does this itself; call it after a step that won't be
+  // synced, so the two kept steps stay one step apart.
+  void recordStep(FlockEngine *engine);
+  // Place the views alpha of the way from the previous kept step to the
+  // latest one. Entities first seen in the latest step stay put.
+  void interpolate(double alpha);
+  void clear();
+
+  // In the same order as the engine's store. Valid until the next sync().
+  const QVector<Entity*>& views() const { return m_views; }
+
+  // Times the view table has had to grow since construction.
+  quint64 numAllocations() const { return m_numAllocations; }
+  // Views in the table, including those of free slots.
+  int capacity() const { return m_slots.size(); }
+
+  // Color of flocker type out of numTypes types.
+  static QColor typeToColor(unsigned int type, unsigned int numTypes);
+
+private:
+  void initializeView(Entity *view, FlockEngine *engine, int index);
+
+  // The view of the entity holding each handle slot. A view belongs to the
+  // slot's current entity only while the generations match.
+  struct Slot
+  {
+    Slot() : generation(0), used(false), step(0) {}
+    Entity view;
+    quint32 generation;
+    bool used;
+    // Position and direction at the engine step before step, and at step
+    quint64 step;
+    Eigen::Vector3d lastPos;
+    Eigen::Vector3d lastDirection;
+    Eigen::Vector3d pos;
+    Eigen::Vector3d direction;
+  };
+  QVector<Slot> m_slots;
+
+  // Grow the table to hold every handle slot in store.
+  void growSlots(const EntityStore &store);
+  // Record the state of the entity at index as of step, and return its
+  // slot. created is set if the slot's view was (re)initialized.
+  Slot & recordEntity(FlockEngine *engine, int index, quint64 step,
+                      bool *created);
+
+  QVector<Entity*> m_views;
+  // Slot of each view
+  QVector<quint32> m_viewSlots;
+  quint64 m_numAllocations;
+};
+
+#endif // ENTITYVIEWCACHE_H
@@ -4,50 +4,20 @@
 #include <Eigen/Core>
 
 #include <QtCore/QDebug>
-#include <QtCore/QTimer>
+#include <QtCore/QElapsedTimer>
 
-#include <QtWidgets/QApplication>
-
-#include <QtGui/QBrush>
-#include <QtGui/QKeyEvent>
-#include <QtGui/QPen>
-#include <QtGui/QMouseEvent>
-#include <QtGui/QPainter>
-
-#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include <cstdlib>
 #include <ctime>
+#include <limits>
 
-#include "blast.h"
-#include "flocker.h"
-#include "predator.h"
-#include "target.h"
+#include "buffergrowth.h"
+#include "interaction.h"
+#include "trace.h"
 
 namespace {
-// See http://www.musicdsp.org/showone.php?id=222 for more info
-inline float fastexp5(float x) {
-    return (120+x*(120+x*(60+x*(20+x*(5+x)))))*0.0083333333f;
-}
-
-inline double V_morse(const double r) {
-  const double depth = 1.00;
-  const double rad   = 0.10;
-  const double alpha = 2.00;
-
-  const double tmpTerm = ( 1 - fastexp5( -alpha * (r - rad) ) );
-  double V = depth * tmpTerm * tmpTerm;
-
-  return V - depth;
-}
-
-// Numerical derivatives
-inline double V_morse_ND(const double r) {
-  const double delta = r * 1e-5;
-  const double v1 = V_morse(r - delta);
-  const double v2 = V_morse(r + delta);
-  return (v2 - v1) / (delta + delta);
-}
+using namespace Interaction;
 
 // Weight for each competing force
 static double diffPotWeight  = 0.10; // morse potential, all type()s
@@ -61,12 +31,53 @@ static double boundaryWeight = 1.10; // boundary evasion
 static const double maxTurn = 0.20;
 // velocity *= 1.0 + speedupFactor * direction.dot(goalForce)
 static const double speedupFactor = 0.075;
-// Kill radius for if predators catch flockers:
-static const double killRadius = 0.020;
 // Fraction from boundary to begin repulsion
 // rmax in force = ((rmax - r) / rmax) * norm (m @ 0, 0 @ rmax
 static const double boundaryRMax  = 0.25;
 static const double boundaryRMax2 = boundaryRMax * boundaryRMax;
+// Blasts advance one tick every blastStepsPerTick steps and are removed once
+// they are blastLifetime ticks old.
+static const unsigned int blastStepsPerTick = 3;
+static const unsigned int blastLifetime     = 30;
+// Cell size for the neighbor search grid. An integer fraction of the
+// alignment cutoff keeps the searched volume tight.
+static const double cellListSize   = alignCutoff / 3.0;
+// Position used for kernel lanes that must never interact.
+static const double farAway = 1e6;
+// Smallest number of entities worth handing to a separate thread.
+static const int minChunkSize = 1024;
+// As above, for the far more expensive pair interactions.
+static const int minPairChunkSize = 128;
+// Fewest agents per task when computing their steps.
+static const int minAgentGrain = 16;
+// Agents that may spawn between Verlet list builds, at least; the limit
+// grows with the population (see updateVerletList()).
+static const int minVerletRecent = 32;
+// A flocker this close to one of its targets reaches it.
+static const double targetReachRadius = 0.025;
+// Multiple time stepping: a flocker is quiet when its turn and speed change
+// at an evaluation differ from the last ones by less than quietTurn and
+// the fraction quietSpeedup of its speed, and stirred, waking its quiet
+// neighbors, when they differ by stirFactor times that. Quiet flockers
+// back off to being evaluated every maxRateInterval steps.
+static const double quietTurn = 0.01;
+static const double quietSpeedup = 0.002;
+static const double stirFactor = 10.;
+static const int maxRateInterval = 4;
+// Cells per side of the grid that active flockers mark, with their
+// neighbors, for the quiet ones to check.
+static const int activityGridSize = 32;
+
+// Layout of the per-chunk force buffers: twelve force components
+// (diffPot, samePot, align, predator; x, y, z each) then the catch count.
+enum PairComponent {
+  DiffPotComponent = 0,
+  SamePotComponent = 3,
+  AlignComponent = 6,
+  PredatorComponent = 9,
+  CaughtComponent = 12,
+  NumPairComponents = 13
+};
 
 // (rmax - r) / rmax
 
@@ -91,7 +102,11 @@ static void initWorker()
 
 FlockEngine::FlockEngine(QObject *parent)
   : QObject(parent),
+    m_numCoasted(0),
+    m_numAllocations(0),
     m_useForceTarget(false),
+    m_seed(static_cast<quint64>(time(NULL))),
+    m_stepCount(0),
     m_entityIdHead(0),
     m_numFlockers(500),
     m_numFlockerTypes(12),
@@ -101,22 +116,25 @@ FlockEngine::FlockEngine(QObject *parent)
     m_stepSize(1.),
     m_initialSpeed(0.0050),
     m_minSpeed(    0.0015),
-    m_maxSpeed(    0.0075)
+    m_maxSpeed(    0.0075),
+    m_neighborSearch(CellListSearch),
+    m_cellList(cellListSize),
+    m_symmetricPairs(true),
+    m_pairStride(0),
+    m_multiRate(false)
 {
+  const StepTimings noTimings = { 0, 0, 0, 0, 0 };
+  m_timings = noTimings;
+
   initWorker();
   this->initializeFlockers();
   this->initializePredators();
   this->initializeTargets();
-
-  // Initialize RNG
-  srand(time(NULL));
 }
 
 FlockEngine::~FlockEngine()
 {
-  this->cleanupFlockers();
-  this->cleanupPredators();
-  this->cleanupTargets();
+  m_future.waitForFinished();
 }
 
 const Eigen::Vector3d &FlockEngine::forceTarget() const
@@ -139,24 +157,298 @@ void FlockEngine::setUseForceTarget(bool b)
   m_useForceTarget = b;
 }
 
-struct FlockEngine::TakeStepResult
+struct FlockEngine::PairForces
+{
+  PairForces()
+    : samePotForce(0., 0., 0.),
+      diffPotForce(0., 0., 0.),
+      alignForce(0., 0., 0.),
+      predatorForce(0., 0., 0.)
+  {
+  }
+
+  Eigen::Vector3d samePotForce;
+  Eigen::Vector3d diffPotForce;
+  Eigen::Vector3d alignForce;
+  Eigen::Vector3d predatorForce;
+};
+
+// Runs the pair kernel over ranges of a, such as those found by the cell
+// list, skipping the entity itself.
+struct FlockEngine::KernelRangeFunctor
+{
+  KernelRangeFunctor(const FlockEngine &e, const NeighborArrays &a, int slot,
+                     const PairKernel::Self &s, PairKernel::Forces *f)
+    : engine(e), selfSlot(slot), self(s), forces(f)
+  {
+    neighbors.x = a.x.constData();
+    neighbors.y = a.y.constData();
+    neighbors.z = a.z.constData();
+    neighbors.dx = a.dx.constData();
+    neighbors.dy = a.dy.constData();
+    neighbors.dz = a.dz.constData();
+    neighbors.type = a.type.constData();
+    neighbors.predator = a.predator.constData();
+  }
+  const FlockEngine &engine;
+  int selfSlot;
+  const PairKernel::Self &self;
+  PairKernel::Neighbors neighbors;
+  PairKernel::Forces *forces;
+
+  void operator()(int begin, int end)
+  {
+    if (selfSlot >= begin && selfSlot < end) {
+      engine.m_pairKernel.accumulate(self, neighbors, begin, selfSlot, forces);
+      engine.m_pairKernel.accumulate(self, neighbors, selfSlot + 1, end,
+                                     forces);
+    }
+    else {
+      engine.m_pairKernel.accumulate(self, neighbors, begin, end, forces);
+    }
+  }
+};
+
+// Copies entity state into cell order for the pair kernel.
+struct FlockEngine::GatherFunctor
+{
+  GatherFunctor(FlockEngine &e) : engine(e) {}
+  FlockEngine &engine;
+
+  void operator()(int begin, int end) const
+  {
+    const EntityStore &s = engine.m_store;
+    NeighborArrays &a = engine.m_neighbors;
+    const int *indices = engine.m_cellList.indices();
+    for (int slot = begin; slot < end; ++slot) {
+      const int i = indices[slot];
+      engine.m_cellSlot[i] = slot;
+      if (s.isAgent(i)) {
+        a.x[slot] = s.x()[i];
+        a.y[slot] = s.y()[i];
+        a.z[slot] = s.z()[i];
+      }
+      else {
+        // Targets and blasts share the grid but don't interact; park them
+        // well outside of every cutoff.
+        a.x[slot] = a.y[slot] = a.z[slot] = farAway;
+      }
+      a.dx[slot] = s.dx()[i];
+      a.dy[slot] = s.dy()[i];
+      a.dz[slot] = s.dz()[i];
+      a.type[slot] = s.type(i);
+      a.predator[slot] = s.kind(i) == EntityStore::PredatorKind ? 1. : 0.;
+    }
+  }
+};
+
+// Fills in newly appended entities.
+struct FlockEngine::RandomizeFunctor
+{
+  RandomizeFunctor(FlockEngine &e, int f) : engine(e), first(f) {}
+  FlockEngine &engine;
+  int first;
+
+  void operator()(int begin, int end) const
+  {
+    for (int i = first + begin; i < first + end; ++i)
+      engine.randomizeEntity(i, i - first);
+  }
+};
+
+// Runs the half-pair kernel over the neighbor ranges of one entity.
+struct FlockEngine::SymmetricRangeFunctor
 {
-  Eigen::Vector3d newDirection;
-  double newVelocity;
-  const Target *deadTarget;
-  const Flocker *deadFlocker;
+  SymmetricRangeFunctor(const FlockEngine &e, int slot,
+                        const PairKernel::Self &s,
+                        const PairKernel::Neighbors &n,
+                        PairKernel::Forces *f,
+                        const PairKernel::Reaction &r)
+    : engine(e), selfSlot(slot), self(s), neighbors(n), forces(f), reaction(r)
+  {
+  }
+  const FlockEngine &engine;
+  int selfSlot;
+  const PairKernel::Self &self;
+  const PairKernel::Neighbors &neighbors;
+  PairKernel::Forces *forces;
+  const PairKernel::Reaction &reaction;
+
+  void operator()(int begin, int end)
+  {
+    // Flocker pairs are taken by the lower slot
+    if (!self.predator) {
+      begin = qMax(begin, selfSlot + 1);
+      if (begin >= end)
+        return;
+    }
+    engine.m_pairKernel.accumulateSymmetric(self, selfSlot, neighbors,
+                                            begin, end, forces, reaction);
+  }
 };
 
-struct FlockEngine::TakeStepFunctor
+// Evaluates the pairs of every agent in a range of chunks into each
+// chunk's buffer.
+struct FlockEngine::SymmetricChunkFunctor
 {
-  TakeStepFunctor(FlockEngine &w) : engine(w) {}
+  SymmetricChunkFunctor(FlockEngine &e) : engine(e) {}
   FlockEngine &engine;
 
-  typedef TakeStepResult result_type;
+  void operator()(int begin, int end) const
+  {
+    for (int c = begin; c < end; ++c)
+      this->evaluate(engine.m_pairChunks[c]);
+  }
+
+  void evaluate(PairChunk &chunk) const
+  {
+    const EntityStore &s = engine.m_store;
+    const NeighborArrays &a = engine.m_neighbors;
+    const int *indices = engine.m_cellList.indices();
+    const int stride = engine.m_pairStride;
+
+    chunk.forces.fill(0., NumPairComponents * stride);
+    double *buffer = chunk.forces.data();
+
+    PairKernel::Neighbors neighbors;
+    neighbors.x = a.x.constData();
+    neighbors.y = a.y.constData();
+    neighbors.z = a.z.constData();
+    neighbors.dx = a.dx.constData();
+    neighbors.dy = a.dy.constData();
+    neighbors.dz = a.dz.constData();
+    neighbors.type = a.type.constData();
+    neighbors.predator = a.predator.constData();
+
+    PairKernel::Reaction reaction;
+    for (int d = 0; d < 3; ++d) {
+      reaction.diffPot[d] = buffer + (DiffPotComponent + d) * stride;
+      reaction.samePot[d] = buffer + (SamePotComponent + d) * stride;
+      reaction.align[d] = buffer + (AlignComponent + d) * stride;
+      reaction.predator[d] = buffer + (PredatorComponent + d) * stride;
+    }
+    reaction.caught = buffer + CaughtComponent * stride;
+
+    for (int slot = chunk.begin; slot < chunk.end; ++slot) {
+      const int i = indices[slot];
+      if (!s.isAgent(i))
+        continue;
+
+      PairKernel::Self self;
+      self.x = a.x[slot];
+      self.y = a.y[slot];
+      self.z = a.z[slot];
+      self.dx = a.dx[slot];
+      self.dy = a.dy[slot];
+      self.dz = a.dz[slot];
+      self.type = a.type[slot];
+      self.predator = a.predator[slot] == 1.;
+
+      PairKernel::Forces forces;
+      forces.clear();
+      SymmetricRangeFunctor functor(engine, slot, self, neighbors, &forces,
+                                    reaction);
+      engine.m_cellList.forEachCandidateRange(
+            self.x, self.y, self.z,
+            self.predator ? predatorCutoff : alignCutoff, functor);
+
+      for (int d = 0; d < 3; ++d) {
+        reaction.diffPot[d][slot] += forces.diffPot[d];
+        reaction.samePot[d][slot] += forces.samePot[d];
+        reaction.align[d][slot] += forces.align[d];
+        reaction.predator[d][slot] += forces.predator[d];
+      }
+    }
+  }
+};
 
-  FlockEngine::TakeStepResult operator()(const Flocker *f)
+// Sums the chunk buffers into the first one, in chunk order.
+struct FlockEngine::ReduceFunctor
+{
+  ReduceFunctor(FlockEngine &e, int n) : engine(e), numChunks(n) {}
+  FlockEngine &engine;
+  int numChunks;
+
+  void operator()(int begin, int end) const
   {
-    return engine.takeStepWorker(f);
+    QVector<PairChunk> &chunks = engine.m_pairChunks;
+    const int stride = engine.m_pairStride;
+    double *total = chunks[0].forces.data();
+    for (int c = 1; c < numChunks; ++c) {
+      const double *forces = chunks[c].forces.constData();
+      for (int comp = 0; comp < NumPairComponents; ++comp) {
+        const int offset = comp * stride;
+        for (int slot = begin; slot < end; ++slot)
+          total[offset + slot] += forces[offset + slot];
+      }
+    }
+  }
+};
+
+// Gathers neighbors by entity index into a small structure-of-arrays buffer
+// and runs the pair kernel on it whenever it fills up. Used for the agents
+// that aren't in the Verlet lists yet.
+struct FlockEngine::VerletBatch
+{
+  enum {
+    Capacity = 64,
+    // Room for PairKernel::paddingLanes() inert lanes past the end
+    Padded = Capacity + 16
+  };
+
+  VerletBatch(const FlockEngine &e, const PairKernel::Self &s,
+              PairKernel::Forces *f)
+    : engine(e), self(s), forces(f), size(0)
+  {
+    Q_ASSERT(PairKernel::paddingLanes() <= Padded - Capacity);
+    neighbors.x = x;
+    neighbors.y = y;
+    neighbors.z = z;
+    neighbors.dx = dx;
+    neighbors.dy = dy;
+    neighbors.dz = dz;
+    neighbors.type = type;
+    neighbors.predator = predator;
+  }
+  const FlockEngine &engine;
+  const PairKernel::Self &self;
+  PairKernel::Forces *forces;
+  PairKernel::Neighbors neighbors;
+  int size;
+  double x[Padded];
+  double y[Padded];
+  double z[Padded];
+  double dx[Padded];
+  double dy[Padded];
+  double dz[Padded];
+  double type[Padded];
+  double predator[Padded];
+
+  void add(int j)
+  {
+    const EntityStore &s = engine.m_store;
+    x[size] = s.x()[j];
+    y[size] = s.y()[j];
+    z[size] = s.z()[j];
+    dx[size] = s.dx()[j];
+    dy[size] = s.dy()[j];
+    dz[size] = s.dz()[j];
+    type[size] = s.type(j);
+    predator[size] = s.kind(j) == EntityStore::PredatorKind ? 1. : 0.;
+    if (++size == Capacity)
+      this->flush();
+  }
+
+  void flush()
+  {
+    if (size == 0)
+      return;
+    for (int k = size; k < Padded; ++k) {
+      x[k] = y[k] = z[k] = farAway;
+      dx[k] = dy[k] = dz[k] = type[k] = predator[k] = 0.;
+    }
+    engine.m_pairKernel.accumulate(self, neighbors, 0, size, forces);
+    size = 0;
   }
 };
 
@@ -167,19 +459,107 @@ bool isNan(double d)
 }
 } // end anon namespace
 
+void FlockEngine::accumulatePair(int i, int j, PairForces *forces,
+                                 TakeStepResult *result) const
+{
+  if (i == j)
+    return;
+
+  const EntityStore &s = m_store;
+  const bool pred_i = s.kind(i) == EntityStore::PredatorKind;
+
+  // General cutoff
+  const double cutoff = pred_i ? predatorCutoff : alignCutoff;
+
+  Eigen::Vector3d r(s.x()[j] - s.x()[i],
+                    s.y()[j] - s.y()[i],
+                    s.z()[j] - s.z()[i]);
+  if (r.squaredNorm() > cutoff * cutoff)
+    return;
+
+  const double rNorm = r.norm();
+
+  const double rInvNorm = rNorm > minInvertNorm ? 1.0 / rNorm : 1.0;
+
+  const bool pred_j = s.kind(j) == EntityStore::PredatorKind;
+
+  // Neither are predators, use morse potential
+  bool bothArePredators = pred_i && pred_j;
+  bool neitherArePredators = !pred_i && !pred_j;
+  bool typesMatch = s.type(i) == s.type(j);
+
+  if (neitherArePredators || (bothArePredators && typesMatch)) {
+    double V = std::numeric_limits<double>::max();
+
+    // Apply cutoff for morse interaction
+    if (rNorm < morseCutoff) {
+      V = m_forceLaw.derivative(rNorm);
+      forces->diffPotForce += (V*rInvNorm*rInvNorm) * r;
+    }
+
+    // Alignment -- steer towards the heading of nearby flockers
+    if (typesMatch &&
+        rNorm < alignCutoff && rNorm > minAlignNorm) {
+      if (V == std::numeric_limits<double>::max()) {
+        V = m_forceLaw.derivative(rNorm);
+      }
+      forces->samePotForce += (V *rInvNorm*rInvNorm) * r;
+      forces->alignForce += rInvNorm * s.direction(j);
+    }
+  }
+  else if (bothArePredators && !typesMatch) {
+    r = -r;
+    if (rNorm < predatorRepelCutoff) {
+      //                      2    normalize     1/r2     vector
+      forces->predatorForce += 2. * rInvNorm * (rInvNorm * rInvNorm) * r;
+    }
+  }
+  // One is a predator, one is not. Evade / Pursue
+  else {
+    // Point from the predator to the flocker
+    if (!pred_i)
+      r = -r;
+
+    if (pred_j) {
+      // The flocker is being updated
+      if (rNorm < evadeCutoff) {
+        // Did the predator catch the flocker?
+        if (rNorm < killRadius) {
+          result->dead = true;
+        }
+        else {
+          //                      normalize               1/r^3            vector
+          forces->predatorForce += rInvNorm * (rInvNorm * rInvNorm * rInvNorm) * r;
+        }
+      }
+    }
+    // The predator is being updated
+    else {
+      // Cutoff distance for predator
+      if (rNorm < pursueCutoff) {
+        //                      2    normalize          1/r*2         vector
+        forces->predatorForce += 2. * rInvNorm * (rInvNorm * rInvNorm) * r;
+      }
+      else {
+        //                      normalize     1/r     vector
+        forces->predatorForce += rInvNorm * (rInvNorm) * r;
+      }
+    }
+  }
+}
+
 FlockEngine::TakeStepResult
-FlockEngine::takeStepWorker(const Flocker *f_i) const
+FlockEngine::takeStepWorker(int i) const
 {
-  const bool pred_i = f_i->eType() == Entity::PredatorEntity;
+  const EntityStore &s = m_store;
+  const bool pred_i = s.kind(i) == EntityStore::PredatorKind;
+  const Eigen::Vector3d pos_i = s.pos(i);
+  const Eigen::Vector3d dir_i = s.direction(i);
 
   TakeStepResult result;
-  result.deadTarget = NULL;
-  result.deadFlocker = NULL;
+  result.deadTarget = -1;
+  result.dead = false;
 
-  Eigen::Vector3d samePotForce(0., 0., 0.);
-  Eigen::Vector3d diffPotForce(0., 0., 0.);
-  Eigen::Vector3d alignForce(0., 0., 0.);
-  Eigen::Vector3d predatorForce(0., 0., 0.);
   Eigen::Vector3d targetForce(0., 0., 0.);
   Eigen::Vector3d boundaryForce(0., 0., 0.);
   Eigen::Vector3d r(0., 0., 0.);
@@ -188,10 +568,10 @@ FlockEngine::takeStepWorker(const Flocker *f_i) const
     // Calculate a distance-weighted average vector towards the relevant
     // targets
     if (!pred_i) {
-      foreach (const Target *t, m_targets[f_i->type()]) {
-        r = t->pos() - f_i->pos();
+      foreach (int t, m_targets[s.type(i)]) {
+        r = s.pos(t) - pos_i;
         const double rNorm = r.norm();
-        if (rNorm < 0.025)
+        if (rNorm < targetReachRadius)
           result.deadTarget = t;
         else
           targetForce += (1.0/(rNorm*rNorm*rNorm*rNorm)) * r;
@@ -200,104 +580,84 @@ FlockEngine::takeStepWorker(const Flocker *f_i) const
   }
   else {
     // Ignore targets and pull towards clicked point.
-    r = m_forceTarget - f_i->pos();
+    r = m_forceTarget - pos_i;
     const double rNorm = r.norm();
     if (rNorm > 0.01)
       targetForce = (1.0/(rNorm*rNorm*rNorm)) * r;
   }
 
   // Average together V(|r_ij|) * r_ij
-  foreach (const Flocker *f_j, m_flockers) {
-    if (f_i == f_j) continue;
-    r = f_j->pos() - f_i->pos();
-
-    // General cutoff
-    const double cutoff = pred_i ? 0.6 : 0.3;
-    if (r.x() > cutoff || r.y() > cutoff || r.z() > cutoff)
-      continue;
-
-    const double rNorm = r.norm();
-    const double rInvNorm = rNorm > 0.01 ? 1.0 / rNorm : 1.0;
-
-    const bool pred_j = f_j->eType() == Entity::PredatorEntity;
-
-    // Neither are predators, use morse potential
-    bool bothArePredators = pred_i && pred_j;
-    bool neitherArePredators = !pred_i && !pred_j;
-    bool typesMatch = f_i->type() == f_j->type();
-
-    if (neitherArePredators || (bothArePredators && typesMatch)) {
-      double V = std::numeric_limits<double>::max();
-
-      // Apply cutoff for morse interaction
-      if (rNorm < 0.20) {
-        V = V_morse_ND(rNorm);
-        diffPotForce += (V*rInvNorm*rInvNorm) * r;
-      }
-
-      // Alignment -- steer towards the heading of nearby flockers
-      if (typesMatch &&
-          rNorm < 0.30 && rNorm > 0.001) {
-        if (V == std::numeric_limits<double>::max()) {
-          V = V_morse_ND(rNorm);
-        }
-        samePotForce += (V *rInvNorm*rInvNorm) * r;
-        alignForce += rInvNorm * f_j->direction();
-      }
+  PairForces forces;
+  if (m_neighborSearch == CellListSearch && m_symmetricPairs) {
+    // Reduced by computeSymmetricForces()
+    const double *total = m_pairChunks[0].forces.constData() + m_cellSlot[i];
+    const int stride = m_pairStride;
+    for (int d = 0; d < 3; ++d) {
+      forces.diffPotForce[d] = total[(DiffPotComponent + d) * stride];
+      forces.samePotForce[d] = total[(SamePotComponent + d) * stride];
+      forces.alignForce[d] = total[(AlignComponent + d) * stride];
+      forces.predatorForce[d] = total[(PredatorComponent + d) * stride];
     }
-    else if (bothArePredators && !typesMatch) {
-      r = f_i->pos() - f_j->pos();
-      const double rNorm = r.norm();
-      if (rNorm < 0.5) {
-        const double rInvNorm = rNorm > 0.01 ? 1.0 / rNorm : 1.0;
-        //              2    normalize     1/r2     vector
-        predatorForce = 2. * rInvNorm * (rInvNorm * rInvNorm) * r;
-      }
+    result.dead = total[CaughtComponent * stride] > 0.;
+  }
+  else if (m_neighborSearch == CellListSearch ||
+           m_neighborSearch == VerletListSearch) {
+    PairKernel::Self self;
+    self.x = pos_i.x();
+    self.y = pos_i.y();
+    self.z = pos_i.z();
+    self.dx = dir_i.x();
+    self.dy = dir_i.y();
+    self.dz = dir_i.z();
+    self.type = s.type(i);
+    self.predator = pred_i;
+
+    PairKernel::Forces kernelForces;
+    kernelForces.clear();
+    if (m_neighborSearch == CellListSearch) {
+      KernelRangeFunctor functor(*this, m_neighbors, m_cellSlot[i], self,
+                                 &kernelForces);
+      m_cellList.forEachCandidateRange(pos_i.x(), pos_i.y(), pos_i.z(),
+                                       pred_i ? predatorCutoff : alignCutoff,
+                                       functor);
     }
-    // One is a predator, one is not. Evade / Pursue
     else {
-      const Flocker *p;
-      const Flocker *f;
-      if (pred_i) {
-        p = f_i;
-        f = f_j;
+      const int slot = s.listSlot(i);
+      KernelRangeFunctor functor(*this, m_verletData, slot, self,
+                                 &kernelForces);
+      if (slot >= 0) {
+        const int lastRun = m_verletList.firstRun(slot + 1);
+        for (int run = m_verletList.firstRun(slot); run < lastRun; ++run)
+          functor(m_verletList.runBegin(run), m_verletList.runEnd(run));
       }
       else {
-        p = f_j;
-        f = f_i;
+        // Spawned since the lists were built
+        functor(0, m_verletList.size());
       }
 
-      // Calculate distance between them
-      r = f->pos() - p->pos();
-      const double rNorm = r.norm();
-      const double rInvNorm = rNorm > 0.01 ? 1.0 / rNorm : 1.0;
-      if (pred_j) {
-        // The flocker is being updated
-        if (rNorm < 0.3) {
-          // Did the predator catch the flocker?
-          if (rNorm < killRadius) {
-            result.deadFlocker = f;
-          }
-          else {
-            //               normalize               1/r^3               vector
-            predatorForce += rInvNorm * (rInvNorm * rInvNorm * rInvNorm) * r;
-          }
-        }
-      }
-      // The predator is being updated
-      else {
-        // Cutoff distance for predator
-        if (rNorm < 0.15) {
-          //               2    normalize          1/r*2         vector
-          predatorForce += 2. * rInvNorm * (rInvNorm * rInvNorm) * r;
-        }
-        else {
-          //               normalize     1/r     vector
-          predatorForce += rInvNorm * (rInvNorm) * r;
-        }
+      VerletBatch batch(*this, self, &kernelForces);
+      foreach (int j, m_verletRecent) {
+        if (j != i)
+          batch.add(j);
       }
+      batch.flush();
     }
+
+    forces.diffPotForce = Eigen::Vector3d(kernelForces.diffPot);
+    forces.samePotForce = Eigen::Vector3d(kernelForces.samePot);
+    forces.alignForce = Eigen::Vector3d(kernelForces.align);
+    forces.predatorForce = Eigen::Vector3d(kernelForces.predator);
+    result.dead = kernelForces.caught;
   }
+  else {
+    foreach (int j, m_agents)
+      accumulatePair(i, j, &forces, &result);
+  }
+
+  Eigen::Vector3d &samePotForce = forces.samePotForce;
+  Eigen::Vector3d &diffPotForce = forces.diffPotForce;
+  Eigen::Vector3d &alignForce = forces.alignForce;
+  Eigen::Vector3d &predatorForce = forces.predatorForce;
 
   // Repel boundaries
   const double minBound = boundaryRMax;
@@ -306,14 +666,14 @@ FlockEngine::takeStepWorker(const Flocker *f_i) const
                                      Eigen::Vector3d(0, 1, 0),
                                      Eigen::Vector3d(0, 0, 1) };
 
-  for (size_t i = 0; i < 3; ++i) {
-    if (f_i->pos()[i] < minBound) {
-      const double r2 = f_i->pos()[i] * f_i->pos()[i];
-      boundaryForce += ((boundaryRMax2 - r2) / boundaryRMax2) * basis[i];
+  for (size_t d = 0; d < 3; ++d) {
+    if (pos_i[d] < minBound) {
+      const double r2 = pos_i[d] * pos_i[d];
+      boundaryForce += ((boundaryRMax2 - r2) / boundaryRMax2) * basis[d];
     }
-    if (f_i->pos()[i] > maxBound) {
-      const double r2 = (1.0 - f_i->pos()[i]) * (1.0 - f_i->pos()[i]);
-      boundaryForce -= ((boundaryRMax2 - r2) / boundaryRMax2) * basis[i];
+    if (pos_i[d] > maxBound) {
+      const double r2 = (1.0 - pos_i[d]) * (1.0 - pos_i[d]);
+      boundaryForce -= ((boundaryRMax2 - r2) / boundaryRMax2) * basis[d];
     }
   }
 
@@ -350,21 +710,21 @@ FlockEngine::takeStepWorker(const Flocker *f_i) const
   if (!force.isZero(0.1)) {
     force.normalize();
     // Calculate the rejection of force onto direction:
-    force -= force.dot(f_i->direction()) * f_i->direction();
+    force -= force.dot(dir_i) * dir_i;
   }
 
-  const double directionDotForce = f_i->direction().dot(force);
+  const double directionDotForce = dir_i.dot(force);
   const double scale ((1.0 - 0.5 * (directionDotForce + 1.0)) * maxTurn);
-  result.newDirection = (f_i->direction() + scale * force).normalized();
+  result.newDirection = (dir_i + scale * force).normalized();
 
   //dDF  :    -1     -0.5       0       0.5       1
   //scale:     0.25  ~0.19      0.125  ~0.06      0
 
   // Accelerate towards goal
-  const double goalForce = f_i->direction().dot(0.15 * predatorForce +
+  const double goalForce = dir_i.dot(0.15 * predatorForce +
                                                 0.25 * targetForce +
                                                 0.6 * samePotForce);
-  result.newVelocity = f_i->velocity() * (1.0 + speedupFactor * goalForce);
+  result.newVelocity = s.velocity(i) * (1.0 + speedupFactor * goalForce);
   if (result.newVelocity < m_minSpeed)
     result.newVelocity = m_minSpeed;
   else if (result.newVelocity > m_maxSpeed)
@@ -373,6 +733,150 @@ FlockEngine::takeStepWorker(const Flocker *f_i) const
   return result;
 }
 
+FlockEngine::TakeStepResult FlockEngine::takeMultiRateStep(int i,
+                                                           bool *coasted)
+{
+  const EntityStore &s = m_store;
+  if (s.kind(i) != EntityStore::FlockerKind)
+    return this->takeStepWorker(i);
+
+  // Each entity has its own slot, so the workers never share a state.
+  const EntityStore::Handle handle = s.handle(i);
+  RateState &rate = m_rates[handle.slot];
+  if (rate.generation != handle.generation) {
+    rate = RateState();
+    rate.generation = handle.generation;
+  }
+
+  // Quiet flockers are evaluated in turn, by slot, to spread the load.
+  const Eigen::Vector3d pos = s.pos(i);
+  const bool due = (m_stepCount + handle.slot) % rate.interval == 0;
+  const bool disturbed = this->isDisturbed(pos);
+  if (!due && !disturbed) {
+    *coasted = true;
+    TakeStepResult result;
+    result.dead = false;
+    result.deadTarget = -1;
+    result.newDirection = (s.direction(i) + rate.turn).normalized();
+    result.newVelocity = qBound(m_minSpeed, s.velocity(i) + rate.speedup,
+                                m_maxSpeed);
+    foreach (int t, m_targets[s.type(i)]) {
+      if ((s.pos(t) - pos).norm() < targetReachRadius)
+        result.deadTarget = t;
+    }
+    return result;
+  }
+
+  // Steady turns are fine; it's a change of course that coasting would
+  // miss.
+  const TakeStepResult result = this->takeStepWorker(i);
+  const Eigen::Vector3d turn = result.newDirection - s.direction(i);
+  const double speedup = result.newVelocity - s.velocity(i);
+  const double change = qMax((turn - rate.turn).norm() / quietTurn,
+                             qAbs(speedup - rate.speedup) /
+                             (quietSpeedup * s.velocity(i)));
+  rate.active = change > stirFactor;
+  rate.turn = turn;
+  rate.speedup = speedup;
+  if (change > 1. || disturbed)
+    rate.interval = 1;
+  else
+    rate.interval = qMin(maxRateInterval, 2 * rate.interval);
+  return result;
+}
+
+bool FlockEngine::coasts() const
+{
+  return m_multiRate &&
+      !(m_neighborSearch == CellListSearch && m_symmetricPairs);
+}
+
+bool FlockEngine::isDisturbed(const Eigen::Vector3d &pos) const
+{
+  // The click target moves with the mouse
+  if (m_useForceTarget)
+    return true;
+
+  int cell[3];
+  for (int d = 0; d < 3; ++d) {
+    cell[d] = qBound(0, static_cast<int>(pos[d] * activityGridSize),
+                     activityGridSize - 1);
+  }
+  if (m_activeCells[(cell[2] * activityGridSize + cell[1]) *
+                    activityGridSize + cell[0]])
+    return true;
+
+  // A steady chase extrapolates well enough. A predator that could come
+  // into or out of evadeCutoff, or within killRadius, before the next
+  // evaluation can't be coasted past.
+  const double margin = 2. * maxRateInterval * m_maxSpeed * m_stepSize;
+  foreach (int p, m_predators) {
+    const double r = (m_store.pos(p) - pos).norm();
+    if (r < killRadius + margin || qAbs(r - evadeCutoff) < margin)
+      return true;
+  }
+  return false;
+}
+
+void FlockEngine::markActivity()
+{
+  const int numCells = activityGridSize * activityGridSize * activityGridSize;
+  m_numAllocations += reserveGrowth(m_predators, m_agents.size());
+  m_numAllocations += reserveGrowth(m_activeCells, numCells);
+  m_predators.resize(0);
+  m_activeCells.fill(0, numCells);
+
+  quint32 maxSlot = 0;
+  foreach (int i, m_agents)
+    maxSlot = qMax(maxSlot, m_store.handle(i).slot);
+  if (static_cast<int>(maxSlot) >= m_rates.size()) {
+    m_numAllocations += reserveGrowth(m_rates, maxSlot + 1);
+    m_rates.resize(maxSlot + 1);
+  }
+
+  foreach (int i, m_agents) {
+    if (m_store.kind(i) == EntityStore::PredatorKind) {
+      m_predators.push_back(i);
+      continue;
+    }
+
+    // Flockers new to their slot haven't been evaluated yet, so count as
+    // active.
+    const EntityStore::Handle handle = m_store.handle(i);
+    const RateState &rate = m_rates[handle.slot];
+    if (rate.generation == handle.generation && !rate.active)
+      continue;
+
+    int cell[3];
+    for (int d = 0; d < 3; ++d) {
+      cell[d] = qBound(0, static_cast<int>(m_store.pos(i)[d] *
+                                           activityGridSize),
+                       activityGridSize - 1);
+    }
+    for (int z = qMax(0, cell[2] - 1);
+         z <= qMin(activityGridSize - 1, cell[2] + 1); ++z) {
+      for (int y = qMax(0, cell[1] - 1);
+           y <= qMin(activityGridSize - 1, cell[1] + 1); ++y) {
+        for (int x = qMax(0, cell[0] - 1);
+             x <= qMin(activityGridSize - 1, cell[0] + 1); ++x) {
+          m_activeCells[(z * activityGridSize + y) * activityGridSize + x] = 1;
+        }
+      }
+    }
+  }
+}
+
+bool FlockEngine::multiRate() const
+{
+  return m_multiRate;
+}
+
+void FlockEngine::setMultiRate(bool multiRate)
+{
+  m_future.waitForFinished();
+  m_multiRate = multiRate;
+}
+
 double FlockEngine::stepSize() const
 {
   return m_stepSize;
@@ -383,16 +887,170 @@ void FlockEngine::setStepSize(double size)
   m_stepSize = size;
 }
 
+PairKernel::Isa FlockEngine::pairKernelIsa() const
+{
+  return m_pairKernel.isa();
+}
+
+void FlockEngine::setPairKernelIsa(PairKernel::Isa isa)
+{
+  m_future.waitForFinished();
+  m_pairKernel.setIsa(isa);
+}
+
+ForceLaw::Mode FlockEngine::forceLawMode() const
+{
+  return m_forceLaw.mode();
+}
+
+void FlockEngine::setForceLawMode(ForceLaw::Mode mode)
+{
+  // Both laws change, and a step must see them change together
+  m_future.waitForFinished();
+  m_forceLaw.setMode(mode);
+  m_pairKernel.setForceLaw(m_forceLaw.mode());
+}
+
+quint64 FlockEngine::numAllocations() const
+{
+  return m_numAllocations + m_store.numAllocations() +
+      m_cellList.numAllocations() + m_verletList.numAllocations();
+}
+
+int FlockEngine::threadCount() const
+{
+  return m_pool.numThreads();
+}
+
+void FlockEngine::setThreadCount(int count)
+{
+  m_future.waitForFinished();
+  m_pool.setNumThreads(count);
+}
+
+bool FlockEngine::symmetricPairs() const
+{
+  return m_symmetricPairs;
+}
+
+void FlockEngine::setSymmetricPairs(bool symmetric)
+{
+  // takeStepWorker() reads it for every agent
+  m_future.waitForFinished();
+  m_symmetricPairs = symmetric;
+}
+
+double FlockEngine::verletSkin() const
+{
+  return m_verletList.skin();
+}
+
+void FlockEngine::setVerletSkin(double skin)
+{
+  m_future.waitForFinished();
+  m_verletList.setSkin(skin);
+}
+
+quint64 FlockEngine::verletRebuilds() const
+{
+  return m_verletList.numRebuilds();
+}
+
+const char * FlockEngine::neighborSearchName(NeighborSearch search)
+{
+  switch (search) {
+  case BruteForceSearch:
+    return "brute force";
+  case CellListSearch:
+    return "cell list";
+  case VerletListSearch:
+    return "Verlet lists";
+  default:
+    return "unknown";
+  }
+}
+
+FlockEngine::NeighborSearch FlockEngine::neighborSearch() const
+{
+  return m_neighborSearch;
+}
+
+void FlockEngine::setNeighborSearch(NeighborSearch search)
+{
+  // The running step reads it for every agent
+  m_future.waitForFinished();
+  m_neighborSearch = search;
+}
+
+unsigned int FlockEngine::numFlockers() const
+{
+  return m_numFlockers;
+}
+
+void FlockEngine::setNumFlockers(unsigned int num)
+{
+  m_numFlockers = num;
+}
+
 unsigned int FlockEngine::numTargetsPerFlockerType() const
 {
   return m_numTargetsPerFlockerType;
 }
 
+void FlockEngine::setNumTargetsPerFlockerType(unsigned int num)
+{
+  m_numTargetsPerFlockerType = num;
+}
+
 unsigned int FlockEngine::numFlockerTypes() const
 {
   return m_numFlockerTypes;
 }
 
+void FlockEngine::setNumFlockerTypes(unsigned int num)
+{
+  m_numFlockerTypes = qMax(1u, num);
+}
+
+unsigned int FlockEngine::numPredators() const
+{
+  return m_numPredators;
+}
+
+void FlockEngine::setNumPredators(unsigned int num)
+{
+  m_numPredators = num;
+}
+
+unsigned int FlockEngine::numPredatorTypes() const
+{
+  return m_numPredatorTypes;
+}
+
+void FlockEngine::setNumPredatorTypes(unsigned int num)
+{
+  m_numPredatorTypes = qMax(1u, num);
+}
+
+quint64 FlockEngine::seed() const
+{
+  return m_seed;
+}
+
+void FlockEngine::reset(quint64 seed)
+{
+  m_future.waitForFinished();
+
+  m_store.clear();
+  m_entityIdHead = 0;
+  m_stepCount = 0;
+  m_seed = seed;
+
+  this->initializeFlockers();
+  this->initializePredators();
+  this->initializeTargets();
+}
+
 bool FlockEngine::createBlasts() const
 {
   return m_createBlasts;
@@ -403,282 +1061,610 @@ void FlockEngine::setCreateBlasts(bool b)
   m_createBlasts = b;
 }
 
-QColor FlockEngine::typeToColor(const unsigned int type)
+// Writes the next frame of a range of m_agents from the current one, and
+// collects the agents that die and the targets they reach. Agents steer and
+// move in one go, so every read sees the current frame and every write goes
+// to the next.
+struct FlockEngine::AgentStepFunctor
 {
-  static const unsigned int numColors = 12;
-  const unsigned int colorMod = (m_numFlockerTypes < numColors)
-                                ? m_numFlockerTypes : numColors;
+  AgentStepFunctor(FlockEngine &e, double t) : engine(e), m_t(t) {}
+  FlockEngine &engine;
+  double m_t;
 
-  switch (type % colorMod)
+  void operator()(int chunk, int begin, int end) const
   {
-  case 0:
-    return QColor(Qt::blue);
-  case 1:
-    return QColor(Qt::darkCyan);
-  case 2:
-    return QColor(Qt::green);
-  case 3:
-    return QColor(Qt::yellow);
-  case 4:
-    return QColor(Qt::white);
-  case 5:
-    return QColor(Qt::cyan);
-  case 6:
-    return QColor(Qt::magenta);
-  case 7:
-    return QColor(Qt::darkGray);
-  case 8:
-    return QColor(Qt::lightGray);
-  case 9:
-    return QColor(Qt::darkMagenta);
-  case 10:
-    return QColor(Qt::darkBlue);
-  case 11:
-    return QColor(Qt::darkGreen);
-  default:
-    qWarning() << "Unrecognized type:" << type;
-    return QColor();
+    DeadEntities *dead = &engine.m_dead[chunk];
+    const int *agents = engine.m_agents.constData();
+    const bool coasts = engine.coasts();
+    for (int a = begin; a < end; ++a) {
+      const int i = agents[a];
+      bool coasted = false;
+      const TakeStepResult result =
+          coasts ? engine.takeMultiRateStep(i, &coasted)
+                 : engine.takeStepWorker(i);
+      if (coasted)
+        ++dead->coasted;
+      engine.stepFlocker(i, result, m_t);
+      if (result.dead)
+        dead->agents.push_back(i);
+      if (result.deadTarget >= 0)
+        dead->targets.push_back(result.deadTarget);
+    }
   }
-}
+};
 
-namespace {
-struct EntityStepFunctor
+// Moves the targets of a range of flocker types.
+struct FlockEngine::TargetStepFunctor
 {
+  TargetStepFunctor(FlockEngine &e, double t) : engine(e), m_t(t) {}
+  FlockEngine &engine;
   double m_t;
-  EntityStepFunctor(double t) : m_t(t) {}
-  void operator()(Entity *e) const { e->takeStep(m_t); }
+
+  void operator()(int begin, int end) const
+  {
+    for (int t = begin; t < end; ++t) {
+      foreach (int i, engine.m_targets[t])
+        engine.stepTarget(i, m_t);
+    }
+  }
 };
-}
 
-void FlockEngine::computeNextStep()
+// Ages a range of m_blasts and collects the ones that expire.
+struct FlockEngine::BlastStepFunctor
 {
-  Q_ASSERT(!m_future.isRunning());
-  m_future = QtConcurrent::mapped(m_flockers, TakeStepFunctor(*this));
+  BlastStepFunctor(FlockEngine &e) : engine(e) {}
+  FlockEngine &engine;
+
+  void operator()(int chunk, int begin, int end) const
+  {
+    DeadEntities *dead = &engine.m_dead[chunk];
+    const int *blasts = engine.m_blasts.constData();
+    for (int b = begin; b < end; ++b) {
+      if (engine.stepBlast(blasts[b]))
+        dead->blasts.push_back(blasts[b]);
+    }
+  }
+};
+
+int FlockEngine::NeighborArrays::reserve(int size)
+{
+  return reserveGrowth(x, size) + reserveGrowth(y, size) +
+      reserveGrowth(z, size) + reserveGrowth(dx, size) +
+      reserveGrowth(dy, size) + reserveGrowth(dz, size) +
+      reserveGrowth(type, size) + reserveGrowth(predator, size);
 }
 
-void FlockEngine::commitNextStep()
+void FlockEngine::rebuildCellList()
 {
-  Q_ASSERT(m_future.isStarted());
-  m_future.waitForFinished();
+  TraceSpan span("engine", "rebuild cell list");
+  const int count = m_store.size();
+  m_cellList.rebuild(m_store.x(), m_store.y(), m_store.z(), count, m_pool);
+
+  // The kernel may read past the end of a range; pad with inert lanes.
+  const int padded = count + PairKernel::paddingLanes();
+  NeighborArrays &a = m_neighbors;
+  m_numAllocations += a.reserve(padded);
+  m_numAllocations += reserveGrowth(m_cellSlot, count);
+  a.x.fill(farAway, padded);
+  a.y.fill(farAway, padded);
+  a.z.fill(farAway, padded);
+  a.dx.resize(padded);
+  a.dy.resize(padded);
+  a.dz.resize(padded);
+  a.type.resize(padded);
+  a.predator.resize(padded);
+  m_cellSlot.resize(count);
+
+  GatherFunctor gather(*this);
+  m_pool.parallelFor(count, gather, minChunkSize);
+}
 
-  QVector<Flocker*> deadFlockers;
-  QVector<Target*> deadTargets;
+// Finds the largest distance a range of Verlet slots has moved since the
+// lists were built.
+struct FlockEngine::DisplacementFunctor
+{
+  DisplacementFunctor(const FlockEngine &e) : engine(e) {}
+  const FlockEngine &engine;
 
-  QLinkedList<Flocker*>::iterator current = m_flockers.begin();
-  foreach (const TakeStepResult &result, m_future.results()) {
-    (*current)->direction() = result.newDirection;
-    (*current)->velocity() = result.newVelocity;
-    if (result.deadFlocker)
-      deadFlockers.push_back(const_cast<Flocker*>(result.deadFlocker));
-    if (result.deadTarget)
-      deadTargets.push_back(const_cast<Target*>(result.deadTarget));
-    ++current;
+  void operator()(int begin, int end, double *max) const
+  {
+    *max = qMax(*max, engine.m_verletList.maxDisplacement(
+                  engine.m_verletX.constData(), engine.m_verletY.constData(),
+                  engine.m_verletZ.constData(), begin, end));
   }
 
-  QVector<Blast*> deadBlasts;
-  deadBlasts.reserve(m_blasts.size());
-  foreach (Blast *b, m_blasts) {
-    if (b->done())
-      deadBlasts.push_back(b);
+  void operator()(double *total, double max) const
+  {
+    *total = qMax(*total, max);
   }
+};
 
-  foreach (Blast *b, deadBlasts)
-    removeBlast(b);
-
-  foreach (Flocker *f, deadFlockers) {
-    this->removeFlocker(f);
-    if (!m_createBlasts)
-      this->addBlastFromEntity(f);
+void FlockEngine::updateVerletList()
+{
+  TraceSpan span("engine", "update Verlet list");
+  const bool valid = m_verletList.isValid();
+  const int count = m_verletList.size();
+  const int numAgents = m_agents.size();
+  m_numAllocations += reserveGrowth(m_verletIndex, qMax(count, numAgents));
+  m_numAllocations += reserveGrowth(m_verletRecent, numAgents);
+  m_verletIndex.fill(-1, count);
+  m_verletRecent.resize(0);
+  foreach (int i, m_agents) {
+    const int slot = m_store.listSlot(i);
+    if (valid && slot >= 0 && slot < count) {
+      m_verletIndex[slot] = i;
+      m_verletX[slot] = m_store.x()[i];
+      m_verletY[slot] = m_store.y()[i];
+      m_verletZ[slot] = m_store.z()[i];
+    }
+    else {
+      m_verletRecent.push_back(i);
+    }
   }
 
-  foreach (Target *t, deadTargets) {
-    this->addFlockerFromEntity(t);
-    this->randomizeTarget(t);
+  // Every agent checks the recent ones directly and vice versa, so rebuild
+  // before that costs more than the lists save.
+  const int maxRecent = qMax(minVerletRecent, numAgents / 16);
+  bool rebuild = !valid || m_verletRecent.size() > maxRecent;
+  if (!rebuild) {
+    DisplacementFunctor displacement(*this);
+    const double maxDisplacement =
+        m_pool.parallelReduce(count, 0., displacement, displacement,
+                              minChunkSize);
+    rebuild = 2. * maxDisplacement > m_verletList.skin();
+  }
+  if (rebuild) {
+    m_numAllocations += reserveGrowth(m_verletCutoff, numAgents);
+    m_numAllocations += reserveGrowth(m_verletX, numAgents);
+    m_numAllocations += reserveGrowth(m_verletY, numAgents);
+    m_numAllocations += reserveGrowth(m_verletZ, numAgents);
+    m_verletCutoff.resize(numAgents);
+    m_verletX.resize(numAgents);
+    m_verletY.resize(numAgents);
+    m_verletZ.resize(numAgents);
+    for (int a = 0; a < numAgents; ++a) {
+      const int i = m_agents[a];
+      m_verletX[a] = m_store.x()[i];
+      m_verletY[a] = m_store.y()[i];
+      m_verletZ[a] = m_store.z()[i];
+      m_verletCutoff[a] = m_store.kind(i) == EntityStore::PredatorKind
+          ? predatorCutoff : alignCutoff;
+    }
+    m_verletList.build(m_verletX.constData(), m_verletY.constData(),
+                       m_verletZ.constData(), m_verletCutoff.constData(),
+                       numAgents, m_pool);
+
+    // From here on everything is in slot order
+    m_verletIndex.resize(numAgents);
+    for (int slot = 0; slot < numAgents; ++slot) {
+      const int i = m_agents[m_verletList.pointAt(slot)];
+      m_store.setListSlot(i, slot);
+      m_verletIndex[slot] = i;
+      m_verletX[slot] = m_store.x()[i];
+      m_verletY[slot] = m_store.y()[i];
+      m_verletZ[slot] = m_store.z()[i];
+    }
+    m_verletRecent.resize(0);
   }
 
-  QFuture<void> stepFuture = QtConcurrent::map(m_entities,
-                                               EntityStepFunctor(m_stepSize));
-  qApp->processEvents();
-  stepFuture.waitForFinished();
+  // The kernel may read past the end of a range; pad with inert lanes.
+  NeighborArrays &d = m_verletData;
+  const int numSlots = m_verletList.size();
+  const int padded = numSlots + PairKernel::paddingLanes();
+  m_numAllocations += d.reserve(padded);
+  d.x.fill(farAway, padded);
+  d.y.fill(farAway, padded);
+  d.z.fill(farAway, padded);
+  d.dx.fill(0., padded);
+  d.dy.fill(0., padded);
+  d.dz.fill(0., padded);
+  d.type.fill(0., padded);
+  d.predator.fill(0., padded);
+  for (int slot = 0; slot < numSlots; ++slot) {
+    const int i = m_verletIndex[slot];
+    if (i < 0)
+      continue;
+    d.x[slot] = m_store.x()[i];
+    d.y[slot] = m_store.y()[i];
+    d.z[slot] = m_store.z()[i];
+    d.dx[slot] = m_store.dx()[i];
+    d.dy[slot] = m_store.dy()[i];
+    d.dz[slot] = m_store.dz()[i];
+    d.type[slot] = m_store.type(i);
+    d.predator[slot] = m_store.kind(i) == EntityStore::PredatorKind ? 1. : 0.;
+  }
 }
 
-void FlockEngine::initializeFlockers()
+void FlockEngine::computeNextStep()
 {
-  this->cleanupFlockers();
+  Q_ASSERT(!m_future.isRunning());
+  QElapsedTimer timer;
+  timer.start();
+  TraceSpan span("engine", "step setup");
+
+  // Index the agents, each type's targets and the blasts for the workers.
+  const int numEntities = m_store.size();
+  const int numAgents = m_store.count(EntityStore::FlockerKind) +
+      m_store.count(EntityStore::PredatorKind);
+  const int numTargets = m_store.count(EntityStore::TargetKind);
+  const int numBlasts = m_store.count(EntityStore::BlastKind);
+  // Sized for the whole store: the mix of kinds moves more than the total.
+  m_numAllocations += reserveGrowth(m_agents, numEntities);
+  m_numAllocations += reserveGrowth(m_blasts, numEntities);
+  m_agents.resize(0);
+  m_blasts.resize(0);
+  m_targets.resize(m_numFlockerTypes);
+  for (int t = 0; t < m_targets.size(); ++t) {
+    m_numAllocations += reserveGrowth(m_targets[t], numTargets);
+    m_targets[t].resize(0);
+  }
+
+  // The step's lists of the dead, one per chunk. No chunk can lose more
+  // entities than it holds, and an agent reaches one target at most. As
+  // above, the room is what a chunk of the whole store could hold. Lists
+  // past this step's chunks are cleared too.
+  const int numChunks =
+      qMax(m_pool.numChunks(numAgents, minAgentGrain),
+           m_pool.numChunks(numBlasts, minChunkSize));
+  const int agentGrain =
+      qMin(numEntities, m_pool.grainSize(numEntities, minAgentGrain));
+  const int blastGrain =
+      qMin(numEntities, m_pool.grainSize(numEntities, minChunkSize));
+  m_numAllocations += resizeGrowth(m_dead, numChunks);
+  for (int c = 0; c < m_dead.size(); ++c) {
+    DeadEntities &dead = m_dead[c];
+    m_numAllocations += reserveGrowth(dead.agents, agentGrain);
+    m_numAllocations += reserveGrowth(dead.targets, agentGrain);
+    m_numAllocations += reserveGrowth(dead.blasts, blastGrain);
+    dead.agents.resize(0);
+    dead.targets.resize(0);
+    dead.blasts.resize(0);
+    dead.coasted = 0;
+  }
 
-  for (unsigned int i = 0; i < m_numFlockers; ++i) {
-    this->addRandomFlocker();
+  for (int i = 0; i < numEntities; ++i) {
+    switch (m_store.kind(i)) {
+    case EntityStore::FlockerKind:
+    case EntityStore::PredatorKind:
+      m_agents.push_back(i);
+      break;
+    case EntityStore::TargetKind:
+      m_targets[m_store.type(i)].push_back(i);
+      break;
+    case EntityStore::BlastKind:
+      m_blasts.push_back(i);
+      break;
+    default:
+      break;
+    }
   }
+
+  if (m_neighborSearch == CellListSearch)
+    this->rebuildCellList();
+  else if (m_neighborSearch == VerletListSearch)
+    this->updateVerletList();
+
+  // Rates left from before coasting stopped would be stale when it starts
+  // again. markActivity() refills them as new.
+  if (this->coasts())
+    this->markActivity();
+  else
+    m_rates.resize(0);
+
+  m_timings.setup = timer.nsecsElapsed();
+  m_future = QtConcurrent::run(this, &FlockEngine::computeStep);
 }
 
-void FlockEngine::cleanupFlockers()
+void FlockEngine::computeStep()
 {
-  foreach (Flocker *f, m_flockers) {
-    m_entities.removeOne(f);
-  }
-  qDeleteAll(m_flockers);
-  m_flockers.clear();
-  m_predators.clear();
+  QElapsedTimer timer;
+  timer.start();
+  TraceSpan span("engine", "forces + integration");
+
+  if (m_neighborSearch == CellListSearch && m_symmetricPairs)
+    this->computeSymmetricForces();
+
+  // Each chunk has its own lists of the dead, so they come out in index
+  // order whatever the scheduling. There are only a few targets, so this
+  // thread moves them; blasts are cheap and get coarse chunks.
+  TraceSpan stepSpan("engine", "step entities");
+  AgentStepFunctor stepAgents(*this, m_stepSize);
+  m_pool.parallelForChunks(m_agents.size(), stepAgents, minAgentGrain);
+  TargetStepFunctor stepTargets(*this, m_stepSize);
+  stepTargets(0, m_targets.size());
+  BlastStepFunctor stepBlasts(*this);
+  m_pool.parallelForChunks(m_blasts.size(), stepBlasts, minChunkSize);
+
+  m_timings.forces = timer.nsecsElapsed();
 }
 
-void FlockEngine::addFlockerFromEntity(const Entity *e)
+void FlockEngine::computeSymmetricForces()
 {
-  Flocker *newFlocker = new Flocker (m_entityIdHead++, e->type());
-  newFlocker->pos() = e->pos();
-  newFlocker->direction() = e->direction();
-  newFlocker->velocity() = e->velocity();
-  newFlocker->color() = e->color();
+  TraceSpan span("engine", "symmetric forces");
+  const int count = m_store.size();
+  m_pairStride = count + PairKernel::paddingLanes();
+
+  // One chunk per thread: each chunk costs a full force buffer to clear and
+  // reduce.
+  const int numChunks = qBound(1, count / minPairChunkSize,
+                               m_pool.numThreads());
+  m_numAllocations += resizeGrowth(m_pairChunks, numChunks);
+  for (int c = 0; c < numChunks; ++c) {
+    m_numAllocations += reserveGrowth(m_pairChunks[c].forces,
+                                      NumPairComponents * m_pairStride);
+    m_pairChunks[c].begin = static_cast<int>(qint64(count) * c / numChunks);
+    m_pairChunks[c].end = static_cast<int>(qint64(count) * (c + 1) / numChunks);
+  }
+  SymmetricChunkFunctor evaluate(*this);
+  m_pool.parallelFor(numChunks, evaluate);
 
-  m_flockers.push_back(newFlocker);
-  m_entities.push_back(newFlocker);
+  if (numChunks > 1) {
+    ReduceFunctor reduce(*this, numChunks);
+    m_pool.parallelFor(count, reduce, minChunkSize);
+  }
 }
 
-void FlockEngine::addRandomFlocker()
+void FlockEngine::commitNextStep()
 {
-  Flocker *f = new Flocker (m_entityIdHead, m_entityIdHead % m_numFlockerTypes);
-  m_entityIdHead++;
+  Q_ASSERT(m_future.isStarted());
+  QElapsedTimer timer;
+  timer.start();
+  {
+    TraceSpan span("engine", "wait for step");
+    m_future.waitForFinished();
+  }
+  m_timings.wait = timer.nsecsElapsed();
 
-  this->randomizeVector(&f->pos());
+  timer.start();
+  {
+    TraceSpan span("engine", "commit");
+    m_store.swapFrames();
+  }
+  m_timings.commit = timer.nsecsElapsed();
+
+  timer.start();
+  TraceSpan span("engine", "kill/respawn");
 
-  f->direction().setRandom();
-  f->direction().normalize();
+  // Spawning only appends, so the collected indices stay valid until the
+  // removals below. New entities take their first step next frame.
+  if (!m_createBlasts) {
+    foreach (const DeadEntities &dead, m_dead) {
+      foreach (int i, dead.agents)
+        this->addBlastFromEntity(i);
+    }
+  }
 
-  f->velocity() = m_initialSpeed;
+  m_numCoasted = 0;
+  foreach (const DeadEntities &dead, m_dead) {
+    foreach (int t, dead.targets) {
+      this->addFlockerFromEntity(t);
+      this->randomizeTarget(t);
+    }
+    m_numCoasted += dead.coasted;
+  }
 
-  f->color() = this->typeToColor(f->type());
+  foreach (const DeadEntities &dead, m_dead) {
+    foreach (int i, dead.agents)
+      m_store.markRemoved(i);
+    foreach (int i, dead.blasts)
+      m_store.markRemoved(i);
+  }
+  m_store.compact(m_pool);
+  m_timings.respawn = timer.nsecsElapsed();
 
-  m_flockers.push_back(f);
-  m_entities.push_back(f);
+  ++m_stepCount;
 }
 
-void FlockEngine::removeFlocker(Flocker *f)
+void FlockEngine::stepFlocker(int i, const TakeStepResult &result, double t)
 {
-  m_flockers.removeOne(f);
-  m_entities.removeOne(f);
-  f->deleteLater();
+  EntityStore &s = m_store;
+  const double pos[3] = { s.x()[i], s.y()[i], s.z()[i] };
+  double *nextPos[3] = { s.nextX() + i, s.nextY() + i, s.nextZ() + i };
+  double *nextDir[3] = { s.nextDx() + i, s.nextDy() + i, s.nextDz() + i };
+  double velocity = result.newVelocity;
+
+  for (int d = 0; d < 3; ++d) {
+    *nextDir[d] = result.newDirection[d];
+    *nextPos[d] = pos[d] + velocity * *nextDir[d] * t;
+  }
+
+  // Bounce at boundaries, slow down
+  const double bounceSlowdownFactor = 0.50;
+  for (int d = 0; d < 3; ++d) {
+    if (*nextPos[d] < 0.0) {
+      *nextDir[d] =  fabs(*nextDir[d]);
+      *nextPos[d] = 0.001;
+      velocity *= bounceSlowdownFactor;
+    }
+    else if (*nextPos[d] > 1.0) {
+      *nextDir[d] = -fabs(*nextDir[d]);
+      *nextPos[d] = 0.999;
+      velocity *= bounceSlowdownFactor;
+    }
+  }
+
+  s.nextVelocities()[i] = velocity;
+  s.nextAges()[i] = s.age(i);
 }
 
-void FlockEngine::initializePredators()
+void FlockEngine::stepTarget(int i, double t)
 {
-  this->cleanupPredators();
+  Eigen::Vector3d pos = m_store.pos(i);
+  Eigen::Vector3d direction = m_store.direction(i);
+
+  pos += m_store.velocity(i) * direction * t;
 
-  unsigned int type = 0;
-  for (unsigned int i = 0; i < m_numPredators; ++i) {
-    this->addRandomPredator(type);
-    if (++type == m_numPredatorTypes)
-      type = 0;
+  // Use a reduced boundary for these -- keeps the flockers from bouncing off
+  // of the walls as much
+  const double validFraction = 0.90;
+
+  const double minVal = (1.0 - validFraction) / 2.0;
+  const double maxVal = 1.0 - minVal;
+
+  // lower values reduce bounce angle (hugs wall)
+  const double factor = 0.1;
+
+  // Bounce at boundaries
+  for (int d = 0; d < 3; ++d) {
+    if (pos[d] < minVal) {
+      direction[d] = factor * fabs(direction[d]);
+      direction.normalize();
+      pos[d] = minVal;
+    }
+    else if (pos[d] > maxVal) {
+      direction[d] = factor * -fabs(direction[d]);
+      direction.normalize();
+      pos[d] = maxVal;
+    }
   }
+
+  EntityStore &s = m_store;
+  s.nextX()[i] = pos.x();
+  s.nextY()[i] = pos.y();
+  s.nextZ()[i] = pos.z();
+  s.nextDx()[i] = direction.x();
+  s.nextDy()[i] = direction.y();
+  s.nextDz()[i] = direction.z();
+  s.nextVelocities()[i] = s.velocity(i);
+  s.nextAges()[i] = s.age(i);
 }
 
-void FlockEngine::cleanupPredators()
+bool FlockEngine::stepBlast(int i)
 {
-  foreach (Predator *p, this->m_predators) {
-    m_flockers.removeOne(p);
-    m_entities.removeOne(p);
-  }
-  qDeleteAll(this->m_predators);
-  this->m_predators.clear();
+  EntityStore &s = m_store;
+  s.nextX()[i] = s.x()[i];
+  s.nextY()[i] = s.y()[i];
+  s.nextZ()[i] = s.z()[i];
+  s.nextDx()[i] = s.dx()[i];
+  s.nextDy()[i] = s.dy()[i];
+  s.nextDz()[i] = s.dz()[i];
+  s.nextVelocities()[i] = s.velocity(i);
+
+  // Expired blasts are removed instead of aging further
+  const bool expired = s.age(i) / blastStepsPerTick > blastLifetime;
+  s.nextAges()[i] = expired ? s.age(i) : s.age(i) + 1;
+  return expired;
 }
 
-void FlockEngine::addRandomPredator(const unsigned int type)
+double FlockEngine::blastProgress(int index) const
 {
-  Predator *p = new Predator (m_entityIdHead++, type);
-
-  this->randomizeVector(&p->pos());
+  unsigned int ticks = m_store.age(index) / blastStepsPerTick;
+  if (ticks > blastLifetime)
+    ticks = blastLifetime;
+  return ticks / static_cast<double>(blastLifetime);
+}
 
-  p->direction().setRandom();
-  p->direction().normalize();
+void FlockEngine::initializeFlockers()
+{
+  this->cleanupFlockers();
+  this->addRandomEntities(EntityStore::FlockerKind, m_numFlockers);
+}
 
-  p->velocity() = m_initialSpeed;
+void FlockEngine::cleanupFlockers()
+{
+  this->removeKind(EntityStore::FlockerKind);
+}
 
-  p->color() = QColor(Qt::red);
+void FlockEngine::addFlockerFromEntity(int index)
+{
+  m_store.addCopy(m_entityIdHead++, EntityStore::FlockerKind, index);
+}
 
-  m_predators.push_back(p);
-  m_flockers.push_back(p);
-  m_entities.push_back(p);
+void FlockEngine::initializePredators()
+{
+  this->cleanupPredators();
+  this->addRandomEntities(EntityStore::PredatorKind, m_numPredators);
 }
 
-void FlockEngine::removePredator(Predator *p)
+void FlockEngine::cleanupPredators()
 {
-  m_predators.removeOne(p);
-  m_flockers.removeOne(p);
-  m_entities.removeOne(p);
-  p->deleteLater();
+  this->removeKind(EntityStore::PredatorKind);
 }
 
 void FlockEngine::initializeTargets()
 {
   this->cleanupTargets();
-
-  for (unsigned int type = 0; type < m_numFlockerTypes; ++type) {
-    for (unsigned int i = 0; i < m_numTargetsPerFlockerType; ++i) {
-      this->addRandomTarget(type);
-    }
-  }
+  this->addRandomEntities(EntityStore::TargetKind,
+                          m_numFlockerTypes * m_numTargetsPerFlockerType);
 }
 
 void FlockEngine::cleanupTargets()
 {
-  for (int i = 0; i < m_targets.size(); ++i) {
-    qDeleteAll(m_targets[i]);
-  }
-
-  this->m_targets.clear();
+  this->removeKind(EntityStore::TargetKind);
 }
 
-void FlockEngine::addRandomTarget(const unsigned int type)
+void FlockEngine::addRandomEntities(EntityStore::Kind kind, int count)
 {
-  Target *newTarget = new Target(m_entityIdHead++, type);
-
-  randomizeVector(&newTarget->pos());
-  newTarget->color() = this->typeToColor(type);
-  newTarget->velocity() = m_minSpeed;
-  randomizeVector(&newTarget->direction());
-  newTarget->direction().normalize();
+  const int first = m_store.append(count, m_entityIdHead, kind);
+  m_entityIdHead += count;
 
-  if (type + 1 > static_cast<unsigned int>(m_targets.size())) {
-    m_targets.resize(type + 1);
-  }
-
-  m_targets[type].push_back(newTarget);
-  m_entities.push_back(newTarget);
+  RandomizeFunctor randomize(*this, first);
+  m_pool.parallelFor(count, randomize, minChunkSize);
 }
 
-void FlockEngine::removeTarget(Target *t)
+void FlockEngine::randomizeEntity(int i, int ordinal)
 {
-  m_targets[t->type()].removeOne(t);
-  m_entities.removeOne(t);
-  t->deleteLater();
+  const quint32 id = m_store.id(i);
+  CounterRng posRng(m_seed, id, CounterRng::PositionStream);
+  CounterRng dirRng(m_seed, id, CounterRng::DirectionStream);
+
+  Eigen::Vector3d pos;
+  randomizeVector(&posRng, &pos);
+  m_store.setPos(i, pos);
+
+  Eigen::Vector3d dir;
+  switch (m_store.kind(i)) {
+  case EntityStore::FlockerKind:
+    m_store.setType(i, id % m_numFlockerTypes);
+    dir = Eigen::Vector3d(dirRng.uniform(-1., 1.), dirRng.uniform(-1., 1.),
+                          dirRng.uniform(-1., 1.));
+    m_store.velocity(i) = m_initialSpeed;
+    break;
+  case EntityStore::PredatorKind:
+    m_store.setType(i, ordinal % m_numPredatorTypes);
+    dir = Eigen::Vector3d(dirRng.uniform(-1., 1.), dirRng.uniform(-1., 1.),
+                          dirRng.uniform(-1., 1.));
+    m_store.velocity(i) = m_initialSpeed;
+    break;
+  case EntityStore::TargetKind:
+    m_store.setType(i, ordinal / m_numTargetsPerFlockerType);
+    randomizeVector(&dirRng, &dir);
+    m_store.velocity(i) = m_minSpeed;
+    break;
+  default:
+    dir = Eigen::Vector3d(1., 0., 0.);
+    break;
+  }
+  m_store.setDirection(i, dir.normalized());
 }
 
-void FlockEngine::randomizeTarget(Target *t)
+void FlockEngine::randomizeTarget(int index)
 {
-  this->randomizeVector(&t->pos());
+  // A fresh position each time this target is reached, on any thread
+  CounterRng rng(m_seed, m_store.id(index), CounterRng::RespawnStream,
+                 3 * m_stepCount);
+  Eigen::Vector3d pos;
+  randomizeVector(&rng, &pos);
+  m_store.setPos(index, pos);
 }
 
-void FlockEngine::addBlastFromEntity(const Entity *e)
+void FlockEngine::addBlastFromEntity(int index)
 {
-  Blast *newBlast = new Blast (m_entityIdHead++, e->type());
-  newBlast->pos() = e->pos();
-  newBlast->direction() = e->direction();
-  newBlast->velocity() = e->velocity();
-  newBlast->color() = e->color();
-
-  m_blasts.push_back(newBlast);
-  m_entities.push_back(newBlast);
+  m_store.addCopy(m_entityIdHead++, EntityStore::BlastKind, index);
 }
 
-void FlockEngine::removeBlast(Blast *b)
+void FlockEngine::removeKind(EntityStore::Kind kind)
 {
-  m_blasts.removeOne(b);
-  m_entities.removeOne(b);
-  b->deleteLater();
+  for (int i = 0; i < m_store.size(); ++i) {
+    if (m_store.kind(i) == kind)
+      m_store.markRemoved(i);
+  }
+  m_store.compact(m_pool);
 }
 
-void FlockEngine::randomizeVector(Eigen::Vector3d *vec)
+void FlockEngine::randomizeVector(CounterRng *rng, Eigen::Vector3d *vec)
 {
-  static const double invRANDMAX = 1.0/static_cast<double>(RAND_MAX);
-  vec->x() = rand() * invRANDMAX;
-  vec->y() = rand() * invRANDMAX;
-  vec->z() = rand() * invRANDMAX;
+  vec->x() = rng->uniform();
+  vec->y() = rng->uniform();
+  vec->z() = rng->uniform();
 }
@@ -2,31 +2,36 @@
 #define FLOCKENGINE_H
 
 #include <QtCore/QObject>
+#include <QtCore/QtGlobal>
 
 #include <QtCore/QFuture>
-#include <QtCore/QLinkedList>
+#include <QtCore/QVector>
 
 #include <Eigen/Core>
 
-class Blast;
-class Entity;
-class Flocker;
-class Predator;
-class QTimer;
-class Target;
+#include "celllist.h"
+#include "counterrng.h"
+#include "entitystore.h"
+#include "forcelaw.h"
+#include "pairkernel.h"
+#include "verletlist.h"
+#include "workpool.h"
 
 class FlockEngine : public QObject
 {
   Q_OBJECT
 public:
+  enum NeighborSearch {
+    BruteForceSearch = 0,
+    CellListSearch,
+    VerletListSearch,
+    NumNeighborSearches
+  };
+
   explicit FlockEngine(QObject *parent = 0);
   ~FlockEngine();
 
-  const QLinkedList<Entity*>& entities() const { return m_entities; }
-  const QLinkedList<Flocker*>& flockers() const { return m_flockers; }
-  const QVector<QLinkedList<Target*>>& targets() const { return m_targets; }
-  const QLinkedList<Predator*>& predators() const { return m_predators; }
-  const QLinkedList<Blast*>& blasts() const { return m_blasts; }
+  const EntityStore& store() const { return m_store; }
 
   const Eigen::Vector3d& forceTarget() const;
   void setForceTarget(const Eigen::Vector3d &v);
@@ -37,58 +42,232 @@ public:
   void computeNextStep();
   void commitNextStep();
 
+  // How long the phases of the last committed step took, in nanoseconds
+  struct StepTimings
+  {
+    // computeNextStep() indexing the agents and updating the neighbor
+    // search, on the calling thread
+    qint64 setup;
+    // The parallel step: pair forces and integration, on the pool
+    qint64 forces;
+    // commitNextStep() waiting for the step to finish
+    qint64 wait;
+    // Swapping in the new frame
+    qint64 commit;
+    // Turning the dead into blasts and flockers, and compacting the store
+    qint64 respawn;
+  };
+  const StepTimings & lastStepTimings() const { return m_timings; }
+
   bool createBlasts() const;
   void setCreateBlasts(bool b);
 
-  QColor typeToColor(const unsigned int type);
+  // Population sizes used by reset(). The constructor starts with 500
+  // flockers of 12 types, 30 predators of 3 types and 3 targets per type.
+  unsigned int numFlockers() const;
+  void setNumFlockers(unsigned int num);
 
   unsigned int numFlockerTypes() const;
+  void setNumFlockerTypes(unsigned int num);
+
+  unsigned int numPredators() const;
+  void setNumPredators(unsigned int num);
+
+  unsigned int numPredatorTypes() const;
+  void setNumPredatorTypes(unsigned int num);
 
   unsigned int numTargetsPerFlockerType() const;
+  void setNumTargetsPerFlockerType(unsigned int num);
+
+  // Discard every entity and repopulate from seed. The same seed and
+  // population sizes always produce the same world.
+  void reset(quint64 seed);
+  quint64 seed() const;
 
   double stepSize() const;
   void setStepSize(double size);
+  // Steps committed since the last reset()
+  quint64 stepCount() const { return m_stepCount; }
+
+  NeighborSearch neighborSearch() const;
+  void setNeighborSearch(NeighborSearch search);
+
+  // Extra reach of the Verlet lists beyond each cutoff. The lists are
+  // rebuilt once an agent has moved half this far, or when too many agents
+  // have spawned since the last build.
+  double verletSkin() const;
+  void setVerletSkin(double skin);
+  quint64 verletRebuilds() const;
+
+  static const char * neighborSearchName(NeighborSearch search);
+
+  // Instruction set used for the pair interaction with CellListSearch and
+  // VerletListSearch.
+  PairKernel::Isa pairKernelIsa() const;
+  void setPairKernelIsa(PairKernel::Isa isa);
+
+  // With CellListSearch, evaluate each unordered pair once and apply the
+  // result to both entities, rather than once from each side.
+  bool symmetricPairs() const;
+  void setSymmetricPairs(bool symmetric);
+
+  // How the Morse derivative is evaluated, for both search modes.
+  ForceLaw::Mode forceLawMode() const;
+  void setForceLawMode(ForceLaw::Mode mode);
+
+  // Multiple time stepping. Flockers with nothing going on around them
+  // only have their forces evaluated every second or fourth step, and
+  // repeat their last turn and speed change in between. A flocker counts
+  // as quiet once its last evaluation turned and sped it up much as the
+  // one before did. It is evaluated again as soon as a predator nears its
+  // catch or evasion range, or a flocker near it changes course sharply.
+  // Off by default.
+  //
+  // Coasting only saves pair work where forces are gathered per agent:
+  // BruteForceSearch, VerletListSearch, or CellListSearch without
+  // symmetricPairs(). The symmetric pass has every flocker's forces
+  // before any steps, so there every flocker is evaluated and multiRate()
+  // has no effect.
+  bool multiRate() const;
+  void setMultiRate(bool multiRate);
+  // Flockers that coasted instead of being evaluated in the last step
+  int numCoasted() const { return m_numCoasted; }
+
+  // Times a buffer the engine reuses from step to step has had to grow
+  // since construction, counting the store's columns, the neighbor search
+  // and the step's scratch. It stays flat once the population has peaked,
+  // except that the Verlet lists' runs follow the number of close pairs,
+  // which can keep creeping up as flocks gather.
+  // The task QtConcurrent::run() allocates to start each step is Qt's and
+  // isn't counted. The step updates it, so read it between steps.
+  quint64 numAllocations() const;
+
+  // Threads used by the parallel phases, including the one stepping the
+  // engine. 0 picks QThread::idealThreadCount().
+  int threadCount() const;
+  void setThreadCount(int count);
+
+  // How far the blast at index is through its lifetime, in [0, 1].
+  double blastProgress(int index) const;
 
 private:
   void initializeFlockers();
   void cleanupFlockers();
-  void addFlockerFromEntity(const Entity *e);
-  void addRandomFlocker();
-  void removeFlocker(Flocker *f);
+  void addFlockerFromEntity(int index);
 
   void initializePredators();
   void cleanupPredators();
-  void addRandomPredator(const unsigned int type);
-  void removePredator(Predator *p);
 
   void initializeTargets();
   void cleanupTargets();
-  void addRandomTarget(const unsigned int type);
-  void removeTarget(Target *t);
-  void randomizeTarget(Target *t);
+  void randomizeTarget(int index);
 
-  void addBlastFromEntity(const Entity *e);
-  void removeBlast(Blast *b);
+  // Append count entities of kind and randomize them in parallel.
+  void addRandomEntities(EntityStore::Kind kind, int count);
+  // ordinal is the entity's position within its addRandomEntities() batch.
+  void randomizeEntity(int i, int ordinal);
 
-  void randomizeVector(Eigen::Vector3d *vec);
+  void addBlastFromEntity(int index);
 
-  struct TakeStepFunctor;
-  friend struct TakeStepFunctor;
-  struct TakeStepResult;
-  TakeStepResult takeStepWorker(const Flocker *f_i) const;
+  void removeKind(EntityStore::Kind kind);
+
+  static void randomizeVector(CounterRng *rng, Eigen::Vector3d *vec);
+
+  void rebuildCellList();
+  void updateVerletList();
+  void computeStep();
+  void computeSymmetricForces();
+
+  struct TakeStepResult
+  {
+    Eigen::Vector3d newDirection;
+    double newVelocity;
+    // Index of a target this flocker reached, or -1
+    int deadTarget;
+    // Set when a predator caught this flocker
+    bool dead;
+  };
+
+  // swarm-bench times takeStepWorker directly
+  friend class Benchmark;
+
+  struct RandomizeFunctor;
+  friend struct RandomizeFunctor;
+  struct PairForces;
+  struct KernelRangeFunctor;
+  friend struct KernelRangeFunctor;
+  struct GatherFunctor;
+  friend struct GatherFunctor;
+  struct SymmetricRangeFunctor;
+  friend struct SymmetricRangeFunctor;
+  struct SymmetricChunkFunctor;
+  friend struct SymmetricChunkFunctor;
+  struct ReduceFunctor;
+  friend struct ReduceFunctor;
+  struct AgentStepFunctor;
+  friend struct AgentStepFunctor;
+  struct TargetStepFunctor;
+  friend struct TargetStepFunctor;
+  struct BlastStepFunctor;
+  friend struct BlastStepFunctor;
+  struct VerletBatch;
+  friend struct VerletBatch;
+  struct DisplacementFunctor;
+  friend struct DisplacementFunctor;
+  TakeStepResult takeStepWorker(int i) const;
+  // Whether quiet flockers coast: multiRate() in a mode where that saves
+  // pair work.
+  bool coasts() const;
+  // takeStepWorker(), or a coast for quiet flockers, with coasts().
+  // Updates the flocker's rate, so only one thread may step each entity.
+  TakeStepResult takeMultiRateStep(int i, bool *coasted);
+  // Whether anything near pos could change a quiet flocker's course.
+  bool isDisturbed(const Eigen::Vector3d &pos) const;
+  void markActivity();
+  void accumulatePair(int i, int j, PairForces *forces,
+                      TakeStepResult *result) const;
+
+  // Write the next frame of entity i. stepBlast() returns true once the
+  // blast has expired.
+  void stepFlocker(int i, const TakeStepResult &result, double t);
+  void stepTarget(int i, double t);
+  bool stepBlast(int i);
 
 private:
-  QLinkedList<Entity*> m_entities;
-  QLinkedList<Flocker*> m_flockers;
-  QVector<QLinkedList<Target*> > m_targets;
-  QLinkedList<Predator*> m_predators;
-  QLinkedList<Blast*> m_blasts;
+  EntityStore m_store;
+  // Rebuilt each frame: indices of the flockers and predators, of the
+  // targets of each flocker type, and of the blasts. The step runs over
+  // each list on its own, so no worker switches on kind.
+  QVector<int> m_agents;
+  QVector<QVector<int> > m_targets;
+  QVector<int> m_blasts;
+
+  // Collected by the step, one per chunk of m_agents and m_blasts in index
+  // order, and removed by commitNextStep(). Each list has room for its whole
+  // chunk, so they are reused from step to step without reallocating.
+  struct DeadEntities
+  {
+    DeadEntities() : coasted(0) {}
+    QVector<int> agents;
+    QVector<int> targets;
+    QVector<int> blasts;
+    // Not dead, but counted along the way; see multiRate()
+    int coasted;
+  };
+  QVector<DeadEntities> m_dead;
+  int m_numCoasted;
+  // Growth of the engine's own buffers; see numAllocations()
+  quint64 m_numAllocations;
 
   bool m_useForceTarget;
   Eigen::Vector3d m_forceTarget;
 
   bool m_createBlasts;
 
+  // Keys every random draw, with the entity id and a CounterRng::Stream
+  quint64 m_seed;
+  // Steps committed since the last reset
+  quint64 m_stepCount;
   unsigned int m_entityIdHead;
   unsigned int m_numFlockers;
   unsigned int m_numFlockerTypes;
@@ -101,7 +280,90 @@ private:
   double m_minSpeed;
   double m_maxSpeed;
 
-  QFuture<FlockEngine::TakeStepResult> m_future;
+  NeighborSearch m_neighborSearch;
+  CellList m_cellList;
+  ForceLaw m_forceLaw;
+  PairKernel m_pairKernel;
+
+  // Agent state in m_cellList order, for the pair kernel.
+  struct NeighborArrays
+  {
+    QVector<double> x;
+    QVector<double> y;
+    QVector<double> z;
+    QVector<double> dx;
+    QVector<double> dy;
+    QVector<double> dz;
+    QVector<double> type;
+    QVector<double> predator;
+
+    // Make room for size slots, and return how many arrays had to grow.
+    int reserve(int size);
+  };
+  NeighborArrays m_neighbors;
+  // Position of each entity in m_cellList order
+  QVector<int> m_cellSlot;
+
+  // Symmetric evaluation splits the cell-ordered slots into chunks, each
+  // with its own force buffer covering every slot. The buffers are summed
+  // into the first in chunk order, so results don't depend on scheduling.
+  bool m_symmetricPairs;
+  struct PairChunk
+  {
+    int begin;
+    int end;
+    QVector<double> forces;
+  };
+  QVector<PairChunk> m_pairChunks;
+  // Distance between force components in PairChunk::forces
+  int m_pairStride;
+
+  // Lists over the agents, by EntityStore::listSlot(). m_verletIndex maps
+  // each slot to its entity's current index, or -1 once it has died.
+  // m_verletData holds the slots' latest state for the pair kernel, with the
+  // dead parked out of reach, and m_verletX/Y/Z their last known positions
+  // for the displacement check. Agents spawned since the build are checked
+  // against everyone directly.
+  VerletList m_verletList;
+  QVector<int> m_verletIndex;
+  NeighborArrays m_verletData;
+  QVector<double> m_verletX;
+  QVector<double> m_verletY;
+  QVector<double> m_verletZ;
+  QVector<double> m_verletCutoff;
+  QVector<int> m_verletRecent;
+
+  // Multiple time stepping state of each store handle slot. Entries of
+  // stale generations are reset on first use.
+  bool m_multiRate;
+  struct RateState
+  {
+    RateState() : generation(0), interval(1), active(true), turn(0., 0., 0.),
+      speedup(0.) {}
+    quint32 generation;
+    // Steps between force evaluations: 1, 2 or 4
+    int interval;
+    // Whether the last evaluation changed the flocker's course enough to
+    // stir up its neighbors
+    bool active;
+    // Change of direction and velocity at the last evaluation
+    Eigen::Vector3d turn;
+    double speedup;
+  };
+  QVector<RateState> m_rates;
+  // The predators, and which cells of a coarse grid over the world hold an
+  // active flocker or neighbor one. Rebuilt each step.
+  QVector<int> m_predators;
+  QVector<quint8> m_activeCells;
+
+  // Runs every parallel phase. Steps are computed on a QtConcurrent thread,
+  // which then takes part in the pool's calls.
+  WorkPool m_pool;
+  QFuture<void> m_future;
+
+  // Filled in as the step goes; forces is written by the step's thread
+  // before m_future finishes.
+  StepTimings m_timings;
 };
 
 #endif // FLOCKENGINE_H
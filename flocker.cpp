@@ -9,94 +9,73 @@
 const double MINRADIUS = 0.010;
 const double MAXRADIUS = 0.020;
 
-Flocker::Flocker(unsigned int id, unsigned int type, QObject *parent) :
-  Entity(id, type, FlockerEntity, parent)
+void Flocker::drawBatch(QPainter *p, Entity *const *views, int count)
 {
+  Flocker::drawBatch(p, views, count, 0);
 }
 
-Flocker::~Flocker()
+void Flocker::drawBatch(QPainter *p, Entity *const *views, int count,
+                        BrushFunction brush)
 {
-}
-
-void Flocker::draw(QPainter *p)
-{
-  drawInternal(p, Qt::SolidPattern);
-}
-
-void Flocker::takeStep(double t)
-{
-  m_pos += m_velocity * m_direction * t;
-
-  // Bounce at boundaries, slow down
-  const double bounceSlowdownFactor = 0.50;
-  if (m_pos.x() < 0.0) {
-    m_direction.x() =  fabs(m_direction.x());
-    m_pos.x() = 0.001;
-    m_velocity *= bounceSlowdownFactor;
-  }
-  else if (m_pos.x() > 1.0) {
-    m_direction.x() = -fabs(m_direction.x());
-    m_pos.x() = 0.999;
-    m_velocity *= bounceSlowdownFactor;
-  }
-  if (m_pos.y() < 0.0) {
-    m_direction.y() =  fabs(m_direction.y());
-    m_pos.y() = 0.001;
-    m_velocity *= bounceSlowdownFactor;
-  }
-  else if (m_pos.y() > 1.0) {
-    m_direction.y() = -fabs(m_direction.y());
-    m_pos.y() = 0.999;
-    m_velocity *= bounceSlowdownFactor;
-  }
-  if (m_pos.z() < 0.0) {
-    m_direction.z() =  fabs(m_direction.z());
-    m_pos.z() = 0.001;
-    m_velocity *= bounceSlowdownFactor;
-  }
-  else if (m_pos.z() > 1.0) {
-    m_direction.z() = -fabs(m_direction.z());
-    m_pos.z() = 0.999;
-    m_velocity *= bounceSlowdownFactor;
-  }
-}
+  p->save();
 
-void Flocker::drawInternal(QPainter *p, Qt::BrushStyle style)
-{
+  // Device coordinates:
   const double width = p->device()->width();
   const double height = p->device()->height();
 
-  // x/y position in device coordinates:
-  double devPos[2];
-  devPos[0] = m_pos.x() * width;
-  devPos[1] = m_pos.y() * height;
+  p->setPen(Qt::black);
+  QColor color;
+  Qt::BrushStyle style = Qt::NoBrush;
+  for (int i = 0; i < count; ++i) {
+    const Entity &view = *views[i];
+    const Eigen::Vector3d &pos = view.pos();
+
+    // x/y position in device coordinates:
+    const QPointF devPos(pos.x() * width, pos.y() * height);
+
+    const double radius = Flocker::radius(pos.z()) * 0.5 * (width + height);
+    const QPointF devDir(view.direction().x() * radius,
+                         view.direction().y() * radius);
+
+    const Qt::BrushStyle viewStyle = brush ? brush(view) : Qt::SolidPattern;
+    if (i == 0 || view.color() != color || viewStyle != style) {
+      color = view.color();
+      style = viewStyle;
+      p->setBrush(QBrush(color, style));
+    }
+
+    QPointF triangle [3];
+    Flocker::triangle(devPos, devDir, triangle);
+    p->drawPolygon(triangle, 3);
+  }
 
-  const double depth = m_pos.z();
+  p->restore();
+}
 
-  double radius = depth * MAXRADIUS;
+double Flocker::radius(double z)
+{
+  double radius = z * MAXRADIUS;
   if (radius < MINRADIUS) {
     radius = MINRADIUS;
   }
+  return radius;
+}
 
-  radius *= 0.5 * (width + height);
-
-  double devDir[2];
-  devDir[0] = m_direction.x() * radius;
-  devDir[1] = m_direction.y() * radius;
-
-  p->setPen(Qt::black);
-  QBrush brush (m_color, style);
-  p->setBrush(brush);
+double Flocker::maxRadius()
+{
+  return MAXRADIUS;
+}
 
+void Flocker::triangle(const QPointF &center, const QPointF &dir,
+                       QPointF *points)
+{
   // Three points defining the triangle
-  QPointF triangle [3];
-  triangle[0].setX(devPos[0] + devDir[0]);
-  triangle[0].setY(devPos[1] + devDir[1]);
+  points[0].setX(center.x() + dir.x());
+  points[0].setY(center.y() + dir.y());
 
-  triangle[1].setX(devPos[0] - devDir[0] + 0.5 * devDir[1]);
-  triangle[1].setY(devPos[1] - devDir[1] + 0.5 * devDir[0]);
+  points[1].setX(center.x() - dir.x() + 0.5 * dir.y());
+  points[1].setY(center.y() - dir.y() + 0.5 * dir.x());
 
-  triangle[2].setX(devPos[0] - devDir[0] - 0.5 * devDir[1]);
-  triangle[2].setY(devPos[1] - devDir[1] - 0.5 * devDir[0]);
-  p->drawPolygon(triangle, 3);
+  points[2].setX(center.x() - dir.x() - 0.5 * dir.y());
+  points[2].setY(center.y() - dir.y() - 0.5 * dir.x());
 }
@@ -4,20 +4,30 @@
 #include "entity.h"
 
 class QPainter;
+class QPointF;
 
-class Flocker : public Entity
+// Draws flocker views as triangles pointing along their direction, sized by
+// depth.
+class Flocker
 {
-  Q_OBJECT
 public:
-  explicit Flocker(unsigned int id, unsigned int type, QObject *parent = 0);
-  virtual ~Flocker();
-  
-public slots:
-  virtual void draw(QPainter *p);
-  virtual void takeStep(double t);
+  // Every view must be a flocker.
+  static void drawBatch(QPainter *p, Entity *const *views, int count);
 
-protected:
-  void drawInternal(QPainter *p, Qt::BrushStyle style);
+  // As above, filling each view with the style brush(view) returns. The
+  // brush is only set again when the color or style changes.
+  typedef Qt::BrushStyle (*BrushFunction)(const Entity &view);
+  static void drawBatch(QPainter *p, Entity *const *views, int count,
+                        BrushFunction brush);
+
+  // Radius of a flocker at depth z, as a fraction of the mean device side.
+  static double radius(double z);
+  static double maxRadius();
+
+  // The triangle of a flocker at center whose direction projects to dir in
+  // device coordinates, scaled by its radius.
+  static void triangle(const QPointF &center, const QPointF &dir,
+                       QPointF *points);
 };
 
 #endif // FLOCKER_H
@@ -3,7 +3,9 @@
 // TODO clean this up.
 #include <Eigen/Core>
 
+#include <QtCore/QDateTime>
 #include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QTimer>
 
 #include <QtWidgets/QApplication>
@@ -16,27 +18,36 @@
 
 #include <QtConcurrent/QtConcurrentMap>
 
-#include "blast.h"
+#include "counterrng.h"
 #include "flockengine.h"
-#include "flocker.h"
-#include "predator.h"
 #include "target.h"
+#include "trace.h"
 
 FlockWidget::FlockWidget(QWidget *parent) :
   QWidget(parent),
   m_timer(new QTimer (this)),
   m_engine(new FlockEngine(this)),
-  m_lastRender(QDateTime::currentDateTime()),
   m_currentFPS(0.f),
   m_fpsSum(0.f),
   m_fpsCount(0),
   m_aborted(false),
-  m_showOverlay(true)
+  m_showOverlay(true),
+  m_useSprites(false),
+  m_useTiles(false),
+  m_useRaster(false),
+  m_useLod(false),
+  m_stepInterval(12.),
+  m_simLag(0),
+  m_lastSubSteps(0),
+  m_droppedSteps(0),
+  m_clicks(0)
 {
   this->setFocusPolicy(Qt::WheelFocus);
 
   connect(m_timer, SIGNAL(timeout()), this, SLOT(takeStep()));
 
+  m_frameTimer.start();
+
   m_timer->start(12);
 }
 
@@ -49,65 +60,164 @@ void FlockWidget::takeStep()
   if (m_aborted)
     qApp->exit();
 
-  QDateTime now = QDateTime::currentDateTime();
-  qint64 elapsed_ms = m_lastRender.msecsTo(now);
-  float elapsed_s = elapsed_ms / 1000.f;
-  m_lastRender = now;
-  m_currentFPS = 1.f / elapsed_s;
+  const qint64 elapsed_ns = m_frameTimer.nsecsElapsed();
+  m_frameTimer.start();
+  m_timings.record(PhaseTimings::FramePhase, elapsed_ns);
+  m_currentFPS = 1e9f / qMax(Q_INT64_C(1), elapsed_ns);
   m_fpsSum += m_currentFPS;
   ++m_fpsCount;
 
-  m_engine->computeNextStep();
+  // Take as many fixed steps as the wall time since the last frame covers.
+  // Past maxSubSteps(), the simulation slows down instead of falling
+  // further behind.
+  const qint64 stepNsecs = static_cast<qint64>(m_stepInterval * 1e6);
+  m_simLag += elapsed_ns;
+  int steps = static_cast<int>(m_simLag / stepNsecs);
+  if (steps > maxSubSteps()) {
+    m_droppedSteps += steps - maxSubSteps();
+    steps = maxSubSteps();
+  }
+  m_simLag = qMin(m_simLag - steps * stepNsecs, stepNsecs - 1);
+  m_lastSubSteps = steps;
+
+  {
+    TraceSpan frame("gui", "frame");
+
+    // Steps that won't be shown run back to back. The views keep the state
+    // before the last one, to interpolate from.
+    for (int s = 0; s + 1 < steps; ++s) {
+      TraceSpan span("gui", "sub-step");
+      if (s + 2 == steps)
+        m_views.recordStep(m_engine);
+      m_engine->computeNextStep();
+      m_engine->commitNextStep();
+      this->recordStepTimings();
+    }
+
+    if (steps > 0)
+      m_engine->computeNextStep();
 
-  // Render while waiting on future...
-  this->update();
-  qApp->processEvents();
+    // Render while waiting on future. The frame is drawn a step behind the
+    // engine, between the two steps it has committed last.
+    this->renderFrame(steps > 0, m_simLag / static_cast<double>(stepNsecs));
+    this->update();
+    {
+      TraceSpan span("gui", "process events");
+      qApp->processEvents();
+    }
 
-  m_engine->commitNextStep();
+    if (steps > 0) {
+      m_engine->commitNextStep();
+      this->recordStepTimings();
+    }
+  }
+
+  Trace::endFrame();
 }
 
-void FlockWidget::paintEvent(QPaintEvent *)
+void FlockWidget::recordStepTimings()
 {
-  QPainter p(this);
+  const FlockEngine::StepTimings &step = m_engine->lastStepTimings();
+  m_timings.record(PhaseTimings::SetupPhase, step.setup);
+  m_timings.record(PhaseTimings::ForcePhase, step.forces);
+  m_timings.record(PhaseTimings::WaitPhase, step.wait);
+  m_timings.record(PhaseTimings::CommitPhase, step.commit);
+  m_timings.record(PhaseTimings::RespawnPhase, step.respawn);
+}
 
-  p.setBackground(QBrush(Qt::black));
-  p.eraseRect(this->rect());
-
-  // Count types
-  QVector<unsigned int> counts;
-  size_t countsSize = m_engine->numFlockerTypes() + 1;
-  counts.resize(countsSize);
-
-  // Sort Entities by z-depth:
-  QLinkedList<Entity*> sortedEntities;
-  foreach (Entity *e, m_engine->entities()) {
-    Flocker *f = qobject_cast<Flocker*>(e);
-    Predator *pred = qobject_cast<Predator*>(e);
-    if (pred) {
-      ++counts[m_engine->numFlockerTypes()];
-    }
-    else if (f) {
-      ++counts[f->type()];
-    }
-    bool inserted = false;
-    for(QLinkedList<Entity*>::iterator jt = sortedEntities.begin(),
-        jt_end = sortedEntities.end(); jt != jt_end; ++jt) {
-      if (e->pos().z() < (*jt)->pos().z()) {
-        sortedEntities.insert(jt, e);
-        inserted = true;
-        break;
+void FlockWidget::captureTrace(int frames)
+{
+  Trace::captureFrames(frames, QDateTime::currentDateTime().toString(
+                         "'swarm-trace-'yyyyMMdd-hhmmss'.json'"));
+}
+
+void FlockWidget::renderFrame(bool stepped, double alpha)
+{
+  TraceSpan span("gui", "render frame");
+  QElapsedTimer timer;
+  timer.start();
+
+  if (stepped) {
+    // Count types
+    m_counts.fill(0, m_engine->numFlockerTypes() + 1);
+
+    m_views.sync(m_engine);
+
+    foreach (Entity *e, m_views.views()) {
+      if (e->eType() == Entity::PredatorEntity) {
+        ++m_counts[m_engine->numFlockerTypes()];
+      }
+      else if (e->eType() == Entity::FlockerEntity) {
+        ++m_counts[e->type()];
       }
-    }
-    if (!inserted) {
-      sortedEntities.append(e);
     }
   }
+  m_views.interpolate(alpha);
+  const QVector<Entity*> &views = m_views.views();
+
+  m_timings.record(PhaseTimings::SyncPhase, timer.nsecsElapsed());
+
+  // Both of these order what they draw themselves
+  if (m_useLod || m_useRaster) {
+    timer.start();
+    if (m_image.size() != this->size())
+      m_image = QImage(this->size(), QImage::Format_ARGB32_Premultiplied);
+    if (m_useLod)
+      m_lod.render(views, m_useSprites ? &m_sprites : 0, &m_image);
+    else
+      m_tiles.rasterize(views, &m_image);
+    m_timings.record(PhaseTimings::DrawPhase, timer.nsecsElapsed());
+    return;
+  }
 
-  foreach (Entity *e, sortedEntities) {
-    e->draw(&p);
+  // Draw back to front. Between steps the store has moved on from the
+  // views, so the last order is kept.
+  if (stepped) {
+    timer.start();
+    m_depthOrder.update(m_engine->store());
+    const QVector<int> &order = m_depthOrder.order();
+    m_drawOrder.resize(order.size());
+    for (int i = 0; i < order.size(); ++i)
+      m_drawOrder[i] = views[order[i]];
+    m_timings.record(PhaseTimings::DepthSortPhase, timer.nsecsElapsed());
   }
 
+  // On the GUI thread, the drawing itself happens in paintEvent()
+  timer.start();
+  if (m_useSprites)
+    m_sprites.prepare(this->width(), this->height(), m_drawOrder);
+
+  if (m_useTiles) {
+    if (m_image.size() != this->size())
+      m_image = QImage(this->size(), QImage::Format_ARGB32_Premultiplied);
+    m_tiles.render(m_drawOrder, m_useSprites ? &m_sprites : 0, &m_image);
+  }
+  m_timings.record(PhaseTimings::DrawPhase, timer.nsecsElapsed());
+}
+
+void FlockWidget::paintEvent(QPaintEvent *)
+{
+  TraceSpan span("gui", "paint");
+  QElapsedTimer timer;
+  timer.start();
+  QPainter p(this);
+
+  if (this->rendersToImage() && m_image.size() == this->size()) {
+    p.drawImage(0, 0, m_image);
+  }
+  else {
+    p.setBackground(QBrush(Qt::black));
+    p.eraseRect(this->rect());
+    if (!this->rendersToImage()) {
+      TileRenderer::draw(&p, m_drawOrder.constData(), m_drawOrder.size(),
+                         m_useSprites ? &m_sprites : 0);
+    }
+  }
+  m_timings.record(PhaseTimings::PaintPhase, timer.nsecsElapsed());
+
   if (m_showOverlay) {
+    timer.start();
+
     // FPS
     int skip = p.fontMetrics().height() * 1.2;
     int y = 10 + skip;
@@ -118,30 +228,169 @@ void FlockWidget::paintEvent(QPaintEvent *)
                .arg(m_currentFPS));
     y += skip;
 
-    p.drawText(5, y, QString("Step Size: %1x")
-               .arg(m_engine->stepSize(), 0, 'f', 2));
+    p.drawText(5, y, QString("Simulation: %1x step every %2 ms "
+                             "(%3 this frame, %4 dropped)")
+               .arg(m_engine->stepSize(), 0, 'f', 2)
+               .arg(m_stepInterval, 0, 'f', 1)
+               .arg(m_lastSubSteps)
+               .arg(m_droppedSteps));
+    y += skip;
+
+    p.drawText(5, y, QString("Neighbor search: %1")
+               .arg(FlockEngine::neighborSearchName(
+                      m_engine->neighborSearch())));
+    y += skip;
+
+    if (m_engine->neighborSearch() == FlockEngine::VerletListSearch) {
+      p.drawText(5, y, QString("Verlet skin: %1 (%2 rebuilds)")
+                 .arg(m_engine->verletSkin(), 0, 'f', 3)
+                 .arg(m_engine->verletRebuilds()));
+      y += skip;
+    }
+
+    p.drawText(5, y, QString("Pair kernel: %1")
+               .arg(PairKernel::isaName(m_engine->pairKernelIsa())));
+    y += skip;
+
+    p.drawText(5, y, QString("Pair evaluation: %1")
+               .arg(m_engine->symmetricPairs() ? "half pairs" : "full pairs"));
+    y += skip;
+
+    if (m_engine->multiRate()) {
+      p.drawText(5, y, QString("Multiple time stepping: on (%1 flockers "
+                               "coasted)").arg(m_engine->numCoasted()));
+    }
+    else {
+      p.drawText(5, y, QString("Multiple time stepping: off"));
+    }
+    y += skip;
+
+    p.drawText(5, y, QString("Force law: %1")
+               .arg(ForceLaw::modeName(m_engine->forceLawMode())));
+    y += skip;
+
+    const EntityStore &store = m_engine->store();
+    // Flockers and predators are both steered agents
+    const int flockers = store.count(EntityStore::FlockerKind);
+    const int predators = store.count(EntityStore::PredatorKind);
+    p.drawText(5, y, QString("Entities: %1 (%2 agents: %3 flockers and %4 "
+                             "predators; %5 blasts, %6 targets)")
+               .arg(store.size())
+               .arg(flockers + predators)
+               .arg(flockers)
+               .arg(predators)
+               .arg(store.count(EntityStore::BlastKind))
+               .arg(store.count(EntityStore::TargetKind)));
     y += skip;
 
-    p.drawText(5, y, QString("Entities: %1 (%2 flockers, %3 blasts, "
-                             "%4 targets, %5 predators)")
-               .arg(m_engine->entities().size())
-               .arg(m_engine->flockers().size())
-               .arg(m_engine->blasts().size())
-               .arg(m_engine->numFlockerTypes() *
-                    m_engine->numTargetsPerFlockerType())
-               .arg(m_engine->predators().size()));
+    p.drawText(5, y, QString("Views: %1 (%2 allocations)")
+               .arg(m_views.capacity())
+               .arg(m_views.numAllocations()));
+    y += skip;
+
+    if (m_useLod) {
+      p.drawText(5, y, QString("Renderer: density LOD (%1 of %2 bins "
+                               "splatted, %3 views drawn)")
+                 .arg(m_lod.numSplats())
+                 .arg(m_lod.numBins())
+                 .arg(m_lod.numDrawn()));
+    }
+    else if (m_useRaster) {
+      p.drawText(5, y, QString("Renderer: z-buffer rasterizer"));
+    }
+    else if (m_useSprites) {
+      p.drawText(5, y, QString("Renderer: sprites (%1 sheets, %2 KiB)")
+                 .arg(m_sprites.numSheets())
+                 .arg(m_sprites.numBytes() / 1024));
+    }
+    else {
+      p.drawText(5, y, QString("Renderer: polygons"));
+    }
+    y += skip;
+
+    if (m_useLod) {
+      p.drawText(5, y, QString("Render threads: GUI thread only"));
+    }
+    else if (m_useTiles || m_useRaster) {
+      p.drawText(5, y, QString("Render threads: %1 bands")
+                 .arg(m_tiles.numBands()));
+    }
+    else {
+      p.drawText(5, y, QString("Render threads: GUI thread only"));
+    }
+    y += skip;
+
+    if (m_useLod) {
+      p.drawText(5, y, QString("Depth sort: individual views only"));
+    }
+    else if (m_useRaster) {
+      p.drawText(5, y, QString("Depth sort: none (z-buffer)"));
+    }
+    else {
+      p.drawText(5, y, QString("Depth sort: %1 shifts (%2 bucket sorts)")
+                 .arg(m_depthOrder.lastShifts())
+                 .arg(m_depthOrder.numBucketSorts()));
+    }
+    y += skip;
+
+    if (Trace::framesLeft() > 0) {
+      p.drawText(5, y, QString("Trace: recording, %1 frames left")
+                 .arg(Trace::framesLeft()));
+    }
+    else {
+      p.drawText(5, y, QString("Trace: off"));
+    }
     y += skip;
 
     // Print out number of types
-    for (unsigned int i = 0; i < countsSize; ++i) {
-      unsigned int count = counts[i];
+    for (unsigned int i = 0; i < static_cast<unsigned int>(m_counts.size());
+         ++i) {
+      unsigned int count = m_counts[i];
       if (i < m_engine->numFlockerTypes())
-        p.setPen(m_engine->typeToColor(i));
+        p.setPen(EntityViewCache::typeToColor(
+                   i, m_engine->numFlockerTypes()));
       else
         p.setPen(Qt::red);
       p.drawText(5, y, QString::number(count));
       y += skip;
     }
+    y += skip;
+
+    // Phase percentiles, with bars scaled so the frame budget is 120px wide.
+    // A phase whose p99 overruns the budget is shown in red.
+    const double budget = qMax(1, m_timer->interval());
+    const double barScale = 120. / budget;
+    const int barX = 300;
+    p.setPen(Qt::white);
+    p.drawText(5, y, QString("Phase timings, ms (last %1 frames): "
+                             "p50 / p95 / p99")
+               .arg(m_timings.count(PhaseTimings::FramePhase)));
+    y += skip;
+    for (int i = 0; i < PhaseTimings::NumPhases; ++i) {
+      const PhaseTimings::Phase phase = static_cast<PhaseTimings::Phase>(i);
+      const double p50 = m_timings.percentile(phase, 50.);
+      const double p95 = m_timings.percentile(phase, 95.);
+      const double p99 = m_timings.percentile(phase, 99.);
+      p.setPen(p99 > budget ? Qt::red : Qt::white);
+      p.drawText(5, y, QString("  %1: %2 / %3 / %4")
+                 .arg(PhaseTimings::phaseName(phase))
+                 .arg(p50, 0, 'f', 2)
+                 .arg(p95, 0, 'f', 2)
+                 .arg(p99, 0, 'f', 2));
+      const int barTop = y - skip + 4;
+      const int barHeight = skip - 6;
+      p.fillRect(QRectF(barX, barTop, qMin(p99 * barScale, 240.), barHeight),
+                 Qt::darkGray);
+      p.fillRect(QRectF(barX, barTop, qMin(p95 * barScale, 240.), barHeight),
+                 Qt::gray);
+      p.fillRect(QRectF(barX, barTop, qMin(p50 * barScale, 240.), barHeight),
+                 Qt::white);
+      y += skip;
+    }
+    p.setPen(Qt::yellow);
+    p.drawLine(QPointF(barX + 120, y - skip * (PhaseTimings::NumPhases + 1)),
+               QPointF(barX + 120, y - skip));
+    m_timings.record(PhaseTimings::OverlayPhase, timer.nsecsElapsed());
   }
 }
 
@@ -157,6 +406,60 @@ void FlockWidget::keyPressEvent(QKeyEvent *e)
     m_engine->setCreateBlasts(!m_engine->createBlasts());
     break;
 
+  case Qt::Key_G:
+    m_engine->setNeighborSearch(static_cast<FlockEngine::NeighborSearch>(
+                                  (m_engine->neighborSearch() + 1) %
+                                  FlockEngine::NumNeighborSearches));
+    break;
+
+  case Qt::Key_BracketLeft:
+    m_engine->setVerletSkin(m_engine->verletSkin() * 0.8);
+    break;
+
+  case Qt::Key_BracketRight:
+    m_engine->setVerletSkin(m_engine->verletSkin() * 1.25);
+    break;
+
+  case Qt::Key_K: {
+    // Cycle through the instruction sets this CPU supports
+    int isa = m_engine->pairKernelIsa();
+    do {
+      isa = (isa + 1) % PairKernel::NumIsas;
+    } while (!PairKernel::isSupported(static_cast<PairKernel::Isa>(isa)));
+    m_engine->setPairKernelIsa(static_cast<PairKernel::Isa>(isa));
+    break;
+  }
+
+  case Qt::Key_H:
+    m_engine->setSymmetricPairs(!m_engine->symmetricPairs());
+    break;
+
+  case Qt::Key_M:
+    m_engine->setMultiRate(!m_engine->multiRate());
+    break;
+
+  case Qt::Key_L:
+    m_engine->setForceLawMode(static_cast<ForceLaw::Mode>(
+                                (m_engine->forceLawMode() + 1) %
+                                ForceLaw::NumModes));
+    break;
+
+  case Qt::Key_S:
+    m_useSprites = !m_useSprites;
+    break;
+
+  case Qt::Key_R:
+    m_useTiles = !m_useTiles;
+    break;
+
+  case Qt::Key_Z:
+    m_useRaster = !m_useRaster;
+    break;
+
+  case Qt::Key_D:
+    m_useLod = !m_useLod;
+    break;
+
   case Qt::Key_O:
     m_showOverlay = !m_showOverlay;
     break;
@@ -175,12 +478,26 @@ void FlockWidget::keyPressEvent(QKeyEvent *e)
     Target::setVisible(!Target::visible());
     break;
 
+  case Qt::Key_P:
+    this->captureTrace(defaultTraceFrames());
+    break;
+
+  // Simulation speed; the step itself stays the same size
   case Qt::Key_Up:
-    m_engine->setStepSize(m_engine->stepSize() * 1.25);
+    m_stepInterval = qMax(2., m_stepInterval * 0.8);
     break;
 
   case Qt::Key_Down:
-    m_engine->setStepSize(m_engine->stepSize() * 0.8);
+    m_stepInterval = qMin(200., m_stepInterval * 1.25);
+    break;
+
+  // Render budget
+  case Qt::Key_PageUp:
+    m_timer->setInterval(qMax(1, m_timer->interval() * 4 / 5));
+    break;
+
+  case Qt::Key_PageDown:
+    m_timer->setInterval(qMin(200, m_timer->interval() * 5 / 4 + 1));
     break;
   }
 
@@ -224,6 +541,7 @@ void FlockWidget::setClickPoint(const QPointF &loc)
   Eigen::Vector3d point;
   point.x() = loc.x() / width;
   point.y() = loc.y() / height;
-  point.z() = rand() / static_cast<double>(RAND_MAX);
+  CounterRng rng(m_engine->seed(), 0, CounterRng::ClickStream, m_clicks++);
+  point.z() = rng.uniform();
   m_engine->setForceTarget(point);
 }
@@ -1,10 +1,19 @@
 #ifndef FLOCKWIDGET_H
 #define FLOCKWIDGET_H
 
-#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+
+#include <QtGui/QImage>
 
 #include <QtWidgets/QWidget>
 
+#include "depthorder.h"
+#include "entityviewcache.h"
+#include "lodrenderer.h"
+#include "phasetimings.h"
+#include "spriteatlas.h"
+#include "tilerenderer.h"
+
 class FlockEngine;
 
 class FlockWidget : public QWidget
@@ -14,6 +23,11 @@ public:
   explicit FlockWidget(QWidget *parent = 0);
   virtual ~FlockWidget();
 
+  // Record a Chrome trace of the next frames frames into
+  // swarm-trace-<time>.json in the working directory.
+  void captureTrace(int frames);
+  static int defaultTraceFrames() { return 120; }
+
 protected slots:
   void takeStep();
 
@@ -29,16 +43,56 @@ protected:
 
   void setClickPoint(const QPointF &loc);
 
+  // Bring the views and draw order up to date with the engine's current
+  // frame if it has stepped, place them alpha of the way from the frame
+  // before and, when rendering on worker threads, render them into m_image
+  // for paintEvent() to show.
+  void renderFrame(bool stepped, double alpha);
+  void recordStepTimings();
+  // True if frames are rendered into m_image rather than in paintEvent().
+  bool rendersToImage() const
+  {
+    return m_useTiles || m_useRaster || m_useLod;
+  }
+
   QTimer *m_timer;
 
   FlockEngine *m_engine;
+  EntityViewCache m_views;
+  DepthOrder m_depthOrder;
+  QVector<Entity*> m_drawOrder;
+  SpriteAtlas m_sprites;
+  TileRenderer m_tiles;
+  LodRenderer m_lod;
+  QImage m_image;
+  QVector<unsigned int> m_counts;
 
-  QDateTime m_lastRender;
+  // Runs from one takeStep() to the next
+  QElapsedTimer m_frameTimer;
+  PhaseTimings m_timings;
   float m_currentFPS;
   float m_fpsSum;
   float m_fpsCount;
 
   bool m_aborted;
+  bool m_showOverlay;
+  // Renderers other than direct painting start off and are toggled from
+  // the keyboard.
+  bool m_useSprites;
+  bool m_useTiles;
+  bool m_useRaster;
+  bool m_useLod;
+
+  // Fixed simulation clock: one step per m_stepInterval ms of wall time,
+  // at most maxSubSteps() per frame. m_simLag is the wall time not yet
+  // stepped through.
+  static int maxSubSteps() { return 4; }
+  double m_stepInterval;
+  qint64 m_simLag;
+  int m_lastSubSteps;
+  quint64 m_droppedSteps;
+  // Counter for the random click depths
+  quint64 m_clicks;
 };
 
 #endif // FLOCKWIDGET_H
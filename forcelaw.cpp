@@ -0,0 +1,128 @@
+#include "forcelaw.h"
+
+#include <QtCore/QtGlobal>
+#include <QtCore/QVector>
+
+#include <cmath>
+
+namespace {
+// Linear interpolation error is below 2.1e-7 at this resolution.
+const int tableSize = 2048;
+const double tableTolerance = 1e-6;
+
+// Worst case rounding noise of V_morse_ND times r. Measured at about 5.3e-3.
+const double finiteDifferenceNoise = 1e-2;
+
+struct TableData
+{
+  TableData() : values(tableSize + 1)
+  {
+    const double spacing = Interaction::alignCutoff / tableSize;
+    for (int i = 0; i <= tableSize; ++i)
+      values[i] = ForceLaw::analytic(i * spacing);
+
+    table.values = values.constData();
+    table.size = values.size();
+    table.invSpacing = 1. / spacing;
+    // Just below the last interval's end, so lookups never read past it.
+    table.maxPosition = tableSize - 1e-9;
+
+#ifndef QT_NO_DEBUG
+    // Midpoints are where linear interpolation is furthest off.
+    for (int i = 0; i < tableSize; ++i) {
+      const double r = (i + 0.5) * spacing;
+      Q_ASSERT(std::fabs(0.5 * (values[i] + values[i + 1]) -
+                         ForceLaw::analytic(r)) < tableTolerance);
+    }
+#endif
+  }
+
+  QVector<double> values;
+  ForceLaw::Table table;
+};
+} // end anon namespace
+
+ForceLaw::ForceLaw(Mode mode)
+{
+  this->setMode(mode);
+}
+
+void ForceLaw::setMode(Mode mode)
+{
+  m_mode = (mode >= Exact && mode < NumModes) ? mode : Analytic;
+  if (m_mode == Tabulated)
+    table();
+}
+
+const ForceLaw::Table &ForceLaw::table()
+{
+  static const TableData data;
+  return data.table;
+}
+
+double ForceLaw::errorBound(Mode mode, double r)
+{
+  switch (mode) {
+  case Exact:
+    return 0.;
+  case Tabulated:
+    return finiteDifferenceNoise / r + tableTolerance;
+  default:
+    return finiteDifferenceNoise / r;
+  }
+}
+
+double ForceLaw::tableError(double r)
+{
+  return std::fabs(tabulated(r) - analytic(r));
+}
+
+double ForceLaw::checkAccuracy(Mode mode, int samples)
+{
+  if (mode == Tabulated)
+    return checkTable(samples);
+
+  const ForceLaw law(mode);
+  double worst = 0.;
+  for (int i = 1; i <= samples; ++i) {
+    const double r = Interaction::alignCutoff * i / samples;
+    const double error = std::fabs(law.derivative(r) - exact(r));
+    const double bound = errorBound(mode, r);
+    const double ratio = bound > 0. ? error / bound : (error > 0. ? 2. : 0.);
+    if (ratio > worst)
+      worst = ratio;
+  }
+  return worst;
+}
+
+double ForceLaw::checkTable(int samples)
+{
+  const Table &t = table();
+  const double spacing = 1. / t.invSpacing;
+  double worst = 0.;
+  // Evenly spread samples, the midpoint of every interval, where linear
+  // interpolation is furthest off, and the last interval's end, where
+  // lookups are clamped to maxPosition.
+  for (int i = 1; i <= samples; ++i)
+    worst = qMax(worst, tableError(Interaction::alignCutoff * i / samples));
+  for (int i = 0; i + 1 < t.size; ++i)
+    worst = qMax(worst, tableError((i + 0.5) * spacing));
+  for (double d = 1e-3; d > 1e-13; d *= 1e-3)
+    worst = qMax(worst, tableError(Interaction::alignCutoff - d * spacing));
+  worst = qMax(worst, tableError(Interaction::alignCutoff));
+  return worst / tableTolerance;
+}
+
+const char *ForceLaw::modeName(Mode mode)
+{
+  switch (mode) {
+  case Exact:
+    return "exact";
+  case Analytic:
+    return "analytic";
+  case Tabulated:
+    return "tabulated";
+  default:
+    return "unknown";
+  }
+}
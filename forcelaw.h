@@ -0,0 +1,100 @@
+#ifndef FORCELAW_H
+#define FORCELAW_H
+
+#include "interaction.h"
+
+// Derivative of the Morse potential used by the pair interaction.
+//
+// Exact reproduces Interaction::V_morse_ND, the original central difference
+// (two fastexp5 evaluations and a division per pair). Analytic differentiates
+// the fastexp5 polynomial in closed form. Tabulated interpolates linearly in
+// a table of the analytic derivative over [0, Interaction::alignCutoff],
+// built once on first use.
+class ForceLaw
+{
+public:
+  enum Mode {
+    Exact = 0,
+    Analytic,
+    Tabulated,
+    NumModes
+  };
+
+  explicit ForceLaw(Mode mode = Analytic);
+
+  Mode mode() const { return m_mode; }
+  void setMode(Mode mode);
+
+  double derivative(double r) const
+  {
+    switch (m_mode) {
+    case Exact:
+      return exact(r);
+    case Tabulated:
+      return tabulated(r);
+    default:
+      return analytic(r);
+    }
+  }
+
+  static double exact(double r) { return Interaction::V_morse_ND(r); }
+
+  static double analytic(double r)
+  {
+    using namespace Interaction;
+    // V = depth * (1 - P(x))^2 - depth, with P = fastexp5 and
+    // x = -alpha * (r - rad).
+    const double x = -morseAlpha * (r - morseRad);
+    const double p = (120+x*(120+x*(60+x*(20+x*(5+x))))) * (1. / 120.);
+    const double dp = (120+x*(120+x*(60+x*(20+x*5)))) * (1. / 120.);
+    return 2. * morseDepth * morseAlpha * (1. - p) * dp;
+  }
+
+  static double tabulated(double r)
+  {
+    const Table &t = table();
+    double s = r * t.invSpacing;
+    if (s > t.maxPosition)
+      s = t.maxPosition;
+    const int i = static_cast<int>(s);
+    const double frac = s - i;
+    return t.values[i] + frac * (t.values[i + 1] - t.values[i]);
+  }
+
+  // Samples of the analytic derivative at r = i / invSpacing. Lookups clamp
+  // to maxPosition, so values[i + 1] is always valid.
+  struct Table
+  {
+    const double *values;
+    int size;
+    double invSpacing;
+    double maxPosition;
+  };
+  static const Table & table();
+
+  // Upper bound on |derivative(r) - exact(r)| for mode. V_morse_ND differences
+  // single precision fastexp5 results over a step of 2e-5 r, so its rounding
+  // noise grows like 1/r and dominates the bound.
+  static double errorBound(Mode mode, double r);
+
+  // Sample r over (0, alignCutoff] and return the largest ratio of the error
+  // against V_morse_ND to errorBound(). Anything above 1 is a bug.
+  // Tabulated is the exception and returns checkTable(samples): against
+  // V_morse_ND, whose noise is far larger than the table's, an interval off
+  // by one would still pass.
+  static double checkAccuracy(Mode mode, int samples = 100000);
+  // The largest error of the table against analytic(), the function it
+  // samples, as a ratio to the interpolation tolerance. Covers every
+  // interval's midpoint and lookups near the maxPosition clamp as well as
+  // samples spread over (0, alignCutoff]. Anything above 1 is a bug.
+  static double checkTable(int samples = 100000);
+
+  static const char * modeName(Mode mode);
+
+private:
+  static double tableError(double r);
+
+  Mode m_mode;
+};
+
+#endif // FORCELAW_H
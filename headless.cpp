@@ -0,0 +1,228 @@
+#include <QtCore/QCommandLineOption>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <QtCore/QVector>
+
+#include "flockengine.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+// Nearest-rank percentile of sorted, which must not be empty.
+double percentile(const QVector<double> &sorted, double p)
+{
+  int rank = static_cast<int>(p / 100. * sorted.size() + 0.5);
+  rank = qBound(1, rank, sorted.size());
+  return sorted[rank - 1];
+}
+
+bool parseIsa(const QString &name, PairKernel::Isa *isa)
+{
+  for (int i = 0; i < PairKernel::NumIsas; ++i) {
+    const PairKernel::Isa candidate = static_cast<PairKernel::Isa>(i);
+    if (name.compare(PairKernel::isaName(candidate), Qt::CaseInsensitive) == 0) {
+      *isa = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool parseForceLaw(const QString &name, ForceLaw::Mode *mode)
+{
+  for (int i = 0; i < ForceLaw::NumModes; ++i) {
+    const ForceLaw::Mode candidate = static_cast<ForceLaw::Mode>(i);
+    if (name.compare(ForceLaw::modeName(candidate), Qt::CaseInsensitive) == 0) {
+      *mode = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+} // end anon namespace
+
+int main(int argc, char **argv)
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("swarm-headless");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+        "Runs the flocking simulation without rendering and reports "
+        "throughput and per-step latency.");
+  parser.addHelpOption();
+
+  const QCommandLineOption stepsOption(
+        QStringList() << "n" << "steps", "Number of timed steps.", "N", "1000");
+  const QCommandLineOption warmupOption(
+        "warmup", "Untimed steps to run first.", "N", "10");
+  const QCommandLineOption seedOption(
+        "seed", "Seed for the initial population.", "S", "1");
+  const QCommandLineOption flockersOption(
+        "flockers", "Number of flockers.", "N", "500");
+  const QCommandLineOption flockerTypesOption(
+        "flocker-types", "Number of flocker types.", "N", "12");
+  const QCommandLineOption predatorsOption(
+        "predators", "Number of predators.", "N", "30");
+  const QCommandLineOption predatorTypesOption(
+        "predator-types", "Number of predator types.", "N", "3");
+  const QCommandLineOption targetsOption(
+        "targets", "Targets per flocker type.", "N", "3");
+  const QCommandLineOption bruteForceOption(
+        "brute-force", "Use brute force instead of the cell list.");
+  const QCommandLineOption verletOption(
+        "verlet", "Use Verlet neighbor lists instead of the cell list.");
+  const QCommandLineOption skinOption(
+        "skin", "Verlet list skin.", "R", "0.06");
+  const QCommandLineOption fullPairsOption(
+        "full-pairs", "Evaluate each pair from both sides.");
+  const QCommandLineOption multiRateOption(
+        "multi-rate", "Evaluate quiet flockers every second or fourth step. "
+        "Has no effect with half pairs, the default for the cell list.");
+  const QCommandLineOption isaOption(
+        "isa", "Pair kernel instruction set: scalar, SSE2, AVX2 or AVX-512.",
+        "ISA");
+  const QCommandLineOption forceLawOption(
+        "force-law", "Morse derivative: exact, analytic or tabulated.", "MODE");
+  const QCommandLineOption threadsOption(
+        "threads", "Engine threads; 0 uses every core.", "N", "0");
+  const QCommandLineOption traceOption(
+        "trace", "Write a Chrome trace of the first timed steps to FILE.",
+        "FILE");
+  const QCommandLineOption traceStepsOption(
+        "trace-steps", "Number of steps to trace.", "N", "50");
+  parser.addOption(stepsOption);
+  parser.addOption(warmupOption);
+  parser.addOption(seedOption);
+  parser.addOption(flockersOption);
+  parser.addOption(flockerTypesOption);
+  parser.addOption(predatorsOption);
+  parser.addOption(predatorTypesOption);
+  parser.addOption(targetsOption);
+  parser.addOption(bruteForceOption);
+  parser.addOption(verletOption);
+  parser.addOption(skinOption);
+  parser.addOption(fullPairsOption);
+  parser.addOption(multiRateOption);
+  parser.addOption(isaOption);
+  parser.addOption(forceLawOption);
+  parser.addOption(threadsOption);
+  parser.addOption(traceOption);
+  parser.addOption(traceStepsOption);
+  parser.process(app);
+
+  const int steps = qMax(1, parser.value(stepsOption).toInt());
+  const int warmup = qMax(0, parser.value(warmupOption).toInt());
+  const quint64 seed = parser.value(seedOption).toULongLong();
+
+  FlockEngine engine;
+  engine.setNumFlockers(parser.value(flockersOption).toUInt());
+  engine.setNumFlockerTypes(parser.value(flockerTypesOption).toUInt());
+  engine.setNumPredators(parser.value(predatorsOption).toUInt());
+  engine.setNumPredatorTypes(parser.value(predatorTypesOption).toUInt());
+  engine.setNumTargetsPerFlockerType(parser.value(targetsOption).toUInt());
+  if (parser.isSet(bruteForceOption))
+    engine.setNeighborSearch(FlockEngine::BruteForceSearch);
+  else if (parser.isSet(verletOption))
+    engine.setNeighborSearch(FlockEngine::VerletListSearch);
+  else
+    engine.setNeighborSearch(FlockEngine::CellListSearch);
+  engine.setVerletSkin(parser.value(skinOption).toDouble());
+  engine.setSymmetricPairs(!parser.isSet(fullPairsOption));
+  engine.setMultiRate(parser.isSet(multiRateOption));
+  engine.setThreadCount(parser.value(threadsOption).toInt());
+
+  if (parser.isSet(isaOption)) {
+    PairKernel::Isa isa;
+    if (!parseIsa(parser.value(isaOption), &isa)) {
+      fprintf(stderr, "Unknown ISA: %s\n", qPrintable(parser.value(isaOption)));
+      return 1;
+    }
+    engine.setPairKernelIsa(isa);
+  }
+  if (parser.isSet(forceLawOption)) {
+    ForceLaw::Mode mode;
+    if (!parseForceLaw(parser.value(forceLawOption), &mode)) {
+      fprintf(stderr, "Unknown force law: %s\n",
+              qPrintable(parser.value(forceLawOption)));
+      return 1;
+    }
+    engine.setForceLawMode(mode);
+  }
+
+  engine.reset(seed);
+
+  for (int i = 0; i < warmup; ++i) {
+    engine.computeNextStep();
+    engine.commitNextStep();
+  }
+
+  QVector<double> latencies;
+  latencies.reserve(steps);
+  QElapsedTimer total;
+  QElapsedTimer step;
+  qint64 coasted = 0;
+  qint64 flockerSteps = 0;
+  if (parser.isSet(traceOption)) {
+    Trace::captureFrames(qBound(1, parser.value(traceStepsOption).toInt(),
+                                steps),
+                         parser.value(traceOption));
+  }
+  total.start();
+  for (int i = 0; i < steps; ++i) {
+    step.start();
+    engine.computeNextStep();
+    engine.commitNextStep();
+    latencies.push_back(step.nsecsElapsed() * 1e-6);
+    coasted += engine.numCoasted();
+    flockerSteps += engine.store().count(EntityStore::FlockerKind);
+    Trace::endFrame();
+  }
+  const double seconds = total.nsecsElapsed() * 1e-9;
+  std::sort(latencies.begin(), latencies.end());
+
+  const EntityStore &store = engine.store();
+  QTextStream out(stdout);
+  out << "seed:          " << seed << "\n"
+      << "steps:         " << steps << " (+" << warmup << " warmup)\n"
+      << "neighbors:     "
+      << FlockEngine::neighborSearchName(engine.neighborSearch())
+      << (engine.symmetricPairs() ? ", half pairs" : ", full pairs") << "\n"
+      << "list rebuilds: " << engine.verletRebuilds() << "\n"
+      << "pair kernel:   " << PairKernel::isaName(engine.pairKernelIsa())
+      << "\n"
+      << "force law:     " << ForceLaw::modeName(engine.forceLawMode()) << "\n"
+      << "multi-rate:    ";
+  if (engine.multiRate()) {
+    out << "on, " << QString::number(flockerSteps > 0 ?
+                                       100. * coasted / flockerSteps : 0.,
+                                     'f', 1)
+        << "% of flocker steps coasted";
+    if (engine.neighborSearch() == FlockEngine::CellListSearch &&
+        engine.symmetricPairs())
+      out << " (half pairs: every flocker evaluated)";
+    out << "\n";
+  }
+  else {
+    out << "off\n";
+  }
+  out << "threads:       " << engine.threadCount() << "\n"
+      << "entities:      " << store.size() << " ("
+      << store.count(EntityStore::FlockerKind) << " flockers, "
+      << store.count(EntityStore::PredatorKind) << " predators, "
+      << store.count(EntityStore::TargetKind) << " targets, "
+      << store.count(EntityStore::BlastKind) << " blasts)\n"
+      << "steps/sec:     " << QString::number(steps / seconds, 'f', 2) << "\n"
+      << "latency (ms):  "
+      << "p50 " << QString::number(percentile(latencies, 50.), 'f', 3)
+      << "  p90 " << QString::number(percentile(latencies, 90.), 'f', 3)
+      << "  p99 " << QString::number(percentile(latencies, 99.), 'f', 3)
+      << "  max " << QString::number(latencies.last(), 'f', 3) << "\n";
+
+  return 0;
+}
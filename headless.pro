@@ -0,0 +1,12 @@
+# Render-less simulation runner: qmake headless.pro
+include(engine.pri)
+
+TARGET = swarm-headless
+
+SOURCES += \
+    headless.cpp
+
+QT -= gui
+
+CONFIG += console
+CONFIG -= app_bundle
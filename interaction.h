@@ -0,0 +1,55 @@
+#ifndef INTERACTION_H
+#define INTERACTION_H
+
+// Constants and potentials shared by every implementation of the pairwise
+// flocker interaction.
+namespace Interaction {
+
+// Cutoffs. Flockers only see neighbors within alignCutoff, while predators
+// hunt out to predatorCutoff.
+const double morseCutoff    = 0.20;
+const double alignCutoff    = 0.30;
+const double predatorCutoff = 0.60;
+// Flockers evade predators within evadeCutoff; predators of different types
+// repel within predatorRepelCutoff; pursuit strengthens within pursueCutoff.
+const double evadeCutoff         = 0.30;
+const double predatorRepelCutoff = 0.50;
+const double pursueCutoff        = 0.15;
+// Kill radius for if predators catch flockers:
+const double killRadius = 0.020;
+// Distances below these are not inverted / aligned to.
+const double minInvertNorm = 0.01;
+const double minAlignNorm  = 0.001;
+
+// Morse potential parameters
+const double morseDepth = 1.00;
+const double morseRad   = 0.10;
+const double morseAlpha = 2.00;
+
+// See http://www.musicdsp.org/showone.php?id=222 for more info
+inline float fastexp5(float x) {
+    return (120+x*(120+x*(60+x*(20+x*(5+x)))))*0.0083333333f;
+}
+
+inline double V_morse(const double r) {
+  const double depth = morseDepth;
+  const double rad   = morseRad;
+  const double alpha = morseAlpha;
+
+  const double tmpTerm = ( 1 - fastexp5( -alpha * (r - rad) ) );
+  double V = depth * tmpTerm * tmpTerm;
+
+  return V - depth;
+}
+
+// Numerical derivatives
+inline double V_morse_ND(const double r) {
+  const double delta = r * 1e-5;
+  const double v1 = V_morse(r - delta);
+  const double v2 = V_morse(r + delta);
+  return (v2 - v1) / (delta + delta);
+}
+
+} // end namespace Interaction
+
+#endif // INTERACTION_H
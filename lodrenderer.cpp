@@ -0,0 +1,141 @@
+#include "lodrenderer.h"
+
+#include <QtCore/QRectF>
+
+#include <QtGui/QPainter>
+
+#include <algorithm>
+#include <cmath>
+
+#include "flocker.h"
+#include "spriteatlas.h"
+#include "tilerenderer.h"
+
+namespace {
+// Flockers within this many of the largest flocker radii of a predator are
+// drawn individually, so a chase stays readable.
+const double predatorReach = 4.;
+
+bool zLessThan(const Entity *a, const Entity *b)
+{
+  return a->pos().z() < b->pos().z();
+}
+} // end anon namespace
+
+LodRenderer::LodRenderer()
+  : m_numSplats(0)
+{
+}
+
+void LodRenderer::render(const QVector<Entity*> &views, SpriteAtlas *sprites,
+                         QImage *image)
+{
+  const int width = image->width();
+  const int height = image->height();
+  const double scale = 0.5 * (width + height);
+  const int columns = (width + binSize() - 1) / binSize();
+  const int rows = (height + binSize() - 1) / binSize();
+
+  const Bin empty = { 0, 0.f, 0.f, 0.f, 0.f, false, false };
+  m_bins.fill(empty, columns * rows);
+
+  // Bin the flockers on screen by their centers. A flocker's triangle
+  // covers the square of its projected direction's length.
+  m_viewBins.resize(views.size());
+  for (int i = 0; i < views.size(); ++i) {
+    const Entity &view = *views[i];
+    m_viewBins[i] = -1;
+    if (view.eType() != Entity::FlockerEntity)
+      continue;
+
+    const Eigen::Vector3d &pos = view.pos();
+    const double x = pos.x() * width;
+    const double y = pos.y() * height;
+    if (x < 0. || x >= width || y < 0. || y >= height)
+      continue;
+    const int index = (static_cast<int>(y) / binSize()) * columns +
+        static_cast<int>(x) / binSize();
+
+    const double radius = Flocker::radius(pos.z()) * scale;
+    const double dx = view.direction().x() * radius;
+    const double dy = view.direction().y() * radius;
+    const float area = static_cast<float>(dx * dx + dy * dy);
+    const QColor &color = view.color();
+    Bin &bin = m_bins[index];
+    ++bin.count;
+    bin.area += area;
+    bin.red += area * color.red();
+    bin.green += area * color.green();
+    bin.blue += area * color.blue();
+    m_viewBins[i] = index;
+  }
+
+  // Keep the bins around each predator in full detail
+  const int reach = static_cast<int>(
+        std::ceil(predatorReach * Flocker::maxRadius() * scale / binSize()));
+  foreach (const Entity *view, views) {
+    if (view->eType() != Entity::PredatorEntity)
+      continue;
+    const int column = static_cast<int>(
+          std::floor(view->pos().x() * width / binSize()));
+    const int row = static_cast<int>(
+          std::floor(view->pos().y() * height / binSize()));
+    for (int r = qMax(0, row - reach); r <= qMin(rows - 1, row + reach); ++r) {
+      for (int c = qMax(0, column - reach);
+           c <= qMin(columns - 1, column + reach); ++c) {
+        m_bins[r * columns + c].detailed = true;
+      }
+    }
+  }
+
+  // Splat the dense bins, leaving the rest transparent
+  if (m_splats.width() != columns || m_splats.height() != rows)
+    m_splats = QImage(columns, rows, QImage::Format_ARGB32_Premultiplied);
+  const float binArea = binSize() * binSize();
+  m_numSplats = 0;
+  for (int r = 0; r < rows; ++r) {
+    QRgb *line = reinterpret_cast<QRgb *>(m_splats.scanLine(r));
+    for (int c = 0; c < columns; ++c) {
+      Bin &bin = m_bins[r * columns + c];
+      if (bin.detailed) {
+        bin.dense = bin.count > detailFactor() * maxPerBin();
+      }
+      else {
+        bin.dense = bin.count > maxPerBin() ||
+            bin.area >= denseCoverage() * binArea;
+      }
+      if (bin.dense)
+        ++m_numSplats;
+      // Flockers seen end on cover nothing
+      if (!bin.dense || bin.area <= 0.f) {
+        line[c] = 0;
+        continue;
+      }
+      const float alpha = qMin(1.f, bin.area / binArea);
+      line[c] = qPremultiply(qRgba(static_cast<int>(bin.red / bin.area),
+                                   static_cast<int>(bin.green / bin.area),
+                                   static_cast<int>(bin.blue / bin.area),
+                                   static_cast<int>(255.f * alpha)));
+    }
+  }
+
+  // Everything not splatted is drawn as it is
+  m_drawn.resize(0);
+  for (int i = 0; i < views.size(); ++i) {
+    const int bin = m_viewBins[i];
+    if (bin < 0 || !m_bins[bin].dense)
+      m_drawn.push_back(views[i]);
+  }
+  std::stable_sort(m_drawn.begin(), m_drawn.end(), zLessThan);
+  if (sprites)
+    sprites->prepare(width, height, m_drawn);
+
+  image->fill(Qt::black);
+  QPainter p(image);
+  p.save();
+  p.setRenderHint(QPainter::SmoothPixmapTransform);
+  p.drawImage(QRectF(0., 0., columns * binSize(), rows * binSize()),
+              m_splats, QRectF(0., 0., columns, rows));
+  p.restore();
+  TileRenderer::draw(&p, m_drawn.constData(), m_drawn.size(), sprites);
+}
@@ -0,0 +1,75 @@
+#ifndef LODRENDERER_H
+#define LODRENDERER_H
+
+#include <QtCore/QVector>
+
+#include <QtGui/QImage>
+
+#include "entity.h"
+
+class SpriteAtlas;
+
+// Renders crowded frames at a level of detail set by on-screen density.
+//
+// The device is divided into square bins of binSize() pixels, and each
+// flocker is counted in the bin its center lands in, along with the area
+// its triangle covers. Where a bin's flockers would cover it denseCoverage()
+// times over, or there are more than maxPerBin() of them, their triangles
+// would only pile up into a blob, so the bin is drawn as one impostor
+// instead: a splat of their area-weighted mean color, as opaque as they
+// cover the bin. The splats are kept as one pixel per bin and scaled up
+// smoothly over the frame, which softens the edges of a flock.
+//
+// Near a predator, bins keep their flockers unless there are more than
+// detailFactor() times maxPerBin() of them. Those flockers, the ones in
+// sparse bins, and all predators, targets and blasts are drawn one by one,
+// back to front, over the splats. Every bin draws a bounded number of
+// flockers, so the drawing cost follows the device size rather than the
+// number of entities.
+class LodRenderer
+{
+public:
+  LodRenderer();
+
+  // Render views, in any order, over a black background. Flockers and
+  // predators are drawn from sprites if given an atlas, which is prepared
+  // for the views drawn individually.
+  void render(const QVector<Entity*> &views, SpriteAtlas *sprites,
+              QImage *image);
+
+  // Bins in the last render(), those drawn as splats, and the views drawn
+  // individually.
+  int numBins() const { return m_bins.size(); }
+  int numSplats() const { return m_numSplats; }
+  int numDrawn() const { return m_drawn.size(); }
+
+  static int binSize() { return 16; }
+  static double denseCoverage() { return 2.; }
+  static int maxPerBin() { return 12; }
+  static int detailFactor() { return 4; }
+
+private:
+  struct Bin
+  {
+    int count;
+    // Area covered by the bin's flockers, in square pixels, and their
+    // colors' channels weighted by it
+    float area;
+    float red;
+    float green;
+    float blue;
+    // Near a predator, so splatted only past the looser limit
+    bool detailed;
+    bool dense;
+  };
+
+  QVector<Bin> m_bins;
+  // Bin of each view, or -1 for views that aren't binned
+  QVector<int> m_viewBins;
+  // One pixel per bin
+  QImage m_splats;
+  int m_numSplats;
+  QVector<Entity*> m_drawn;
+};
+
+#endif // LODRENDERER_H
@@ -8,6 +8,7 @@
 
 #include <flockwidget.h>
 
+#include <stdlib.h>
 #include <string.h>
 
 int main(int argc, char **argv)
@@ -15,18 +16,27 @@ int main(int argc, char **argv)
   QApplication app(argc, argv);
 
   bool fullscreen = false;
+  int traceFrames = 0;
   if (argc >= 2) {
     int argInd = 0;
     while (char *arg = argv[argInd++]) {
       if (strcmp(arg, "-f") == true) {
         fullscreen = true;
       }
+      // --trace [frames]: record a Chrome trace of the first frames
+      else if (strcmp(arg, "--trace") == 0) {
+        traceFrames = FlockWidget::defaultTraceFrames();
+        if (argv[argInd] && atoi(argv[argInd]) > 0)
+          traceFrames = atoi(argv[argInd++]);
+      }
     }
   }
 
   QMainWindow mw;
-  QWidget *target = new FlockWidget(&mw);
+  FlockWidget *target = new FlockWidget(&mw);
   mw.setCentralWidget(target);
+  if (traceFrames > 0)
+    target->captureTrace(traceFrames);
 
   if (fullscreen) {
     mw.showFullScreen();
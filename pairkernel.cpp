@@ -0,0 +1,456 @@
+#include "pairkernel.h"
+
+#include "forcelaw.h"
+#include "interaction.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#  define PAIRKERNEL_X86
+#  include <immintrin.h>
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#  endif
+#endif
+
+namespace {
+
+namespace scalar {
+struct Vec
+{
+  typedef double Reg;
+  typedef bool Mask;
+  enum { Width = 1 };
+
+  static Reg set1(double d) { return d; }
+  static Reg zero() { return 0.; }
+  static Reg loadu(const double *p) { return *p; }
+  static void storeu(double *p, Reg a) { *p = a; }
+  static Reg iota() { return 0.; }
+
+  static Reg add(Reg a, Reg b) { return a + b; }
+  static Reg sub(Reg a, Reg b) { return a - b; }
+  static Reg mul(Reg a, Reg b) { return a * b; }
+  static Reg div(Reg a, Reg b) { return a / b; }
+  static Reg sqrt(Reg a) { return std::sqrt(a); }
+  static Reg min(Reg a, Reg b) { return a < b ? a : b; }
+
+  static Mask lt(Reg a, Reg b) { return a < b; }
+  static Mask le(Reg a, Reg b) { return a <= b; }
+  static Mask gt(Reg a, Reg b) { return a > b; }
+  static Mask eq(Reg a, Reg b) { return a == b; }
+  static Mask mand(Mask a, Mask b) { return a && b; }
+  static Mask mor(Mask a, Mask b) { return a || b; }
+  // a && !b
+  static Mask mandnot(Mask a, Mask b) { return a && !b; }
+  static Mask noneMask() { return false; }
+  static bool any(Mask m) { return m; }
+  static Reg select(Mask m, Reg a, Reg b) { return m ? a : b; }
+
+  static double hsum(Reg a) { return a; }
+
+  static Reg fastexp5(Reg x)
+  {
+    return Interaction::fastexp5(static_cast<float>(x));
+  }
+
+  // Linear interpolation in table at position s >= 0.
+  static Reg interpolate(const double *table, Reg s)
+  {
+    const int i = static_cast<int>(s);
+    return table[i] + (s - i) * (table[i + 1] - table[i]);
+  }
+};
+#include "pairkernelimpl.h"
+} // end namespace scalar
+
+#ifdef PAIRKERNEL_X86
+
+// The SIMD variants are compiled for their instruction set regardless of the
+// compiler flags, and only called after a runtime CPU check.
+
+#if defined(__clang__)
+#  pragma clang attribute push (__attribute__((target("sse2"))), \
+                                apply_to = function)
+#elif defined(__GNUC__)
+#  pragma GCC push_options
+#  pragma GCC target("sse2")
+#endif
+namespace sse2 {
+struct Vec
+{
+  typedef __m128d Reg;
+  typedef __m128d Mask;
+  enum { Width = 2 };
+
+  static Reg set1(double d) { return _mm_set1_pd(d); }
+  static Reg zero() { return _mm_setzero_pd(); }
+  static Reg loadu(const double *p) { return _mm_loadu_pd(p); }
+  static void storeu(double *p, Reg a) { _mm_storeu_pd(p, a); }
+  static Reg iota() { return _mm_set_pd(1., 0.); }
+
+  static Reg add(Reg a, Reg b) { return _mm_add_pd(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm_sub_pd(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm_mul_pd(a, b); }
+  static Reg div(Reg a, Reg b) { return _mm_div_pd(a, b); }
+  static Reg sqrt(Reg a) { return _mm_sqrt_pd(a); }
+  static Reg min(Reg a, Reg b) { return _mm_min_pd(a, b); }
+
+  static Mask lt(Reg a, Reg b) { return _mm_cmplt_pd(a, b); }
+  static Mask le(Reg a, Reg b) { return _mm_cmple_pd(a, b); }
+  static Mask gt(Reg a, Reg b) { return _mm_cmpgt_pd(a, b); }
+  static Mask eq(Reg a, Reg b) { return _mm_cmpeq_pd(a, b); }
+  static Mask mand(Mask a, Mask b) { return _mm_and_pd(a, b); }
+  static Mask mor(Mask a, Mask b) { return _mm_or_pd(a, b); }
+  static Mask mandnot(Mask a, Mask b) { return _mm_andnot_pd(b, a); }
+  static Mask noneMask() { return _mm_setzero_pd(); }
+  static bool any(Mask m) { return _mm_movemask_pd(m) != 0; }
+  static Reg select(Mask m, Reg a, Reg b)
+  {
+    return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b));
+  }
+
+  static double hsum(Reg a)
+  {
+    double t[2];
+    _mm_storeu_pd(t, a);
+    return t[0] + t[1];
+  }
+
+  // Evaluated in single precision, like Interaction::fastexp5.
+  static Reg fastexp5(Reg x)
+  {
+    const __m128 xf = _mm_cvtpd_ps(x);
+    __m128 t = _mm_add_ps(_mm_set1_ps(5.f), xf);
+    t = _mm_add_ps(_mm_set1_ps(20.f), _mm_mul_ps(xf, t));
+    t = _mm_add_ps(_mm_set1_ps(60.f), _mm_mul_ps(xf, t));
+    t = _mm_add_ps(_mm_set1_ps(120.f), _mm_mul_ps(xf, t));
+    t = _mm_add_ps(_mm_set1_ps(120.f), _mm_mul_ps(xf, t));
+    return _mm_cvtps_pd(_mm_mul_ps(t, _mm_set1_ps(0.0083333333f)));
+  }
+
+  // SSE2 has no gather, so load the two lanes separately.
+  static Reg interpolate(const double *table, Reg s)
+  {
+    const __m128i idx = _mm_cvttpd_epi32(s);
+    const int i0 = _mm_cvtsi128_si32(idx);
+    const int i1 = _mm_cvtsi128_si32(_mm_srli_si128(idx, 4));
+    const Reg lo = _mm_set_pd(table[i1], table[i0]);
+    const Reg hi = _mm_set_pd(table[i1 + 1], table[i0 + 1]);
+    const Reg frac = _mm_sub_pd(s, _mm_cvtepi32_pd(idx));
+    return _mm_add_pd(lo, _mm_mul_pd(frac, _mm_sub_pd(hi, lo)));
+  }
+};
+#include "pairkernelimpl.h"
+} // end namespace sse2
+#if defined(__clang__)
+#  pragma clang attribute pop
+#elif defined(__GNUC__)
+#  pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#  pragma clang attribute push (__attribute__((target("avx2"))), \
+                                apply_to = function)
+#elif defined(__GNUC__)
+#  pragma GCC push_options
+#  pragma GCC target("avx2")
+#endif
+namespace avx2 {
+struct Vec
+{
+  typedef __m256d Reg;
+  typedef __m256d Mask;
+  enum { Width = 4 };
+
+  static Reg set1(double d) { return _mm256_set1_pd(d); }
+  static Reg zero() { return _mm256_setzero_pd(); }
+  static Reg loadu(const double *p) { return _mm256_loadu_pd(p); }
+  static void storeu(double *p, Reg a) { _mm256_storeu_pd(p, a); }
+  static Reg iota() { return _mm256_set_pd(3., 2., 1., 0.); }
+
+  static Reg add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+  static Reg div(Reg a, Reg b) { return _mm256_div_pd(a, b); }
+  static Reg sqrt(Reg a) { return _mm256_sqrt_pd(a); }
+  static Reg min(Reg a, Reg b) { return _mm256_min_pd(a, b); }
+
+  static Mask lt(Reg a, Reg b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+  static Mask le(Reg a, Reg b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+  static Mask gt(Reg a, Reg b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+  static Mask eq(Reg a, Reg b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+  static Mask mand(Mask a, Mask b) { return _mm256_and_pd(a, b); }
+  static Mask mor(Mask a, Mask b) { return _mm256_or_pd(a, b); }
+  static Mask mandnot(Mask a, Mask b) { return _mm256_andnot_pd(b, a); }
+  static Mask noneMask() { return _mm256_setzero_pd(); }
+  static bool any(Mask m) { return _mm256_movemask_pd(m) != 0; }
+  static Reg select(Mask m, Reg a, Reg b) { return _mm256_blendv_pd(b, a, m); }
+
+  static double hsum(Reg a)
+  {
+    const __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(a),
+                                    _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+  }
+
+  // Evaluated in single precision, like Interaction::fastexp5.
+  static Reg fastexp5(Reg x)
+  {
+    const __m128 xf = _mm256_cvtpd_ps(x);
+    __m128 t = _mm_add_ps(_mm_set1_ps(5.f), xf);
+    t = _mm_add_ps(_mm_set1_ps(20.f), _mm_mul_ps(xf, t));
+    t = _mm_add_ps(_mm_set1_ps(60.f), _mm_mul_ps(xf, t));
+    t = _mm_add_ps(_mm_set1_ps(120.f), _mm_mul_ps(xf, t));
+    t = _mm_add_ps(_mm_set1_ps(120.f), _mm_mul_ps(xf, t));
+    return _mm256_cvtps_pd(_mm_mul_ps(t, _mm_set1_ps(0.0083333333f)));
+  }
+
+  static Reg interpolate(const double *table, Reg s)
+  {
+    const __m128i idx = _mm256_cvttpd_epi32(s);
+    const Reg lo = _mm256_i32gather_pd(table, idx, 8);
+    const Reg hi = _mm256_i32gather_pd(table + 1, idx, 8);
+    const Reg frac = _mm256_sub_pd(s, _mm256_cvtepi32_pd(idx));
+    return _mm256_add_pd(lo, _mm256_mul_pd(frac, _mm256_sub_pd(hi, lo)));
+  }
+};
+#include "pairkernelimpl.h"
+} // end namespace avx2
+#if defined(__clang__)
+#  pragma clang attribute pop
+#elif defined(__GNUC__)
+#  pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#  pragma clang attribute push (__attribute__((target("avx512f"))), \
+                                apply_to = function)
+#elif defined(__GNUC__)
+#  pragma GCC push_options
+#  pragma GCC target("avx512f")
+#endif
+namespace avx512 {
+struct Vec
+{
+  typedef __m512d Reg;
+  typedef __mmask8 Mask;
+  enum { Width = 8 };
+
+  static Reg set1(double d) { return _mm512_set1_pd(d); }
+  static Reg zero() { return _mm512_setzero_pd(); }
+  static Reg loadu(const double *p) { return _mm512_loadu_pd(p); }
+  static void storeu(double *p, Reg a) { _mm512_storeu_pd(p, a); }
+  static Reg iota() { return _mm512_set_pd(7., 6., 5., 4., 3., 2., 1., 0.); }
+
+  static Reg add(Reg a, Reg b) { return _mm512_add_pd(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm512_sub_pd(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm512_mul_pd(a, b); }
+  static Reg div(Reg a, Reg b) { return _mm512_div_pd(a, b); }
+  static Reg sqrt(Reg a) { return _mm512_sqrt_pd(a); }
+  static Reg min(Reg a, Reg b) { return _mm512_min_pd(a, b); }
+
+  static Mask lt(Reg a, Reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+  static Mask le(Reg a, Reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+  static Mask gt(Reg a, Reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+  static Mask eq(Reg a, Reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+  static Mask mand(Mask a, Mask b) { return a & b; }
+  static Mask mor(Mask a, Mask b) { return a | b; }
+  static Mask mandnot(Mask a, Mask b) { return a & ~b; }
+  static Mask noneMask() { return 0; }
+  static bool any(Mask m) { return m != 0; }
+  static Reg select(Mask m, Reg a, Reg b) { return _mm512_mask_blend_pd(m, b, a); }
+
+  static double hsum(Reg a) { return _mm512_reduce_add_pd(a); }
+
+  // Evaluated in single precision, like Interaction::fastexp5.
+  static Reg fastexp5(Reg x)
+  {
+    const __m256 xf = _mm512_cvtpd_ps(x);
+    __m256 t = _mm256_add_ps(_mm256_set1_ps(5.f), xf);
+    t = _mm256_add_ps(_mm256_set1_ps(20.f), _mm256_mul_ps(xf, t));
+    t = _mm256_add_ps(_mm256_set1_ps(60.f), _mm256_mul_ps(xf, t));
+    t = _mm256_add_ps(_mm256_set1_ps(120.f), _mm256_mul_ps(xf, t));
+    t = _mm256_add_ps(_mm256_set1_ps(120.f), _mm256_mul_ps(xf, t));
+    return _mm512_cvtps_pd(_mm256_mul_ps(t, _mm256_set1_ps(0.0083333333f)));
+  }
+
+  static Reg interpolate(const double *table, Reg s)
+  {
+    const __m256i idx = _mm512_cvttpd_epi32(s);
+    const Reg lo = _mm512_i32gather_pd(idx, table, 8);
+    const Reg hi = _mm512_i32gather_pd(idx, table + 1, 8);
+    const Reg frac = _mm512_sub_pd(s, _mm512_cvtepi32_pd(idx));
+    return _mm512_add_pd(lo, _mm512_mul_pd(frac, _mm512_sub_pd(hi, lo)));
+  }
+};
+#include "pairkernelimpl.h"
+} // end namespace avx512
+#if defined(__clang__)
+#  pragma clang attribute pop
+#elif defined(__GNUC__)
+#  pragma GCC pop_options
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+bool msvcCpuSupports(PairKernel::Isa isa)
+{
+  int info[4];
+  __cpuid(info, 0);
+  const int maxLeaf = info[0];
+
+  __cpuid(info, 1);
+  const bool sse2 = (info[3] & (1 << 26)) != 0;
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+  // XMM and YMM state, plus opmask and ZMM state for AVX-512
+  const bool osAvx = (xcr0 & 0x6) == 0x6;
+  const bool osAvx512 = (xcr0 & 0xe6) == 0xe6;
+
+  int ebx7 = 0;
+  if (maxLeaf >= 7) {
+    __cpuidex(info, 7, 0);
+    ebx7 = info[1];
+  }
+
+  switch (isa) {
+  case PairKernel::SSE2:
+    return sse2;
+  case PairKernel::AVX2:
+    return osAvx && (ebx7 & (1 << 5)) != 0;
+  case PairKernel::AVX512:
+    return osAvx512 && (ebx7 & (1 << 16)) != 0;
+  default:
+    return false;
+  }
+}
+#endif
+
+#endif // PAIRKERNEL_X86
+
+bool cpuSupports(PairKernel::Isa isa)
+{
+  if (isa == PairKernel::Scalar)
+    return true;
+
+#if defined(PAIRKERNEL_X86)
+#  if defined(__GNUC__) || defined(__clang__)
+  __builtin_cpu_init();
+  switch (isa) {
+  case PairKernel::SSE2:
+    return __builtin_cpu_supports("sse2");
+  case PairKernel::AVX2:
+    return __builtin_cpu_supports("avx2");
+  case PairKernel::AVX512:
+    return __builtin_cpu_supports("avx512f");
+  default:
+    return false;
+  }
+#  elif defined(_MSC_VER)
+  return msvcCpuSupports(isa);
+#  else
+  return false;
+#  endif
+#else
+  return false;
+#endif
+}
+
+PairKernel::Function functionFor(PairKernel::Isa isa, ForceLaw::Mode law)
+{
+  switch (isa) {
+#ifdef PAIRKERNEL_X86
+  case PairKernel::SSE2:
+    return sse2::functionForLaw(law);
+  case PairKernel::AVX2:
+    return avx2::functionForLaw(law);
+  case PairKernel::AVX512:
+    return avx512::functionForLaw(law);
+#endif
+  default:
+    return scalar::functionForLaw(law);
+  }
+}
+
+PairKernel::SymmetricFunction symmetricFunctionFor(PairKernel::Isa isa,
+                                                   ForceLaw::Mode law)
+{
+  switch (isa) {
+#ifdef PAIRKERNEL_X86
+  case PairKernel::SSE2:
+    return sse2::symmetricFunctionForLaw(law);
+  case PairKernel::AVX2:
+    return avx2::symmetricFunctionForLaw(law);
+  case PairKernel::AVX512:
+    return avx512::symmetricFunctionForLaw(law);
+#endif
+  default:
+    return scalar::symmetricFunctionForLaw(law);
+  }
+}
+} // end anon namespace
+
+void PairKernel::Forces::clear()
+{
+  for (int d = 0; d < 3; ++d) {
+    diffPot[d] = 0.;
+    samePot[d] = 0.;
+    align[d] = 0.;
+    predator[d] = 0.;
+  }
+  caught = false;
+}
+
+PairKernel::PairKernel(Isa isa, ForceLaw::Mode law)
+  : m_law(law)
+{
+  this->setIsa(isa);
+}
+
+void PairKernel::setIsa(Isa isa)
+{
+  m_isa = isSupported(isa) ? isa : Scalar;
+  m_func = functionFor(m_isa, m_law);
+  m_symmetricFunc = symmetricFunctionFor(m_isa, m_law);
+}
+
+void PairKernel::setForceLaw(ForceLaw::Mode law)
+{
+  // Build the table here rather than on a worker thread mid-step
+  if (law == ForceLaw::Tabulated)
+    ForceLaw::table();
+  m_law = law;
+  m_func = functionFor(m_isa, m_law);
+  m_symmetricFunc = symmetricFunctionFor(m_isa, m_law);
+}
+
+PairKernel::Isa PairKernel::bestSupportedIsa()
+{
+  static const Isa best = isSupported(AVX512) ? AVX512
+                        : isSupported(AVX2)   ? AVX2
+                        : isSupported(SSE2)   ? SSE2
+                                              : Scalar;
+  return best;
+}
+
+bool PairKernel::isSupported(Isa isa)
+{
+  return isa >= Scalar && isa < NumIsas && cpuSupports(isa);
+}
+
+const char *PairKernel::isaName(Isa isa)
+{
+  switch (isa) {
+  case Scalar:
+    return "scalar";
+  case SSE2:
+    return "SSE2";
+  case AVX2:
+    return "AVX2";
+  case AVX512:
+    return "AVX-512";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,127 @@
+#ifndef PAIRKERNEL_H
+#define PAIRKERNEL_H
+
+#include <QtCore/QtGlobal>
+
+#include "forcelaw.h"
+
+// Vectorized evaluation of the flocker pair interaction (Morse, alignment and
+// evade/pursue terms) for one entity against a contiguous run of neighbors.
+// Cutoff and type tests are evaluated as lane masks. The instruction set is
+// picked at runtime, so one binary runs on any x86-64 host; the Scalar
+// variant runs the same code one lane at a time everywhere else.
+class PairKernel
+{
+public:
+  enum Isa {
+    Scalar = 0,
+    SSE2,
+    AVX2,
+    AVX512,
+    NumIsas
+  };
+
+  // Neighbor data in structure-of-arrays form. Every array must stay
+  // readable for paddingLanes() entries past the last neighbor passed in.
+  struct Neighbors
+  {
+    const double *x;
+    const double *y;
+    const double *z;
+    const double *dx;
+    const double *dy;
+    const double *dz;
+    // Flocker type, and 1.0 for predators / 0.0 otherwise
+    const double *type;
+    const double *predator;
+  };
+
+  // The entity being updated. The direction is only read by
+  // accumulateSymmetric().
+  struct Self
+  {
+    double x;
+    double y;
+    double z;
+    double dx;
+    double dy;
+    double dz;
+    double type;
+    bool predator;
+  };
+
+  struct Forces
+  {
+    void clear();
+
+    double diffPot[3];
+    double samePot[3];
+    double align[3];
+    double predator[3];
+    // Set if a predator is within the kill radius of a flocker
+    bool caught;
+  };
+
+  // Per-neighbor force accumulators written by accumulateSymmetric(), indexed
+  // like Neighbors and padded the same way. caught counts the predators
+  // within the kill radius.
+  struct Reaction
+  {
+    double *diffPot[3];
+    double *samePot[3];
+    double *align[3];
+    double *predator[3];
+    double *caught;
+  };
+
+  explicit PairKernel(Isa isa = bestSupportedIsa(),
+                      ForceLaw::Mode law = ForceLaw::Analytic);
+
+  Isa isa() const { return m_isa; }
+  // Falls back to Scalar if isa isn't supported by this CPU.
+  void setIsa(Isa isa);
+
+  // How the Morse derivative is evaluated; see ForceLaw.
+  ForceLaw::Mode forceLaw() const { return m_law; }
+  void setForceLaw(ForceLaw::Mode law);
+
+  // Accumulate the interactions of self with neighbors [begin, end).
+  void accumulate(const Self &self, const Neighbors &neighbors,
+                  int begin, int end, Forces *forces) const
+  {
+    m_func(self, neighbors, begin, end, forces);
+  }
+
+  // Half-pair form of accumulate(): the forces on both self and each visited
+  // neighbor come from one evaluation per pair, with the neighbors' share
+  // added to reaction. To visit every unordered pair once, flockers skip
+  // predators and are only called with neighbors after selfSlot, while
+  // predators see everything and skip predators at or before selfSlot.
+  void accumulateSymmetric(const Self &self, int selfSlot,
+                           const Neighbors &neighbors, int begin, int end,
+                           Forces *forces, const Reaction &reaction) const
+  {
+    m_symmetricFunc(self, selfSlot, neighbors, begin, end, forces, reaction);
+  }
+
+  static Isa bestSupportedIsa();
+  static bool isSupported(Isa isa);
+  static const char * isaName(Isa isa);
+  // Largest number of entries read past the end of a range.
+  static int paddingLanes() { return 16; }
+
+  typedef void (*Function)(const Self &self, const Neighbors &neighbors,
+                           int begin, int end, Forces *forces);
+  typedef void (*SymmetricFunction)(const Self &self, int selfSlot,
+                                    const Neighbors &neighbors,
+                                    int begin, int end, Forces *forces,
+                                    const Reaction &reaction);
+
+private:
+  Isa m_isa;
+  ForceLaw::Mode m_law;
+  Function m_func;
+  SymmetricFunction m_symmetricFunc;
+};
+
+#endif // PAIRKERNEL_H
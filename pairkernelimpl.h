@@ -0,0 +1,378 @@
+// Body of the pair interaction kernel. pairkernel.cpp includes this once per
+// instruction set, inside a namespace that defines a Vec type with the
+// vector operations for that set. There are deliberately no include guards.
+
+inline Vec::Reg morse(Vec::Reg r)
+{
+  using namespace Interaction;
+  const Vec::Reg tmpTerm =
+      Vec::sub(Vec::set1(1.0),
+               Vec::fastexp5(Vec::mul(Vec::set1(-morseAlpha),
+                                      Vec::sub(r, Vec::set1(morseRad)))));
+  return Vec::sub(Vec::mul(Vec::mul(Vec::set1(morseDepth), tmpTerm), tmpTerm),
+                  Vec::set1(morseDepth));
+}
+
+// Vector forms of the ForceLaw modes.
+template <int Law>
+inline Vec::Reg morseDerivative(Vec::Reg r);
+
+// Same finite difference as Interaction::V_morse_ND
+template <>
+inline Vec::Reg morseDerivative<ForceLaw::Exact>(Vec::Reg r)
+{
+  const Vec::Reg delta = Vec::mul(r, Vec::set1(1e-5));
+  const Vec::Reg v1 = morse(Vec::sub(r, delta));
+  const Vec::Reg v2 = morse(Vec::add(r, delta));
+  return Vec::div(Vec::sub(v2, v1), Vec::add(delta, delta));
+}
+
+// Same closed form as ForceLaw::analytic
+template <>
+inline Vec::Reg morseDerivative<ForceLaw::Analytic>(Vec::Reg r)
+{
+  using namespace Interaction;
+  const Vec::Reg x = Vec::mul(Vec::set1(-morseAlpha),
+                              Vec::sub(r, Vec::set1(morseRad)));
+  Vec::Reg p = Vec::add(Vec::set1(5.), x);
+  Vec::Reg dp = Vec::set1(5.);
+  p = Vec::add(Vec::set1(20.), Vec::mul(x, p));
+  dp = Vec::add(Vec::set1(20.), Vec::mul(x, dp));
+  p = Vec::add(Vec::set1(60.), Vec::mul(x, p));
+  dp = Vec::add(Vec::set1(60.), Vec::mul(x, dp));
+  p = Vec::add(Vec::set1(120.), Vec::mul(x, p));
+  dp = Vec::add(Vec::set1(120.), Vec::mul(x, dp));
+  p = Vec::add(Vec::set1(120.), Vec::mul(x, p));
+  dp = Vec::add(Vec::set1(120.), Vec::mul(x, dp));
+  const Vec::Reg scale = Vec::set1(1. / 120.);
+  p = Vec::mul(p, scale);
+  dp = Vec::mul(dp, scale);
+  return Vec::mul(Vec::set1(2. * morseDepth * morseAlpha),
+                  Vec::mul(Vec::sub(Vec::set1(1.), p), dp));
+}
+
+// Same lookup as ForceLaw::tabulated
+template <>
+inline Vec::Reg morseDerivative<ForceLaw::Tabulated>(Vec::Reg r)
+{
+  const ForceLaw::Table &t = ForceLaw::table();
+  const Vec::Reg s = Vec::min(Vec::mul(r, Vec::set1(t.invSpacing)),
+                              Vec::set1(t.maxPosition));
+  return Vec::interpolate(t.values, s);
+}
+
+struct Accumulators
+{
+  Accumulators() : caught(Vec::noneMask())
+  {
+    for (int d = 0; d < 3; ++d) {
+      diffPot[d] = Vec::zero();
+      samePot[d] = Vec::zero();
+      align[d] = Vec::zero();
+      predator[d] = Vec::zero();
+    }
+  }
+
+  Vec::Reg diffPot[3];
+  Vec::Reg samePot[3];
+  Vec::Reg align[3];
+  Vec::Reg predator[3];
+  Vec::Mask caught;
+};
+
+inline void maskedAdd(Vec::Reg &acc, Vec::Mask m, Vec::Reg v)
+{
+  acc = Vec::add(acc, Vec::select(m, v, Vec::zero()));
+}
+
+// Evaluate Vec::Width neighbors starting at offset. Lanes at or past end are
+// masked off.
+template <int Law>
+inline void accumulateLanes(const PairKernel::Self &self,
+                            const PairKernel::Neighbors &n,
+                            int offset, int end, Accumulators &acc)
+{
+  using namespace Interaction;
+
+  const Vec::Mask live = Vec::lt(Vec::iota(),
+                                 Vec::set1(static_cast<double>(end - offset)));
+
+  const Vec::Reg r[3] = { Vec::sub(Vec::loadu(n.x + offset), Vec::set1(self.x)),
+                          Vec::sub(Vec::loadu(n.y + offset), Vec::set1(self.y)),
+                          Vec::sub(Vec::loadu(n.z + offset), Vec::set1(self.z)) };
+  const Vec::Reg r2 = Vec::add(Vec::add(Vec::mul(r[0], r[0]),
+                                        Vec::mul(r[1], r[1])),
+                               Vec::mul(r[2], r[2]));
+
+  // General cutoff
+  const double cutoff = self.predator ? predatorCutoff : alignCutoff;
+  const Vec::Mask inCut = Vec::mand(live, Vec::le(r2, Vec::set1(cutoff * cutoff)));
+  if (!Vec::any(inCut))
+    return;
+
+  const Vec::Reg one = Vec::set1(1.0);
+  const Vec::Reg rNorm = Vec::sqrt(r2);
+  const Vec::Reg rInvNorm = Vec::select(Vec::gt(rNorm, Vec::set1(minInvertNorm)),
+                                        Vec::div(one, rNorm), one);
+  const Vec::Reg rInvNorm2 = Vec::mul(rInvNorm, rInvNorm);
+
+  const Vec::Mask pred_j = Vec::eq(Vec::loadu(n.predator + offset), one);
+  const Vec::Mask typesMatch = Vec::eq(Vec::loadu(n.type + offset),
+                                       Vec::set1(self.type));
+
+  // Neither are predators, or both are predators of the same type: use the
+  // morse potential and align.
+  const Vec::Mask potential =
+      self.predator ? Vec::mand(inCut, Vec::mand(pred_j, typesMatch))
+                    : Vec::mandnot(inCut, pred_j);
+  const Vec::Mask morseLanes =
+      Vec::mand(potential, Vec::lt(rNorm, Vec::set1(morseCutoff)));
+  const Vec::Mask alignLanes =
+      Vec::mand(Vec::mand(potential, typesMatch),
+                Vec::mand(Vec::lt(rNorm, Vec::set1(alignCutoff)),
+                          Vec::gt(rNorm, Vec::set1(minAlignNorm))));
+
+  if (Vec::any(Vec::mor(morseLanes, alignLanes))) {
+    const Vec::Reg scale = Vec::mul(Vec::mul(morseDerivative<Law>(rNorm), rInvNorm),
+                                    rInvNorm);
+    const Vec::Reg dir[3] = { Vec::loadu(n.dx + offset),
+                              Vec::loadu(n.dy + offset),
+                              Vec::loadu(n.dz + offset) };
+    for (int d = 0; d < 3; ++d) {
+      const Vec::Reg f = Vec::mul(scale, r[d]);
+      maskedAdd(acc.diffPot[d], morseLanes, f);
+      maskedAdd(acc.samePot[d], alignLanes, f);
+      maskedAdd(acc.align[d], alignLanes, Vec::mul(rInvNorm, dir[d]));
+    }
+  }
+
+  if (!self.predator) {
+    // Evade predators. r points from the predator to this flocker.
+    const Vec::Mask evade =
+        Vec::mand(Vec::mand(inCut, pred_j),
+                  Vec::lt(rNorm, Vec::set1(evadeCutoff)));
+    const Vec::Mask caught =
+        Vec::mand(evade, Vec::lt(rNorm, Vec::set1(killRadius)));
+    acc.caught = Vec::mor(acc.caught, caught);
+
+    const Vec::Mask flee = Vec::mandnot(evade, caught);
+    if (Vec::any(flee)) {
+      //                    normalize               1/r^3
+      const Vec::Reg scale = Vec::mul(rInvNorm, Vec::mul(rInvNorm2, rInvNorm));
+      for (int d = 0; d < 3; ++d)
+        maskedAdd(acc.predator[d], flee,
+                  Vec::mul(scale, Vec::sub(Vec::zero(), r[d])));
+    }
+  }
+  else {
+    // Predators of other types repel each other.
+    const Vec::Mask repel =
+        Vec::mand(Vec::mandnot(Vec::mand(inCut, pred_j), typesMatch),
+                  Vec::lt(rNorm, Vec::set1(predatorRepelCutoff)));
+    // Pursue flockers, harder once close.
+    const Vec::Mask pursue = Vec::mandnot(inCut, pred_j);
+
+    if (Vec::any(Vec::mor(repel, pursue))) {
+      //                                 2    normalize     1/r2
+      const Vec::Reg nearScale = Vec::mul(Vec::mul(Vec::set1(2.), rInvNorm),
+                                          rInvNorm2);
+      const Vec::Reg pursueScale =
+          Vec::select(Vec::lt(rNorm, Vec::set1(pursueCutoff)),
+                      nearScale, rInvNorm2);
+      for (int d = 0; d < 3; ++d) {
+        maskedAdd(acc.predator[d], repel,
+                  Vec::mul(nearScale, Vec::sub(Vec::zero(), r[d])));
+        maskedAdd(acc.predator[d], pursue, Vec::mul(pursueScale, r[d]));
+      }
+    }
+  }
+}
+
+template <int Law>
+void accumulate(const PairKernel::Self &self, const PairKernel::Neighbors &n,
+                int begin, int end, PairKernel::Forces *forces)
+{
+  Accumulators acc;
+
+  // Two registers per iteration to keep more independent work in flight.
+  for (int offset = begin; offset < end; offset += 2 * Vec::Width) {
+    accumulateLanes<Law>(self, n, offset, end, acc);
+    accumulateLanes<Law>(self, n, offset + Vec::Width, end, acc);
+  }
+
+  for (int d = 0; d < 3; ++d) {
+    forces->diffPot[d] += Vec::hsum(acc.diffPot[d]);
+    forces->samePot[d] += Vec::hsum(acc.samePot[d]);
+    forces->align[d] += Vec::hsum(acc.align[d]);
+    forces->predator[d] += Vec::hsum(acc.predator[d]);
+  }
+  if (Vec::any(acc.caught))
+    forces->caught = true;
+}
+
+inline void maskedAddTo(double *p, Vec::Mask m, Vec::Reg v)
+{
+  Vec::storeu(p, Vec::add(Vec::loadu(p), Vec::select(m, v, Vec::zero())));
+}
+
+// As accumulateLanes, but also adds the neighbors' side of each pair to
+// out. Must produce the same forces as the two one-sided evaluations.
+template <int Law>
+inline void accumulateLanesSymmetric(const PairKernel::Self &self,
+                                     int selfSlot,
+                                     const PairKernel::Neighbors &n,
+                                     int offset, int end, Accumulators &acc,
+                                     const PairKernel::Reaction &out)
+{
+  using namespace Interaction;
+
+  const Vec::Mask live = Vec::lt(Vec::iota(),
+                                 Vec::set1(static_cast<double>(end - offset)));
+  const Vec::Reg one = Vec::set1(1.0);
+  const Vec::Mask pred_j = Vec::eq(Vec::loadu(n.predator + offset), one);
+
+  // Flockers leave pairs with predators to the predator. Predator pairs are
+  // taken by the predator in the lower slot.
+  Vec::Mask visit;
+  if (!self.predator) {
+    visit = Vec::mandnot(live, pred_j);
+  }
+  else {
+    const Vec::Reg slot = Vec::add(Vec::iota(),
+                                   Vec::set1(static_cast<double>(offset)));
+    const Vec::Mask earlier =
+        Vec::le(slot, Vec::set1(static_cast<double>(selfSlot)));
+    visit = Vec::mandnot(live, Vec::mand(pred_j, earlier));
+  }
+
+  const Vec::Reg r[3] = { Vec::sub(Vec::loadu(n.x + offset), Vec::set1(self.x)),
+                          Vec::sub(Vec::loadu(n.y + offset), Vec::set1(self.y)),
+                          Vec::sub(Vec::loadu(n.z + offset), Vec::set1(self.z)) };
+  const Vec::Reg r2 = Vec::add(Vec::add(Vec::mul(r[0], r[0]),
+                                        Vec::mul(r[1], r[1])),
+                               Vec::mul(r[2], r[2]));
+
+  const double cutoff = self.predator ? predatorCutoff : alignCutoff;
+  const Vec::Mask inCut = Vec::mand(visit, Vec::le(r2, Vec::set1(cutoff * cutoff)));
+  if (!Vec::any(inCut))
+    return;
+
+  const Vec::Reg rNorm = Vec::sqrt(r2);
+  const Vec::Reg rInvNorm = Vec::select(Vec::gt(rNorm, Vec::set1(minInvertNorm)),
+                                        Vec::div(one, rNorm), one);
+  const Vec::Reg rInvNorm2 = Vec::mul(rInvNorm, rInvNorm);
+
+  const Vec::Mask typesMatch = Vec::eq(Vec::loadu(n.type + offset),
+                                       Vec::set1(self.type));
+
+  const Vec::Mask potential =
+      self.predator ? Vec::mand(inCut, Vec::mand(pred_j, typesMatch)) : inCut;
+  const Vec::Mask morseLanes =
+      Vec::mand(potential, Vec::lt(rNorm, Vec::set1(morseCutoff)));
+  const Vec::Mask alignLanes =
+      Vec::mand(Vec::mand(potential, typesMatch),
+                Vec::mand(Vec::lt(rNorm, Vec::set1(alignCutoff)),
+                          Vec::gt(rNorm, Vec::set1(minAlignNorm))));
+
+  if (Vec::any(Vec::mor(morseLanes, alignLanes))) {
+    const Vec::Reg scale = Vec::mul(Vec::mul(morseDerivative<Law>(rNorm),
+                                             rInvNorm), rInvNorm);
+    const Vec::Reg dir[3] = { Vec::loadu(n.dx + offset),
+                              Vec::loadu(n.dy + offset),
+                              Vec::loadu(n.dz + offset) };
+    const double selfDir[3] = { self.dx, self.dy, self.dz };
+    for (int d = 0; d < 3; ++d) {
+      // Equal and opposite potential, each side aligns to the other
+      const Vec::Reg f = Vec::mul(scale, r[d]);
+      const Vec::Reg negF = Vec::sub(Vec::zero(), f);
+      maskedAdd(acc.diffPot[d], morseLanes, f);
+      maskedAdd(acc.samePot[d], alignLanes, f);
+      maskedAdd(acc.align[d], alignLanes, Vec::mul(rInvNorm, dir[d]));
+      maskedAddTo(out.diffPot[d] + offset, morseLanes, negF);
+      maskedAddTo(out.samePot[d] + offset, alignLanes, negF);
+      maskedAddTo(out.align[d] + offset, alignLanes,
+                  Vec::mul(rInvNorm, Vec::set1(selfDir[d])));
+    }
+  }
+
+  if (!self.predator)
+    return;
+
+  // Predators of other types repel each other.
+  const Vec::Mask repel =
+      Vec::mand(Vec::mandnot(Vec::mand(inCut, pred_j), typesMatch),
+                Vec::lt(rNorm, Vec::set1(predatorRepelCutoff)));
+  // Pursue flockers, which evade in turn. r points from self to the flocker.
+  const Vec::Mask pursue = Vec::mandnot(inCut, pred_j);
+  const Vec::Mask evade =
+      Vec::mand(pursue, Vec::lt(rNorm, Vec::set1(evadeCutoff)));
+  const Vec::Mask caught =
+      Vec::mand(evade, Vec::lt(rNorm, Vec::set1(killRadius)));
+  const Vec::Mask flee = Vec::mandnot(evade, caught);
+
+  if (Vec::any(Vec::mor(repel, pursue))) {
+    //                                 2    normalize     1/r2
+    const Vec::Reg nearScale = Vec::mul(Vec::mul(Vec::set1(2.), rInvNorm),
+                                        rInvNorm2);
+    const Vec::Reg pursueScale =
+        Vec::select(Vec::lt(rNorm, Vec::set1(pursueCutoff)),
+                    nearScale, rInvNorm2);
+    //                                  normalize               1/r^3
+    const Vec::Reg fleeScale = Vec::mul(rInvNorm, Vec::mul(rInvNorm2, rInvNorm));
+    for (int d = 0; d < 3; ++d) {
+      const Vec::Reg repelForce = Vec::mul(nearScale, r[d]);
+      maskedAdd(acc.predator[d], repel, Vec::sub(Vec::zero(), repelForce));
+      maskedAdd(acc.predator[d], pursue, Vec::mul(pursueScale, r[d]));
+      maskedAddTo(out.predator[d] + offset, repel, repelForce);
+      maskedAddTo(out.predator[d] + offset, flee, Vec::mul(fleeScale, r[d]));
+    }
+    maskedAddTo(out.caught + offset, caught, one);
+  }
+}
+
+template <int Law>
+void accumulateSymmetric(const PairKernel::Self &self, int selfSlot,
+                         const PairKernel::Neighbors &n, int begin, int end,
+                         PairKernel::Forces *forces,
+                         const PairKernel::Reaction &reaction)
+{
+  Accumulators acc;
+
+  for (int offset = begin; offset < end; offset += 2 * Vec::Width) {
+    accumulateLanesSymmetric<Law>(self, selfSlot, n, offset, end, acc,
+                                  reaction);
+    accumulateLanesSymmetric<Law>(self, selfSlot, n, offset + Vec::Width, end,
+                                  acc, reaction);
+  }
+
+  for (int d = 0; d < 3; ++d) {
+    forces->diffPot[d] += Vec::hsum(acc.diffPot[d]);
+    forces->samePot[d] += Vec::hsum(acc.samePot[d]);
+    forces->align[d] += Vec::hsum(acc.align[d]);
+    forces->predator[d] += Vec::hsum(acc.predator[d]);
+  }
+}
+
+PairKernel::Function functionForLaw(ForceLaw::Mode law)
+{
+  switch (law) {
+  case ForceLaw::Exact:
+    return &accumulate<ForceLaw::Exact>;
+  case ForceLaw::Tabulated:
+    return &accumulate<ForceLaw::Tabulated>;
+  default:
+    return &accumulate<ForceLaw::Analytic>;
+  }
+}
+
+PairKernel::SymmetricFunction symmetricFunctionForLaw(ForceLaw::Mode law)
+{
+  switch (law) {
+  case ForceLaw::Exact:
+    return &accumulateSymmetric<ForceLaw::Exact>;
+  case ForceLaw::Tabulated:
+    return &accumulateSymmetric<ForceLaw::Tabulated>;
+  default:
+    return &accumulateSymmetric<ForceLaw::Analytic>;
+  }
+}
@@ -0,0 +1,81 @@
+#include "phasetimings.h"
+
+#include <algorithm>
+#include <cmath>
+
+PhaseTimings::PhaseTimings(int window)
+  : m_window(qMax(1, window))
+{
+  for (int p = 0; p < NumPhases; ++p)
+    m_samples[p].resize(m_window);
+  this->clear();
+}
+
+void PhaseTimings::record(Phase phase, qint64 nsecs)
+{
+  m_samples[phase][m_next[phase]] = nsecs;
+  m_next[phase] = (m_next[phase] + 1) % m_window;
+  m_count[phase] = qMin(m_count[phase] + 1, m_window);
+}
+
+void PhaseTimings::clear()
+{
+  for (int p = 0; p < NumPhases; ++p) {
+    m_next[p] = 0;
+    m_count[p] = 0;
+  }
+}
+
+double PhaseTimings::percentile(Phase phase, double p) const
+{
+  const int count = m_count[phase];
+  if (count == 0)
+    return 0.;
+
+  // Nearest rank
+  const int rank = qBound(0, static_cast<int>(std::ceil(p / 100. * count)) - 1,
+                          count - 1);
+  m_sorted.resize(count);
+  std::copy(m_samples[phase].constBegin(),
+            m_samples[phase].constBegin() + count, m_sorted.begin());
+  std::nth_element(m_sorted.begin(), m_sorted.begin() + rank,
+                   m_sorted.end());
+  return m_sorted[rank] * 1e-6;
+}
+
+double PhaseTimings::last(Phase phase) const
+{
+  if (m_count[phase] == 0)
+    return 0.;
+  return m_samples[phase][(m_next[phase] + m_window - 1) % m_window] * 1e-6;
+}
+
+const char * PhaseTimings::phaseName(Phase phase)
+{
+  switch (phase) {
+  case SetupPhase:
+    return "step setup";
+  case ForcePhase:
+    return "forces + integration";
+  case WaitPhase:
+    return "wait for step";
+  case CommitPhase:
+    return "commit";
+  case RespawnPhase:
+    return "kill/respawn";
+  case SyncPhase:
+    return "view sync";
+  case DepthSortPhase:
+    return "depth sort";
+  case DrawPhase:
+    return "draw";
+  case PaintPhase:
+    return "paint";
+  case OverlayPhase:
+    return "overlay";
+  case FramePhase:
+    return "frame";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef PHASETIMINGS_H
+#define PHASETIMINGS_H
+
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+
+// Rolling record of how long each phase of a frame takes.
+//
+// Each phase keeps its last window() durations in a ring, and percentile()
+// ranks whatever is in it, so the figures follow the last few seconds of
+// frames rather than the whole run.
+class PhaseTimings
+{
+public:
+  enum Phase {
+    // Engine, see FlockEngine::StepTimings
+    SetupPhase = 0,
+    ForcePhase,
+    WaitPhase,
+    CommitPhase,
+    RespawnPhase,
+    // Widget
+    SyncPhase,
+    DepthSortPhase,
+    DrawPhase,
+    PaintPhase,
+    OverlayPhase,
+    // Whole frame, from one takeStep() to the next
+    FramePhase,
+    NumPhases
+  };
+
+  explicit PhaseTimings(int window = 256);
+
+  int window() const { return m_window; }
+
+  void record(Phase phase, qint64 nsecs);
+  void clear();
+
+  // Durations recorded for phase, up to window()
+  int count(Phase phase) const { return m_count[phase]; }
+  // The p-th percentile, p in [0, 100], of phase's recorded durations in
+  // milliseconds, or 0 if there are none.
+  double percentile(Phase phase, double p) const;
+  // The latest duration of phase in milliseconds, or 0.
+  double last(Phase phase) const;
+
+  static const char * phaseName(Phase phase);
+
+private:
+  int m_window;
+  QVector<qint64> m_samples[NumPhases];
+  // Slot the next sample goes in, and samples held
+  int m_next[NumPhases];
+  int m_count[NumPhases];
+  // Scratch for percentile()
+  mutable QVector<qint64> m_sorted;
+};
+
+#endif // PHASETIMINGS_H
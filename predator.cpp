@@ -1,109 +1,119 @@
 #include "predator.h"
 
-#include <algorithm>
+#include "counterrng.h"
+#include "flocker.h"
 
-Predator::Predator(unsigned int id, unsigned int type, QObject *parent) :
-  Flocker(id, type, parent),
-  m_repeat(0)
-{
-  m_eType = PredatorEntity;
+namespace {
+// Each brush is held for this many frames.
+const unsigned int framesPerBrush = 3;
 
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::SolidPattern);
-  m_brushes.push_back(Qt::Dense1Pattern);
-  m_brushes.push_back(Qt::Dense2Pattern);
-  m_brushes.push_back(Qt::Dense3Pattern);
-  m_brushes.push_back(Qt::Dense4Pattern);
-  m_brushes.push_back(Qt::Dense5Pattern);
-  m_brushes.push_back(Qt::Dense6Pattern);
-  m_brushes.push_back(Qt::Dense7Pattern);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::Dense7Pattern);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::Dense7Pattern);
-  m_brushes.push_back(Qt::Dense6Pattern);
-  m_brushes.push_back(Qt::Dense5Pattern);
-  m_brushes.push_back(Qt::Dense6Pattern);
-  m_brushes.push_back(Qt::Dense7Pattern);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::Dense7Pattern);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::Dense7Pattern);
-  m_brushes.push_back(Qt::Dense6Pattern);
-  m_brushes.push_back(Qt::Dense5Pattern);
-  m_brushes.push_back(Qt::Dense6Pattern);
-  m_brushes.push_back(Qt::Dense7Pattern);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::NoBrush);
-  m_brushes.push_back(Qt::Dense7Pattern);
-  m_brushes.push_back(Qt::Dense6Pattern);
-  m_brushes.push_back(Qt::Dense5Pattern);
-  m_brushes.push_back(Qt::Dense4Pattern);
-  m_brushes.push_back(Qt::Dense3Pattern);
-  m_brushes.push_back(Qt::Dense2Pattern);
-  m_brushes.push_back(Qt::Dense1Pattern);
+// The fill cycle every predator goes through, from its own starting point.
+QVector<Qt::BrushStyle> makeBrushes()
+{
+  QVector<Qt::BrushStyle> brushes;
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::SolidPattern);
+  brushes.push_back(Qt::Dense1Pattern);
+  brushes.push_back(Qt::Dense2Pattern);
+  brushes.push_back(Qt::Dense3Pattern);
+  brushes.push_back(Qt::Dense4Pattern);
+  brushes.push_back(Qt::Dense5Pattern);
+  brushes.push_back(Qt::Dense6Pattern);
+  brushes.push_back(Qt::Dense7Pattern);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::Dense7Pattern);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::Dense7Pattern);
+  brushes.push_back(Qt::Dense6Pattern);
+  brushes.push_back(Qt::Dense5Pattern);
+  brushes.push_back(Qt::Dense6Pattern);
+  brushes.push_back(Qt::Dense7Pattern);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::Dense7Pattern);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::Dense7Pattern);
+  brushes.push_back(Qt::Dense6Pattern);
+  brushes.push_back(Qt::Dense5Pattern);
+  brushes.push_back(Qt::Dense6Pattern);
+  brushes.push_back(Qt::Dense7Pattern);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::NoBrush);
+  brushes.push_back(Qt::Dense7Pattern);
+  brushes.push_back(Qt::Dense6Pattern);
+  brushes.push_back(Qt::Dense5Pattern);
+  brushes.push_back(Qt::Dense4Pattern);
+  brushes.push_back(Qt::Dense3Pattern);
+  brushes.push_back(Qt::Dense2Pattern);
+  brushes.push_back(Qt::Dense1Pattern);
+  return brushes;
+}
+} // end anon namespace
 
-  std::rotate(m_brushes.begin(),
-              m_brushes.begin() + (rand() % m_brushes.size()),
-              m_brushes.end());
+const QVector<Qt::BrushStyle> &Predator::brushes()
+{
+  static const QVector<Qt::BrushStyle> table = makeBrushes();
+  return table;
+}
 
-  m_current = m_brushes.begin();
+void Predator::startCycle(Entity *view)
+{
+  // Start each predator at its own point in the cycle
+  CounterRng rng(0, view->id(), CounterRng::BrushStream);
+  view->cycle() = framesPerBrush * rng.bounded(brushes().size());
 }
 
-Predator::~Predator()
+void Predator::advanceCycle(Entity *view)
 {
+  view->cycle() = (view->cycle() + 1) % (framesPerBrush * brushes().size());
 }
 
-void Predator::draw(QPainter *p)
+void Predator::drawBatch(QPainter *p, Entity *const *views, int count)
 {
-  if (m_current == m_brushes.end())
-    m_current = m_brushes.begin();
-  drawInternal(p, *m_current);
+  Flocker::drawBatch(p, views, count, Predator::brush);
+}
 
-  // Change brushes every x frames:
-  if (++m_repeat == 3) {
-    ++m_current;
-    m_repeat = 0;
-  }
+Qt::BrushStyle Predator::brush(const Entity &view)
+{
+  return brushes()[view.cycle() / framesPerBrush];
 }
@@ -1,25 +1,31 @@
 #ifndef PREDATOR_H
 #define PREDATOR_H
 
-#include "flocker.h"
-
 #include <QtCore/QVector>
 
-class Predator : public Flocker
+#include "entity.h"
+
+class QPainter;
+
+// Draws predator views as flockers whose fill cycles through a shared table
+// of brush patterns.
+class Predator
 {
-  Q_OBJECT
 public:
-  explicit Predator(unsigned int id, unsigned int type, QObject *parent = 0);
-  virtual ~Predator();
+  // Pick the starting point of a new predator view's brush cycle.
+  static void startCycle(Entity *view);
+
+  // Move a predator view on to its next frame's brush.
+  static void advanceCycle(Entity *view);
+
+  // Every view must be a predator.
+  static void drawBatch(QPainter *p, Entity *const *views, int count);
 
-public slots:
-  void draw(QPainter *p);
+  // The brush to draw a predator view with this frame.
+  static Qt::BrushStyle brush(const Entity &view);
 
 private:
-  typedef QVector<Qt::BrushStyle> BrushVector;
-   BrushVector m_brushes;
-   BrushVector::const_iterator m_current;
-   unsigned int m_repeat;
+  static const QVector<Qt::BrushStyle> & brushes();
 };
 
 #endif // PREDATOR_H
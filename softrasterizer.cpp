@@ -0,0 +1,404 @@
+#include "softrasterizer.h"
+
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QtGlobal>
+
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define SOFTRASTERIZER_SSE2
+#  include <emmintrin.h>
+#endif
+
+namespace {
+// Qt's dense brush patterns, Dense1Pattern to Dense7Pattern; set bits are
+// painted.
+const uchar densePatterns[7][8] = {
+  { 0xff, 0xbb, 0xff, 0xff, 0xff, 0xbb, 0xff, 0xff },
+  { 0x77, 0xff, 0xdd, 0xff, 0x77, 0xff, 0xdd, 0xff },
+  { 0x55, 0xbb, 0x55, 0xee, 0x55, 0xbb, 0x55, 0xee },
+  { 0xaa, 0x55, 0xaa, 0x55, 0xaa, 0x55, 0xaa, 0x55 },
+  { 0xaa, 0x44, 0xaa, 0x11, 0xaa, 0x44, 0xaa, 0x11 },
+  { 0x88, 0x00, 0x22, 0x00, 0x88, 0x00, 0x22, 0x00 },
+  { 0x00, 0x44, 0x00, 0x00, 0x00, 0x44, 0x00, 0x00 }
+};
+
+// x * a / 255 for each channel of a premultiplied pixel, as Qt rounds it.
+inline QRgb byteMul(QRgb x, uint a)
+{
+  uint t = (x & 0xff00ff) * a;
+  t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+  t &= 0xff00ff;
+  x = ((x >> 8) & 0xff00ff) * a;
+  x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+  x &= 0xff00ff00;
+  return x | t;
+}
+
+const double twoPi = 6.283185307179586;
+
+// The pixels whose centers lie in [from, to]
+inline int firstCenter(double from) { return int(std::ceil(from - 0.5)); }
+inline int lastCenter(double to) { return int(std::floor(to - 0.5)); }
+
+// std::floor without the library call, for the line loops.
+inline int floorToInt(double v)
+{
+  const int i = int(v);
+  return i - (v < i);
+}
+
+// Edge function of the directed edge a -> b, positive on its left (in
+// device coordinates) and stepped by a per pixel along x.
+struct Edge
+{
+  Edge(const QPointF &from, const QPointF &to)
+    : a(from.y() - to.y()), b(to.x() - from.x()), x(from.x()), y(from.y())
+  {
+  }
+  double a;
+  double b;
+  double x;
+  double y;
+
+  double at(double px, double py) const
+  {
+    return a * (px - x) + b * (py - y);
+  }
+};
+} // end anon namespace
+
+SoftRasterizer::SoftRasterizer(uchar *pixels, int bytesPerLine, float *depth,
+                               int width, int height, int top, int bottom)
+  : m_pixels(pixels),
+    m_bytesPerLine(bytesPerLine),
+    m_depth(depth),
+    m_width(width),
+    m_height(height),
+    m_top(qMax(0, top)),
+    m_bottom(qMin(height, bottom))
+{
+}
+
+void SoftRasterizer::clear(QRgb color)
+{
+  const float far = -std::numeric_limits<float>::infinity();
+  for (int y = m_top; y < m_bottom; ++y) {
+    QRgb *pixels = this->row(y);
+    float *depth = this->depthRow(y);
+    for (int x = 0; x < m_width; ++x) {
+      pixels[x] = color;
+      depth[x] = far;
+    }
+  }
+}
+
+void SoftRasterizer::triangle(const QPointF *points, float z, QRgb fill,
+                              Qt::BrushStyle style, QRgb pen)
+{
+  if (style != Qt::NoBrush)
+    this->fillTriangle(points, z, fill, pattern(style));
+  this->line(points[0], points[1], z, pen);
+  this->line(points[1], points[2], z, pen);
+  this->line(points[2], points[0], z, pen);
+}
+
+void SoftRasterizer::disc(const QPointF &center, double radius, float z,
+                          QRgb fill, QRgb pen)
+{
+  const int y0 = qMax(m_top, firstCenter(center.y() - radius));
+  const int y1 = qMin(m_bottom - 1, lastCenter(center.y() + radius));
+  for (int y = y0; y <= y1; ++y) {
+    const double dy = y + 0.5 - center.y();
+    if (dy * dy < radius * radius) {
+      const double w = std::sqrt(radius * radius - dy * dy);
+      this->span(firstCenter(center.x() - w), lastCenter(center.x() + w), y,
+                 z, fill);
+    }
+  }
+  this->circle(center, radius, z, pen, false);
+}
+
+void SoftRasterizer::ring(const QPointF &center, double radius, float z,
+                          QRgb color)
+{
+  this->circle(center, radius, z, color, true);
+}
+
+const uchar * SoftRasterizer::pattern(Qt::BrushStyle style)
+{
+  if (style >= Qt::Dense1Pattern && style <= Qt::Dense7Pattern)
+    return densePatterns[style - Qt::Dense1Pattern];
+  return 0;
+}
+
+void SoftRasterizer::fillTriangle(const QPointF *points, float z,
+                                  QRgb color, const uchar *pattern)
+{
+  QPointF p[3] = { points[0], points[1], points[2] };
+  const double area = Edge(p[0], p[1]).at(p[2].x(), p[2].y());
+  if (area == 0.)
+    return;
+  if (area < 0.)
+    qSwap(p[1], p[2]);
+  const Edge edges[3] = { Edge(p[0], p[1]), Edge(p[1], p[2]),
+                          Edge(p[2], p[0]) };
+
+  const double minX = qMin(p[0].x(), qMin(p[1].x(), p[2].x()));
+  const double maxX = qMax(p[0].x(), qMax(p[1].x(), p[2].x()));
+  const double minY = qMin(p[0].y(), qMin(p[1].y(), p[2].y()));
+  const double maxY = qMax(p[0].y(), qMax(p[1].y(), p[2].y()));
+  const int x0 = qMax(0, firstCenter(minX));
+  const int x1 = qMin(m_width - 1, lastCenter(maxX));
+  const int y0 = qMax(m_top, firstCenter(minY));
+  const int y1 = qMin(m_bottom - 1, lastCenter(maxY));
+  if (x0 > x1 || y0 > y1)
+    return;
+
+  // Groups of four pixels start on a multiple of four, so each covers one
+  // half of a pattern byte.
+  const int xStart = x0 & ~3;
+
+#ifdef SOFTRASTERIZER_SSE2
+  const __m128 lanes = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+  const __m128i laneX = _mm_set_epi32(3, 2, 1, 0);
+  const __m128i first = _mm_set1_epi32(x0 - 1);
+  const __m128i last = _mm_set1_epi32(x1 + 1);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 zs = _mm_set1_ps(z);
+  const __m128i colors = _mm_set1_epi32(static_cast<int>(color));
+  const __m128i bitLanes = _mm_set_epi32(8, 4, 2, 1);
+  __m128 step[3];
+  for (int e = 0; e < 3; ++e)
+    step[e] = _mm_set1_ps(static_cast<float>(4. * edges[e].a));
+#endif
+
+  for (int y = y0; y <= y1; ++y) {
+    const double cy = y + 0.5;
+    QRgb *pixels = this->row(y);
+    float *depth = this->depthRow(y);
+    const uint bits = pattern ? pattern[y & 7] : 0xff;
+
+    double rowEdge[3];
+    for (int e = 0; e < 3; ++e)
+      rowEdge[e] = edges[e].at(xStart + 0.5, cy);
+
+    int x = xStart;
+#ifdef SOFTRASTERIZER_SSE2
+    __m128 value[3];
+    for (int e = 0; e < 3; ++e) {
+      value[e] = _mm_add_ps(_mm_set1_ps(static_cast<float>(rowEdge[e])),
+                            _mm_mul_ps(lanes, _mm_set1_ps(
+                                         static_cast<float>(edges[e].a))));
+    }
+    __m128i patternMask[2];
+    for (int half = 0; half < 2; ++half) {
+      const __m128i halfBits = _mm_set1_epi32((bits >> (4 * half)) & 0xf);
+      patternMask[half] =
+          _mm_cmpeq_epi32(_mm_and_si128(halfBits, bitLanes), bitLanes);
+    }
+
+    // Whole groups that stay inside the row
+    for (; x <= x1 && x + 3 < m_width; x += 4) {
+      const __m128i xs = _mm_add_epi32(_mm_set1_epi32(x), laneX);
+      __m128i mask = _mm_and_si128(_mm_cmpgt_epi32(xs, first),
+                                   _mm_cmplt_epi32(xs, last));
+      const __m128 inside =
+          _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(value[0], zero),
+                                _mm_cmpge_ps(value[1], zero)),
+                     _mm_cmpge_ps(value[2], zero));
+      for (int e = 0; e < 3; ++e)
+        value[e] = _mm_add_ps(value[e], step[e]);
+
+      const __m128 d = _mm_loadu_ps(depth + x);
+      mask = _mm_and_si128(mask, _mm_castps_si128(
+                             _mm_and_ps(inside, _mm_cmpge_ps(zs, d))));
+      mask = _mm_and_si128(mask, patternMask[(x >> 2) & 1]);
+      if (_mm_movemask_epi8(mask) == 0)
+        continue;
+
+      __m128i *target = reinterpret_cast<__m128i *>(pixels + x);
+      const __m128i old = _mm_loadu_si128(target);
+      _mm_storeu_si128(target, _mm_or_si128(_mm_and_si128(mask, colors),
+                                            _mm_andnot_si128(mask, old)));
+      const __m128 m = _mm_castsi128_ps(mask);
+      _mm_storeu_ps(depth + x, _mm_or_ps(_mm_and_ps(m, zs),
+                                         _mm_andnot_ps(m, d)));
+    }
+    for (int e = 0; e < 3; ++e)
+      rowEdge[e] += (x - xStart) * edges[e].a;
+#endif
+
+    // One pixel at a time, for what's left
+    for (; x <= x1; ++x) {
+      const bool inside = rowEdge[0] >= 0. && rowEdge[1] >= 0. &&
+                          rowEdge[2] >= 0.;
+      for (int e = 0; e < 3; ++e)
+        rowEdge[e] += edges[e].a;
+      if (!inside || x < x0 || !(bits & (1u << (x & 7))) || z < depth[x])
+        continue;
+      pixels[x] = color;
+      depth[x] = z;
+    }
+  }
+}
+
+struct SoftRasterizer::LinePlot
+{
+  void operator()(int x, int y) { r->plot(x, y, z, color); }
+  SoftRasterizer *r;
+  float z;
+  QRgb color;
+};
+
+template <typename Plot>
+void SoftRasterizer::traceLine(const QPointF &a, const QPointF &b, int top,
+                               int bottom, Plot &plot)
+{
+  const double dx = b.x() - a.x();
+  const double dy = b.y() - a.y();
+  if (dx == 0. && dy == 0.) {
+    const int y = int(std::floor(a.y()));
+    if (y >= top && y < bottom)
+      plot(int(std::floor(a.x())), y);
+  }
+  else if (std::fabs(dx) >= std::fabs(dy)) {
+    // One pixel per column whose center is in [a, b) or (b, a], where the
+    // line crosses it, as QPainter's cosmetic pen outlines a closed path.
+    const double slope = dy / dx;
+    const int lo = int(std::floor(qMin(a.x(), b.x()) + 0.5));
+    const int hi = int(std::floor(qMax(a.x(), b.x()) + 0.5)) - 1;
+    const int step = dx > 0. ? 1 : -1;
+    const int x0 = dx > 0. ? lo : hi;
+    const int x1 = dx > 0. ? hi : lo;
+    double y = a.y() + (x0 + 0.5 - a.x()) * slope;
+    const double yStep = step * slope;
+    for (int x = x0; (x1 - x) * step >= 0; x += step, y += yStep) {
+      const int py = floorToInt(y);
+      if (py >= top && py < bottom)
+        plot(x, py);
+    }
+  }
+  else {
+    const double slope = dx / dy;
+    const int lo = int(std::floor(qMin(a.y(), b.y()) + 0.5));
+    const int hi = int(std::floor(qMax(a.y(), b.y()) + 0.5)) - 1;
+    const int step = dy > 0. ? 1 : -1;
+    const int y0 = dy > 0. ? lo : hi;
+    const int y1 = dy > 0. ? hi : lo;
+    double x = a.x() + (y0 + 0.5 - a.y()) * slope;
+    const double xStep = step * slope;
+    for (int y = y0; (y1 - y) * step >= 0; y += step, x += xStep) {
+      if (y >= top && y < bottom)
+        plot(floorToInt(x), y);
+    }
+  }
+}
+
+void SoftRasterizer::line(const QPointF &a, const QPointF &b, float z,
+                          QRgb color)
+{
+  LinePlot plot = { this, z, color };
+  traceLine(a, b, m_top, m_bottom, plot);
+}
+
+namespace {
+// Plots the pixels of a closed outline, skipping repeats where its segments
+// meet.
+struct OutlinePlot
+{
+  void operator()(int x, int y)
+  {
+    if (numPlotted > 0 && x == lastX && y == lastY)
+      return;
+    if (numPlotted == 0) {
+      firstX = x;
+      firstY = y;
+    }
+    ++numPlotted;
+    lastX = x;
+    lastY = y;
+    pixels.push_back(x);
+    pixels.push_back(y);
+  }
+  int numPlotted;
+  int firstX;
+  int firstY;
+  int lastX;
+  int lastY;
+  QVarLengthArray<int, 1024> pixels;
+};
+} // end anon namespace
+
+void SoftRasterizer::circle(const QPointF &center, double radius, float z,
+                            QRgb color, bool blend)
+{
+  if (center.y() + radius + 1. < m_top || center.y() - radius - 1. >= m_bottom)
+    return;
+
+  // Chords of about two pixels
+  const int numSegments =
+      qMax(16, static_cast<int>(std::ceil(twoPi * radius / 2.)));
+  OutlinePlot outline;
+  outline.numPlotted = 0;
+  // Step the chords' ends around by rotation, skipping chords that miss
+  // the band.
+  const double c = std::cos(twoPi / numSegments);
+  const double s = std::sin(twoPi / numSegments);
+  double dx = radius;
+  double dy = 0.;
+  QPointF from(center.x() + dx, center.y());
+  for (int i = 1; i <= numSegments; ++i) {
+    const double rx = c * dx - s * dy;
+    dy = s * dx + c * dy;
+    dx = rx;
+    const QPointF to = i < numSegments
+        ? QPointF(center.x() + dx, center.y() + dy)
+        : QPointF(center.x() + radius, center.y());
+    if (qMax(from.y(), to.y()) >= m_top && qMin(from.y(), to.y()) < m_bottom)
+      traceLine(from, to, m_top, m_bottom, outline);
+    from = to;
+  }
+
+  int count = outline.pixels.size() / 2;
+  // The last segment may end on the first pixel
+  if (count > 1 && outline.lastX == outline.firstX &&
+      outline.lastY == outline.firstY)
+    --count;
+  for (int i = 0; i < count; ++i) {
+    const int x = outline.pixels[2 * i];
+    const int y = outline.pixels[2 * i + 1];
+    if (blend)
+      this->blend(x, y, z, color);
+    else
+      this->plot(x, y, z, color);
+  }
+}
+
+void SoftRasterizer::blend(int x, int y, float z, QRgb color)
+{
+  if (x < 0 || x >= m_width || y < m_top || y >= m_bottom)
+    return;
+  if (z < this->depthRow(y)[x])
+    return;
+  QRgb &pixel = this->row(y)[x];
+  pixel = color + byteMul(pixel, 255 - qAlpha(color));
+}
+
+void SoftRasterizer::span(int x0, int x1, int y, float z, QRgb color)
+{
+  if (y < m_top || y >= m_bottom)
+    return;
+  x0 = qMax(0, x0);
+  x1 = qMin(m_width - 1, x1);
+  QRgb *pixels = this->row(y);
+  float *depth = this->depthRow(y);
+  for (int x = x0; x <= x1; ++x) {
+    if (z >= depth[x]) {
+      pixels[x] = color;
+      depth[x] = z;
+    }
+  }
+}
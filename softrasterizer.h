@@ -0,0 +1,97 @@
+#ifndef SOFTRASTERIZER_H
+#define SOFTRASTERIZER_H
+
+#include <QtCore/QPointF>
+
+#include <QtGui/QRgb>
+
+// Software rasterizer for the handful of aliased primitives the entity
+// views are made of: filled or patterned triangles with a one pixel pen,
+// filled discs and translucent rings.
+//
+// It writes 32-bit premultiplied pixels straight into a band of rows
+// [top, bottom) of an image, alongside a float depth per pixel. Opaque
+// pixels are only written where their depth is at least the stored one,
+// and then take it, so opaque primitives may be drawn in any order and
+// come out as if painted back to front. Translucent rings are depth tested
+// but don't write depth, so they still need to go last, back to front.
+//
+// Triangle interiors evaluate their edge functions four pixels at a time
+// with SSE2 where available. Coverage follows QPainter's aliased rules
+// (pixel centers, brush patterns anchored at the device origin) closely
+// but not exactly; edge pixels may differ.
+//
+// On one thread it draws triangles and discs about 5x as fast as QPainter,
+// but rings only about 1.5x: circles are traced as chords of about two
+// pixels, the way QPainter flattens them, so their pixels match, and a
+// blast's ring is long. swarm-bench times both paths.
+class SoftRasterizer
+{
+public:
+  // pixels is the first scanline of a width x height image, depth the
+  // first of width floats per row. Drawing is clipped to rows
+  // [top, bottom), so bands of one image may be rasterized at once.
+  SoftRasterizer(uchar *pixels, int bytesPerLine, float *depth, int width,
+                 int height, int top, int bottom);
+
+  // Fill the band with color, and reset its depth to behind everything.
+  void clear(QRgb color);
+
+  // Triangle through points filled in style (Qt::NoBrush, solid or a
+  // Qt::DenseNPattern) and outlined by a one pixel pen.
+  void triangle(const QPointF *points, float z, QRgb fill,
+                Qt::BrushStyle style, QRgb pen);
+  // Disc of radius around center, outlined by a one pixel pen.
+  void disc(const QPointF &center, double radius, float z, QRgb fill,
+            QRgb pen);
+  // One pixel circle of a premultiplied, possibly translucent color,
+  // blended over what is there.
+  void ring(const QPointF &center, double radius, float z, QRgb color);
+
+  // The 8x8 bit pattern of a Qt::DenseNPattern brush, a byte per row with
+  // the leftmost pixel in the lowest bit, or 0 for other styles.
+  static const uchar * pattern(Qt::BrushStyle style);
+
+private:
+  void fillTriangle(const QPointF *points, float z, QRgb color,
+                    const uchar *pattern);
+  void line(const QPointF &a, const QPointF &b, float z, QRgb color);
+  // A one pixel circle outline, blended or not, visiting each pixel once.
+  void circle(const QPointF &center, double radius, float z, QRgb color,
+              bool blend);
+  // Call plot(x, y) for the pixels of a one pixel line, in order from a to
+  // b, skipping rows outside [top, bottom).
+  template <typename Plot>
+  static void traceLine(const QPointF &a, const QPointF &b, int top,
+                        int bottom, Plot &plot);
+  struct LinePlot;
+
+  void plot(int x, int y, float z, QRgb color)
+  {
+    if (x < 0 || x >= m_width || y < m_top || y >= m_bottom)
+      return;
+    float *d = this->depthRow(y) + x;
+    if (z >= *d) {
+      this->row(y)[x] = color;
+      *d = z;
+    }
+  }
+  void blend(int x, int y, float z, QRgb color);
+  void span(int x0, int x1, int y, float z, QRgb color);
+
+  QRgb * row(int y) const
+  {
+    return reinterpret_cast<QRgb *>(m_pixels + y * m_bytesPerLine);
+  }
+  float * depthRow(int y) const { return m_depth + y * m_width; }
+
+  uchar *m_pixels;
+  int m_bytesPerLine;
+  float *m_depth;
+  int m_width;
+  int m_height;
+  int m_top;
+  int m_bottom;
+};
+
+#endif // SOFTRASTERIZER_H
@@ -0,0 +1,156 @@
+#include "spriteatlas.h"
+
+#include <QtCore/QPointF>
+#include <QtCore/QRectF>
+
+#include <QtGui/QPaintDevice>
+#include <QtGui/QPainter>
+
+#include <cmath>
+
+#include "flocker.h"
+#include "predator.h"
+
+namespace {
+const double twoPi = 6.283185307179586;
+} // end anon namespace
+
+SpriteAtlas::SpriteAtlas()
+  : m_scale(0.),
+    m_cellSize(0),
+    m_maxLength(0.)
+{
+}
+
+void SpriteAtlas::prepare(int width, int height,
+                          const QVector<Entity*> &views)
+{
+  this->setScale(0.5 * (width + height));
+  foreach (const Entity *view, views) {
+    if (view->eType() == Entity::FlockerEntity)
+      this->addSheet(view->color(), Qt::SolidPattern);
+    else if (view->eType() == Entity::PredatorEntity)
+      this->addSheet(view->color(), Predator::brush(*view));
+  }
+}
+
+void SpriteAtlas::drawFlockers(QPainter *p, Entity *const *views,
+                               int count) const
+{
+  const double width = p->device()->width();
+  const double height = p->device()->height();
+  for (int i = 0; i < count; ++i)
+    this->drawSprite(p, *views[i], Qt::SolidPattern, width, height);
+}
+
+void SpriteAtlas::drawPredators(QPainter *p, Entity *const *views,
+                                int count) const
+{
+  const double width = p->device()->width();
+  const double height = p->device()->height();
+  for (int i = 0; i < count; ++i) {
+    const Entity &view = *views[i];
+    this->drawSprite(p, view, Predator::brush(view), width, height);
+  }
+}
+
+void SpriteAtlas::clear()
+{
+  m_image = QImage();
+  m_sheets.clear();
+}
+
+qint64 SpriteAtlas::numBytes() const
+{
+  return qint64(m_image.bytesPerLine()) * m_image.height();
+}
+
+void SpriteAtlas::setScale(double scale)
+{
+  if (scale == m_scale)
+    return;
+
+  this->clear();
+  m_scale = scale;
+  m_maxLength = Flocker::maxRadius() * scale;
+  // The triangle reaches 1.5 direction lengths from its center, plus the
+  // pen.
+  m_cellSize = 2 * static_cast<int>(std::ceil(1.5 * m_maxLength)) + 3;
+}
+
+quint64 SpriteAtlas::sheetKey(const QColor &color, Qt::BrushStyle style)
+{
+  return (static_cast<quint64>(color.rgba()) << 8) | style;
+}
+
+int SpriteAtlas::addSheet(const QColor &color, Qt::BrushStyle style)
+{
+  const quint64 key = sheetKey(color, style);
+  const int found = m_sheets.value(key, -1);
+  if (found >= 0)
+    return found;
+
+  // Grow the image by one sheet
+  const int top = m_sheets.size() * numSizes() * m_cellSize;
+  QImage image(numHeadings() * m_cellSize, top + numSizes() * m_cellSize,
+               QImage::Format_ARGB32_Premultiplied);
+  image.fill(Qt::transparent);
+  QPainter p(&image);
+  if (!m_image.isNull())
+    p.drawImage(0, 0, m_image);
+
+  p.setPen(Qt::black);
+  p.setBrush(QBrush(color, style));
+  for (int s = 0; s < numSizes(); ++s) {
+    const double length = m_maxLength * (s + 1) / numSizes();
+    for (int h = 0; h < numHeadings(); ++h) {
+      const double angle = twoPi * h / numHeadings();
+      const QPointF center((h + 0.5) * m_cellSize,
+                           top + (s + 0.5) * m_cellSize);
+      QPointF triangle[3];
+      Flocker::triangle(center, QPointF(length * std::cos(angle),
+                                        length * std::sin(angle)),
+                        triangle);
+      p.drawPolygon(triangle, 3);
+    }
+  }
+  p.end();
+
+  m_image = image;
+  m_sheets.insert(key, top);
+  return top;
+}
+
+void SpriteAtlas::drawSprite(QPainter *p, const Entity &view,
+                             Qt::BrushStyle style, double width,
+                             double height) const
+{
+  // Views missed by prepare() are skipped.
+  const int sheetTop = m_sheets.value(sheetKey(view.color(), style), -1);
+  if (sheetTop < 0)
+    return;
+
+  const Eigen::Vector3d &pos = view.pos();
+  const double radius = Flocker::radius(pos.z()) * m_scale;
+  const double dx = view.direction().x() * radius;
+  const double dy = view.direction().y() * radius;
+  const double length = std::sqrt(dx * dx + dy * dy);
+  if (length == 0.)
+    return;
+
+  int h = static_cast<int>(std::floor(std::atan2(dy, dx) / twoPi *
+                                      numHeadings() + 0.5));
+  h = (h % numHeadings() + numHeadings()) % numHeadings();
+  const int s = qBound(0, static_cast<int>(std::ceil(length / m_maxLength *
+                                                     numSizes())) - 1,
+                       numSizes() - 1);
+  const double scale = length * numSizes() / ((s + 1) * m_maxLength);
+
+  // The cell, scaled about the view's position
+  const QRectF source(h * m_cellSize, sheetTop + s * m_cellSize, m_cellSize,
+                      m_cellSize);
+  const double side = scale * m_cellSize;
+  const QRectF target(pos.x() * width - 0.5 * side,
+                      pos.y() * height - 0.5 * side, side, side);
+  p->drawImage(target, m_image, source);
+}
@@ -0,0 +1,68 @@
+#ifndef SPRITEATLAS_H
+#define SPRITEATLAS_H
+
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+#include <QtGui/QImage>
+
+#include "entity.h"
+
+class QPainter;
+
+// Draws flocker and predator views as prerendered triangle sprites.
+//
+// The triangles are rasterized once into a single image: a sheet per
+// (color, brush) pair, holding a grid of numHeadings() headings by
+// numSizes() sizes. Each view is then one QPainter::drawImage() of the
+// sprite of its nearest heading and next larger size, scaled down to fit.
+// Everything is redrawn if the device size changes.
+//
+// The atlas is a QImage rather than a QPixmap because TileRenderer draws
+// it from the QtConcurrent pool, and pixmaps may only be used on the GUI
+// thread. prepare() makes any missing sheets; the draw calls only read the
+// atlas, so they may then run on several threads at once.
+class SpriteAtlas
+{
+public:
+  SpriteAtlas();
+
+  // Size the sprites for a width x height device and make the sheets the
+  // flockers and predators among views will need this frame.
+  void prepare(int width, int height, const QVector<Entity*> &views);
+
+  // Every view must be a flocker.
+  void drawFlockers(QPainter *p, Entity *const *views, int count) const;
+  // Every view must be a predator.
+  void drawPredators(QPainter *p, Entity *const *views, int count) const;
+
+  void clear();
+
+  int numSheets() const { return m_sheets.size(); }
+  // The atlas image's size in bytes.
+  qint64 numBytes() const;
+
+  static int numHeadings() { return 32; }
+  static int numSizes() { return 4; }
+
+private:
+  void setScale(double scale);
+  static quint64 sheetKey(const QColor &color, Qt::BrushStyle style);
+  // Top of the sheet for color and style, rasterizing it if needed.
+  int addSheet(const QColor &color, Qt::BrushStyle style);
+  void drawSprite(QPainter *p, const Entity &view, Qt::BrushStyle style,
+                  double width, double height) const;
+
+  // Mean device side the sprites were drawn for
+  double m_scale;
+  // Side of a grid cell, in pixels
+  int m_cellSize;
+  // Length of the largest sprite's direction, in pixels
+  double m_maxLength;
+
+  QImage m_image;
+  // Sheet tops keyed by sheetKey()
+  QHash<quint64, int> m_sheets;
+};
+
+#endif // SPRITEATLAS_H
@@ -1,3 +1,5 @@
+include(engine.pri)
+
 SOURCES += \
     main.cpp \
     flocker.cpp \
@@ -7,7 +9,13 @@ SOURCES += \
     distancecache.cpp \
     predator.cpp \
     blast.cpp \
-    flockengine.cpp
+    entityviewcache.cpp \
+    depthorder.cpp \
+    lodrenderer.cpp \
+    phasetimings.cpp \
+    spriteatlas.cpp \
+    tilerenderer.cpp \
+    softrasterizer.cpp
 
 HEADERS += \
     flocker.h \
@@ -17,12 +25,13 @@ HEADERS += \
     distancecache.h \
     predator.h \
     blast.h \
-    flockengine.h
+    entityviewcache.h \
+    depthorder.h \
+    lodrenderer.h \
+    phasetimings.h \
+    spriteatlas.h \
+    tilerenderer.h \
+    softrasterizer.h
 
 QT += \
-    widgets \
-    concurrent
-
-# Change these as needed...
-INCLUDEPATH += \
-    C:/Users/lonie/src/eigen/
+    widgets
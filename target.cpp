@@ -4,16 +4,7 @@
 
 bool Target::m_visible = false;
 
-Target::Target(unsigned int id, unsigned int type, QObject *parent) :
-  Entity(id, type, TargetEntity, parent)
-{
-}
-
-Target::~Target()
-{
-}
-
-void Target::draw(QPainter *p)
+void Target::drawBatch(QPainter *p, Entity *const *views, int count)
 {
   if (!Target::m_visible) {
     return;
@@ -24,64 +15,29 @@ void Target::draw(QPainter *p)
   // Device coordinates:
   const double width = p->device()->width();
   const double height = p->device()->height();
-  QPointF devPos (m_pos.x() * width, m_pos.y() * height);
-
-  double radius = 0.005 * m_pos.z() + 0.005;
-  radius *= 0.5 * (width + height);
 
   p->setPen(Qt::black);
-  p->setBrush(QBrush(m_color, Qt::SolidPattern));
-
-  p->drawEllipse(devPos, radius, radius);
+  QColor color;
+  for (int i = 0; i < count; ++i) {
+    const Entity &view = *views[i];
+    const Eigen::Vector3d &pos = view.pos();
+    QPointF devPos (pos.x() * width, pos.y() * height);
+
+    const double radius = Target::radius(view) * 0.5 * (width + height);
+
+    if (i == 0 || view.color() != color) {
+      color = view.color();
+      p->setBrush(QBrush(color, Qt::SolidPattern));
+    }
+    p->drawEllipse(devPos, radius, radius);
+  }
 
   p->restore();
 }
 
-void Target::takeStep(double t)
+double Target::radius(const Entity &view)
 {
-  m_pos += m_velocity * m_direction * t;
-
-  // Use a reduced boundary for these -- keeps the flockers from bouncing off
-  // of the walls as much
-  const double validFraction = 0.90;
-
-  const double minVal = (1.0 - validFraction) / 2.0;
-  const double maxVal = 1.0 - minVal;
-
-  // lower values reduce bounce angle (hugs wall)
-  const double factor = 0.1;
-
-  // Bounce at boundaries
-  if (m_pos.x() < minVal) {
-    m_direction.x() = factor * fabs(m_direction.x());
-    m_direction.normalize();
-    m_pos.x() = minVal;
-  }
-  else if (m_pos.x() > maxVal) {
-    m_direction.x() = factor * -fabs(m_direction.x());
-    m_direction.normalize();
-    m_pos.x() = maxVal;
-  }
-  if (m_pos.y() < minVal) {
-    m_direction.y() = factor * fabs(m_direction.y());
-    m_direction.normalize();
-    m_pos.y() = minVal;
-  }
-  else if (m_pos.y() > maxVal) {
-    m_direction.y() = factor * -fabs(m_direction.y());
-    m_direction.normalize();
-    m_pos.y() = maxVal;
-  }
-  if (m_pos.z() < minVal) {
-    m_direction.z() = factor * fabs(m_direction.z());
-    m_direction.normalize();
-    m_pos.z() = minVal;
-  }
-  else if (m_pos.z() > maxVal) {
-    m_direction.z() = factor * -fabs(m_direction.z());
-    m_direction.normalize();
-    m_pos.z() = maxVal;
-  }
+  return 0.005 * view.pos().z() + 0.005;
 }
 
 bool Target::visible()
@@ -3,22 +3,21 @@
 
 #include "entity.h"
 
-class Target : public Entity
+class QPainter;
+
+// Draws target views as small discs, when targets are visible.
+class Target
 {
-  Q_OBJECT
 public:
-  explicit Target(unsigned int id, unsigned int type, QObject *parent = 0);
-  virtual ~Target();
+  // Every view must be a target.
+  static void drawBatch(QPainter *p, Entity *const *views, int count);
+
+  // Radius of a target view, as a fraction of the mean device side.
+  static double radius(const Entity &view);
 
   static bool visible();
   static void setVisible(bool vis);
 
-signals:
-  
-public slots:
-  virtual void draw(QPainter *p);
-  virtual void takeStep(double t);
-
 private:
   static bool m_visible;
 };
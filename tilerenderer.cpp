@@ -0,0 +1,254 @@
+#include "tilerenderer.h"
+
+#include <QtCore/QRect>
+#include <QtCore/QThread>
+
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <algorithm>
+
+#include "blast.h"
+#include "flocker.h"
+#include "predator.h"
+#include "softrasterizer.h"
+#include "spriteatlas.h"
+#include "target.h"
+
+namespace {
+// Bands per thread, so a band crowded with entities doesn't hold up the
+// frame.
+const int bandsPerThread = 4;
+
+// Half the height a view covers on a device whose mean side is scale, in
+// pixels, with a pixel to spare for the pen.
+double halfHeight(const Entity &view, double scale)
+{
+  switch (view.eType()) {
+  case Entity::FlockerEntity:
+  case Entity::PredatorEntity:
+    // The triangle reaches 1.5 radii from its center
+    return 1.5 * Flocker::radius(view.pos().z()) * scale + 1.;
+  case Entity::TargetEntity:
+    return Target::radius(view) * scale + 1.;
+  case Entity::BlastEntity:
+    return Blast::radius(view) * scale + 1.;
+  default:
+    return 0.;
+  }
+}
+
+// Collect the views reaching into rows [top, bottom) of a width x height
+// device.
+void cull(const QVector<Entity*> &views, int width, int height, int top,
+          int bottom, QVector<Entity*> *out)
+{
+  const double scale = 0.5 * (width + height);
+  out->resize(0);
+  foreach (Entity *view, views) {
+    const double y = view->pos().y() * height;
+    const double reach = halfHeight(*view, scale);
+    if (y + reach >= top && y - reach < bottom)
+      out->push_back(view);
+  }
+}
+
+bool zLessThan(const Entity *a, const Entity *b)
+{
+  return a->pos().z() < b->pos().z();
+}
+
+// Rasterize an opaque view the way its type's batch routine paints it.
+void rasterizeView(SoftRasterizer *r, const Entity &view, double width,
+                   double height)
+{
+  const Eigen::Vector3d &pos = view.pos();
+  const QPointF devPos(pos.x() * width, pos.y() * height);
+  const double scale = 0.5 * (width + height);
+  const QRgb black = qRgb(0, 0, 0);
+
+  switch (view.eType()) {
+  case Entity::FlockerEntity:
+  case Entity::PredatorEntity: {
+    const double radius = Flocker::radius(pos.z()) * scale;
+    const QPointF devDir(view.direction().x() * radius,
+                         view.direction().y() * radius);
+    QPointF triangle[3];
+    Flocker::triangle(devPos, devDir, triangle);
+    const Qt::BrushStyle style = view.eType() == Entity::PredatorEntity
+        ? Predator::brush(view) : Qt::SolidPattern;
+    r->triangle(triangle, pos.z(), qPremultiply(view.color().rgba()), style,
+                black);
+    break;
+  }
+  case Entity::TargetEntity:
+    if (Target::visible()) {
+      r->disc(devPos, Target::radius(view) * scale, pos.z(),
+              qPremultiply(view.color().rgba()), black);
+    }
+    break;
+  default:
+    break;
+  }
+}
+} // end anon namespace
+
+struct TileRenderer::BandFunctor
+{
+  BandFunctor(const QVector<Entity*> &views_, const SpriteAtlas *sprites_,
+              uchar *bits_, int width_, int height_, int bytesPerLine_,
+              QImage::Format format_)
+    : views(views_), sprites(sprites_), bits(bits_), width(width_),
+      height(height_), bytesPerLine(bytesPerLine_), format(format_)
+  {
+  }
+  const QVector<Entity*> &views;
+  const SpriteAtlas *sprites;
+  uchar *bits;
+  int width;
+  int height;
+  int bytesPerLine;
+  QImage::Format format;
+
+  void operator()(Band &band) const
+  {
+    cull(views, width, height, band.top, band.bottom, &band.views);
+
+    // A full size image over the shared pixels, so the views are placed
+    // against the whole device; the clip keeps this band's writes apart
+    // from the others'.
+    QImage image(bits, width, height, bytesPerLine, format);
+    QPainter p(&image);
+    const QRect rect(0, band.top, width, band.bottom - band.top);
+    p.setClipRect(rect);
+    p.fillRect(rect, Qt::black);
+    TileRenderer::draw(&p, band.views.constData(), band.views.size(),
+                       sprites);
+  }
+};
+
+struct TileRenderer::RasterFunctor
+{
+  RasterFunctor(const QVector<Entity*> &views_, uchar *bits_, float *depth_,
+                int width_, int height_, int bytesPerLine_)
+    : views(views_), bits(bits_), depth(depth_), width(width_),
+      height(height_), bytesPerLine(bytesPerLine_)
+  {
+  }
+  const QVector<Entity*> &views;
+  uchar *bits;
+  float *depth;
+  int width;
+  int height;
+  int bytesPerLine;
+
+  void operator()(Band &band) const
+  {
+    cull(views, width, height, band.top, band.bottom, &band.views);
+
+    SoftRasterizer r(bits, bytesPerLine, depth, width, height, band.top,
+                     band.bottom);
+    r.clear(qRgb(0, 0, 0));
+
+    // The depth buffer sorts out the opaque views; the translucent blasts
+    // are set aside and blended over them back to front.
+    band.blasts.resize(0);
+    foreach (Entity *view, band.views) {
+      if (view->eType() == Entity::BlastEntity)
+        band.blasts.push_back(view);
+      else
+        rasterizeView(&r, *view, width, height);
+    }
+
+    std::sort(band.blasts.begin(), band.blasts.end(), zLessThan);
+    const double scale = 0.5 * (width + height);
+    foreach (Entity *view, band.blasts) {
+      const Eigen::Vector3d &pos = view->pos();
+      r.ring(QPointF(pos.x() * width, pos.y() * height),
+             Blast::radius(*view) * scale, pos.z(),
+             qPremultiply(Blast::color(*view).rgba()));
+    }
+  }
+};
+
+TileRenderer::TileRenderer()
+{
+}
+
+void TileRenderer::render(const QVector<Entity*> &views,
+                          const SpriteAtlas *sprites, QImage *image)
+{
+  this->layOutBands(image->height());
+
+  // Detach on this thread, before the bands share the pixels
+  uchar *bits = image->bits();
+  QtConcurrent::blockingMap(m_bands,
+                            BandFunctor(views, sprites, bits, image->width(),
+                                        image->height(),
+                                        image->bytesPerLine(),
+                                        image->format()));
+}
+
+void TileRenderer::rasterize(const QVector<Entity*> &views, QImage *image)
+{
+  Q_ASSERT(image->format() == QImage::Format_ARGB32_Premultiplied ||
+           image->format() == QImage::Format_RGB32);
+  this->layOutBands(image->height());
+  m_depth.resize(image->width() * image->height());
+
+  uchar *bits = image->bits();
+  QtConcurrent::blockingMap(m_bands,
+                            RasterFunctor(views, bits, m_depth.data(),
+                                          image->width(), image->height(),
+                                          image->bytesPerLine()));
+}
+
+void TileRenderer::layOutBands(int height)
+{
+  const int numBands =
+      qMax(1, qMin(QThread::idealThreadCount() * bandsPerThread,
+                   height / minBandHeight()));
+  m_bands.resize(numBands);
+  for (int b = 0; b < numBands; ++b) {
+    m_bands[b].top = height * b / numBands;
+    m_bands[b].bottom = height * (b + 1) / numBands;
+  }
+}
+
+void TileRenderer::draw(QPainter *p, Entity *const *views, int count,
+                        const SpriteAtlas *sprites)
+{
+  for (int begin = 0; begin < count;) {
+    const Entity::EntityType eType = views[begin]->eType();
+    int end = begin + 1;
+    while (end < count && views[end]->eType() == eType)
+      ++end;
+
+    Entity *const *batch = views + begin;
+    switch (eType) {
+    case Entity::FlockerEntity:
+      if (sprites)
+        sprites->drawFlockers(p, batch, end - begin);
+      else
+        Flocker::drawBatch(p, batch, end - begin);
+      break;
+    case Entity::PredatorEntity:
+      if (sprites)
+        sprites->drawPredators(p, batch, end - begin);
+      else
+        Predator::drawBatch(p, batch, end - begin);
+      break;
+    case Entity::TargetEntity:
+      Target::drawBatch(p, batch, end - begin);
+      break;
+    case Entity::BlastEntity:
+      Blast::drawBatch(p, batch, end - begin);
+      break;
+    default:
+      break;
+    }
+    begin = end;
+  }
+}
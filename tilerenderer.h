@@ -0,0 +1,69 @@
+#ifndef TILERENDERER_H
+#define TILERENDERER_H
+
+#include <QtCore/QVector>
+
+#include "entity.h"
+
+class QImage;
+class QPainter;
+class SpriteAtlas;
+
+// Renders a frame's views into a QImage on the QtConcurrent thread pool.
+//
+// The image is split into horizontal bands of whole scanlines. Each band
+// is painted by its own QPainter, clipped to the band, with the views that
+// reach into it in the same back to front order, so the bands join up into
+// the same picture a single painter would make. The views and the sprite
+// atlas are only read while rendering.
+//
+// rasterize() paints the bands with a SoftRasterizer instead, testing each
+// pixel against a depth buffer, so the views can come in any order.
+class TileRenderer
+{
+public:
+  TileRenderer();
+
+  // Render views, back to front, over a black background.
+  void render(const QVector<Entity*> &views, const SpriteAtlas *sprites,
+              QImage *image);
+
+  // Render views, in any order, over a black background with the software
+  // rasterizer. Opaque views are resolved by depth; blasts are blended
+  // last, back to front, within each band.
+  void rasterize(const QVector<Entity*> &views, QImage *image);
+
+  // Bands used by the last render() or rasterize().
+  int numBands() const { return m_bands.size(); }
+
+  // Draw views in the given order, handing each run of same-typed views to
+  // its type's batch routine. Flockers and predators are drawn from
+  // sprites if given an atlas.
+  static void draw(QPainter *p, Entity *const *views, int count,
+                   const SpriteAtlas *sprites);
+
+  // Bands are no shorter than this many scanlines.
+  static int minBandHeight() { return 16; }
+
+private:
+  struct Band
+  {
+    int top;
+    int bottom;
+    // Views reaching into the band, reused between frames
+    QVector<Entity*> views;
+    // Blasts reaching into the band, when rasterizing
+    QVector<Entity*> blasts;
+  };
+  struct BandFunctor;
+  struct RasterFunctor;
+
+  // Split the image's rows among the bands.
+  void layOutBands(int height);
+
+  QVector<Band> m_bands;
+  // One depth per pixel, for rasterize()
+  QVector<float> m_depth;
+};
+
+#endif // TILERENDERER_H
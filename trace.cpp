@@ -0,0 +1,187 @@
+#include "trace.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QTextStream>
+#include <QtCore/QThread>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QVector>
+
+namespace {
+struct Event
+{
+  const char *category;
+  const char *name;
+  qint64 begin;
+  qint64 end;
+  const char *argKeys[2];
+  qint64 args[2];
+};
+
+// Only its own thread appends to a buffer; the lock is for write() and
+// start(), which read and clear it from another.
+struct ThreadBuffer
+{
+  QMutex mutex;
+  int id;
+  QString name;
+  QVector<Event> events;
+};
+
+// QThreadStorage deletes this on thread exit, but not the buffer
+struct BufferRef
+{
+  ThreadBuffer *buffer;
+};
+
+struct Registry
+{
+  Registry() { clock.start(); }
+  ~Registry() { qDeleteAll(buffers); }
+
+  QElapsedTimer clock;
+  QMutex mutex;
+  // Buffers outlive their threads, so a trace keeps what finished threads
+  // recorded.
+  QVector<ThreadBuffer *> buffers;
+  QThreadStorage<BufferRef *> current;
+};
+
+Q_GLOBAL_STATIC(Registry, registry)
+
+ThreadBuffer * currentBuffer()
+{
+  Registry *r = registry();
+  if (r->current.hasLocalData())
+    return r->current.localData()->buffer;
+
+  ThreadBuffer *buffer = new ThreadBuffer;
+  QThread *thread = QThread::currentThread();
+  QMutexLocker locker(&r->mutex);
+  buffer->id = r->buffers.size();
+  buffer->name = thread->objectName();
+  if (QCoreApplication::instance() &&
+      thread == QCoreApplication::instance()->thread()) {
+    buffer->name = "main";
+  }
+  else if (buffer->name.isEmpty()) {
+    buffer->name = QString("thread %1").arg(buffer->id);
+  }
+  r->buffers.push_back(buffer);
+  BufferRef *ref = new BufferRef;
+  ref->buffer = buffer;
+  r->current.setLocalData(ref);
+  return buffer;
+}
+
+QString quoted(QString s)
+{
+  s.replace('\\', "\\\\");
+  s.replace('"', "\\\"");
+  return '"' + s + '"';
+}
+} // end anon namespace
+
+QAtomicInt Trace::s_recording(0);
+int Trace::s_framesLeft = 0;
+QString Trace::s_fileName;
+
+void Trace::start()
+{
+  Registry *r = registry();
+  {
+    QMutexLocker locker(&r->mutex);
+    foreach (ThreadBuffer *buffer, r->buffers) {
+      QMutexLocker bufferLocker(&buffer->mutex);
+      buffer->events.resize(0);
+    }
+  }
+  s_recording.storeRelease(1);
+}
+
+void Trace::stop()
+{
+  s_recording.storeRelease(0);
+}
+
+bool Trace::captureFrames(int frames, const QString &fileName)
+{
+  if (s_framesLeft > 0 || frames <= 0)
+    return false;
+  s_framesLeft = frames;
+  s_fileName = fileName;
+  Trace::start();
+  return true;
+}
+
+void Trace::endFrame()
+{
+  if (s_framesLeft <= 0 || --s_framesLeft > 0)
+    return;
+  Trace::stop();
+  if (Trace::write(s_fileName))
+    qDebug() << "Wrote trace to" << s_fileName;
+  else
+    qWarning() << "Could not write trace to" << s_fileName;
+}
+
+bool Trace::write(const QString &fileName)
+{
+  QFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+
+  Registry *r = registry();
+  QMutexLocker locker(&r->mutex);
+  QTextStream out(&file);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  foreach (ThreadBuffer *buffer, r->buffers) {
+    QMutexLocker bufferLocker(&buffer->mutex);
+    if (!first)
+      out << ",\n";
+    first = false;
+    out << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+        << ",\"name\":\"thread_name\",\"args\":{\"name\":"
+        << quoted(buffer->name) << "}}";
+
+    // Timestamps are in microseconds
+    foreach (const Event &e, buffer->events) {
+      out << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+          << ",\"cat\":" << quoted(e.category)
+          << ",\"name\":" << quoted(e.name)
+          << ",\"ts\":" << QString::number(e.begin * 1e-3, 'f', 3)
+          << ",\"dur\":" << QString::number((e.end - e.begin) * 1e-3, 'f', 3);
+      if (e.argKeys[0]) {
+        out << ",\"args\":{" << quoted(e.argKeys[0]) << ":" << e.args[0];
+        if (e.argKeys[1])
+          out << "," << quoted(e.argKeys[1]) << ":" << e.args[1];
+        out << "}";
+      }
+      out << "}";
+    }
+  }
+  out << "\n]}\n";
+  out.flush();
+  return file.error() == QFile::NoError;
+}
+
+qint64 Trace::now()
+{
+  return registry()->clock.nsecsElapsed();
+}
+
+void Trace::record(const char *category, const char *name, qint64 begin,
+                   qint64 end, const char *argKey0, qint64 arg0,
+                   const char *argKey1, qint64 arg1)
+{
+  ThreadBuffer *buffer = currentBuffer();
+  const Event e = { category, name, begin, end, { argKey0, argKey1 },
+                    { arg0, arg1 } };
+  QMutexLocker locker(&buffer->mutex);
+  buffer->events.push_back(e);
+}
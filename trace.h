@@ -0,0 +1,95 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+
+// Records spans of work on any thread and writes them out in the Chrome
+// trace event format, which chrome://tracing and ui.perfetto.dev open.
+//
+// Spans are made with TraceSpan. While recording is off a span costs one
+// atomic load, so they can be left in the hot paths. While it is on, each
+// thread appends to its own buffer, and the buffers are only merged when
+// the trace is written.
+class Trace
+{
+public:
+  static bool isRecording() { return s_recording.loadAcquire() != 0; }
+
+  // Drop anything recorded so far and start recording.
+  static void start();
+  static void stop();
+
+  // Record the next frames frames, as counted by endFrame(), then stop and
+  // write them to fileName. Returns false if a capture is already running.
+  static bool captureFrames(int frames, const QString &fileName);
+  static int framesLeft() { return s_framesLeft; }
+  // Ends a frame for captureFrames(). Call from one thread only.
+  static void endFrame();
+
+  // Write what has been recorded as JSON. Call once recording has stopped
+  // and the traced threads are idle.
+  static bool write(const QString &fileName);
+
+  // Nanoseconds since the trace clock started.
+  static qint64 now();
+  // name, category and the argument keys must outlive the trace, e.g.
+  // string literals.
+  static void record(const char *category, const char *name, qint64 begin,
+                     qint64 end, const char *argKey0 = 0, qint64 arg0 = 0,
+                     const char *argKey1 = 0, qint64 arg1 = 0);
+
+private:
+  static QAtomicInt s_recording;
+  static int s_framesLeft;
+  static QString s_fileName;
+};
+
+// Records the time from its construction to its destruction as a span on
+// the current thread, if recording was on when it was made.
+class TraceSpan
+{
+public:
+  TraceSpan(const char *category, const char *name)
+    : m_category(category),
+      m_name(name),
+      m_begin(Trace::isRecording() ? Trace::now() : -1),
+      m_argKey0(0),
+      m_arg0(0),
+      m_argKey1(0),
+      m_arg1(0)
+  {
+  }
+
+  ~TraceSpan()
+  {
+    if (m_begin >= 0) {
+      Trace::record(m_category, m_name, m_begin, Trace::now(),
+                    m_argKey0, m_arg0, m_argKey1, m_arg1);
+    }
+  }
+
+  // Up to two arguments shown with the span.
+  void setArgs(const char *key0, qint64 arg0, const char *key1 = 0,
+               qint64 arg1 = 0)
+  {
+    m_argKey0 = key0;
+    m_arg0 = arg0;
+    m_argKey1 = key1;
+    m_arg1 = arg1;
+  }
+
+private:
+  Q_DISABLE_COPY(TraceSpan)
+
+  const char *m_category;
+  const char *m_name;
+  qint64 m_begin;
+  const char *m_argKey0;
+  qint64 m_arg0;
+  const char *m_argKey1;
+  qint64 m_arg1;
+};
+
+#endif // TRACE_H
@@ -0,0 +1,185 @@
+#include "verletlist.h"
+
+#include "buffergrowth.h"
+#include "workpool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Smallest number of points worth handing to a separate thread.
+const int minChunkSize = 256;
+
+// Collects the runs of slots within reach of slot i from the candidate
+// ranges of a cell list built in slot order, which arrive in ascending
+// order.
+struct RowScanner
+{
+  RowScanner(const double *x_, const double *y_, const double *z_, int i_,
+             double reach, QVector<int> *out_, int *numAllocations_)
+    : x(x_), y(y_), z(z_), i(i_), reach2(reach * reach), out(out_),
+      numAllocations(numAllocations_), numRuns(0)
+  {
+  }
+  const double *x;
+  const double *y;
+  const double *z;
+  int i;
+  double reach2;
+  QVector<int> *out;
+  int *numAllocations;
+  int numRuns;
+
+  void operator()(int begin, int end)
+  {
+    for (int j = begin; j < end; ++j) {
+      if (j == i)
+        continue;
+      const double rx = x[j] - x[i];
+      const double ry = y[j] - y[i];
+      const double rz = z[j] - z[i];
+      if (rx * rx + ry * ry + rz * rz > reach2)
+        continue;
+
+      if (numRuns > 0 && j <= out->last() + VerletList::mergeGap()) {
+        out->last() = j + 1;
+      }
+      else {
+        *numAllocations += reserveGrowth(*out, out->size() + 2);
+        out->push_back(j);
+        out->push_back(j + 1);
+        ++numRuns;
+      }
+    }
+  }
+};
+} // end anon namespace
+
+struct VerletList::ScanFunctor
+{
+  ScanFunctor(VerletList &l) : list(l) {}
+  VerletList &list;
+
+  void operator()(int begin, int end) const
+  {
+    for (int c = begin; c < end; ++c)
+      this->scan(list.m_chunks[c]);
+  }
+
+  void scan(Chunk &chunk) const
+  {
+    chunk.runs.resize(0);
+    chunk.rowRuns.resize(0);
+    chunk.numAllocations = 0;
+    for (int i = chunk.begin; i < chunk.end; ++i) {
+      const double reach = list.m_cutoff[i] + list.m_skin;
+      RowScanner scanner(list.m_x.constData(), list.m_y.constData(),
+                         list.m_z.constData(), i, reach, &chunk.runs,
+                         &chunk.numAllocations);
+      list.m_cellList.forEachCandidateRange(list.m_x[i], list.m_y[i],
+                                            list.m_z[i], reach, scanner);
+      chunk.rowRuns.push_back(scanner.numRuns);
+    }
+  }
+};
+
+VerletList::VerletList(double skin)
+  : m_skin(skin),
+    m_valid(false),
+    m_numRebuilds(0),
+    m_numAllocations(0),
+    m_numEntries(0),
+    m_cellList(0.1)
+{
+  m_rowStart.fill(0, 1);
+}
+
+void VerletList::setSkin(double skin)
+{
+  m_skin = skin;
+  m_valid = false;
+}
+
+void VerletList::build(const double *x, const double *y, const double *z,
+                       const double *cutoff, int count, WorkPool &pool)
+{
+  // Slots follow the cell list's order, so the candidate ranges it hands
+  // out are ranges of slots.
+  m_cellList.rebuild(x, y, z, count, pool);
+  const int *order = m_cellList.indices();
+  m_numAllocations += reserveGrowth(m_slotPoint, count);
+  m_numAllocations += reserveGrowth(m_pointSlot, count);
+  m_numAllocations += reserveGrowth(m_x, count);
+  m_numAllocations += reserveGrowth(m_y, count);
+  m_numAllocations += reserveGrowth(m_z, count);
+  m_numAllocations += reserveGrowth(m_cutoff, count);
+  m_slotPoint.resize(count);
+  m_pointSlot.resize(count);
+  m_x.resize(count);
+  m_y.resize(count);
+  m_z.resize(count);
+  m_cutoff.resize(count);
+  for (int slot = 0; slot < count; ++slot) {
+    const int point = order[slot];
+    m_slotPoint[slot] = point;
+    m_pointSlot[point] = slot;
+    m_x[slot] = x[point];
+    m_y[slot] = y[point];
+    m_z[slot] = z[point];
+    m_cutoff[slot] = cutoff[point];
+  }
+
+  const int numChunks = (count + minChunkSize - 1) / minChunkSize;
+  m_numAllocations += resizeGrowth(m_chunks, numChunks);
+  for (int c = 0; c < numChunks; ++c) {
+    Chunk &chunk = m_chunks[c];
+    chunk.begin = c * minChunkSize;
+    chunk.end = qMin(count, (c + 1) * minChunkSize);
+    m_numAllocations += reserveGrowth(chunk.rowRuns, chunk.end - chunk.begin);
+    // Dense regions move from chunk to chunk, so each gets room for every
+    // run of the last build.
+    m_numAllocations += reserveGrowth(chunk.runs, m_runs.size());
+  }
+  ScanFunctor scan(*this);
+  pool.parallelFor(numChunks, scan);
+
+  int numRuns = 0;
+  for (int c = 0; c < numChunks; ++c) {
+    m_numAllocations += m_chunks[c].numAllocations;
+    numRuns += m_chunks[c].runs.size();
+  }
+  m_numAllocations += reserveGrowth(m_rowStart, count + 1);
+  m_numAllocations += reserveGrowth(m_runs, numRuns);
+  m_rowStart.resize(count + 1);
+  m_rowStart[0] = 0;
+  // Copied rather than appended: += into an empty QVector shares the
+  // chunk's buffer instead of filling the reserved one.
+  m_runs.resize(numRuns);
+  int *runs = m_runs.data();
+  for (int c = 0; c < numChunks; ++c) {
+    const Chunk &chunk = m_chunks[c];
+    for (int i = chunk.begin; i < chunk.end; ++i)
+      m_rowStart[i + 1] = m_rowStart[i] + chunk.rowRuns[i - chunk.begin];
+    runs = std::copy(chunk.runs.constBegin(), chunk.runs.constEnd(), runs);
+  }
+
+  m_numEntries = 0;
+  for (int run = 0; run < this->numRuns(); ++run)
+    m_numEntries += this->runEnd(run) - this->runBegin(run);
+
+  m_valid = true;
+  ++m_numRebuilds;
+}
+
+double VerletList::maxDisplacement(const double *x, const double *y,
+                                   const double *z, int begin, int end) const
+{
+  double max2 = 0.;
+  for (int i = begin; i < end; ++i) {
+    const double rx = x[i] - m_x[i];
+    const double ry = y[i] - m_y[i];
+    const double rz = z[i] - m_z[i];
+    max2 = qMax(max2, rx * rx + ry * ry + rz * rz);
+  }
+  return std::sqrt(max2);
+}
@@ -0,0 +1,118 @@
+#ifndef VERLETLIST_H
+#define VERLETLIST_H
+
+#include <QtCore/QVector>
+
+#include "celllist.h"
+
+class WorkPool;
+
+// Per-point Verlet neighbor lists in compressed sparse row form. Each point
+// lists the others within its cutoff plus a skin, so the lists stay complete
+// until some point has moved more than half the skin from where it was at
+// the last build.
+//
+// A build renumbers the points into slots in grid cell order, so a point's
+// neighbors mostly occupy a few runs of consecutive slots. Each row is
+// stored as those runs, [begin, end) pairs of slots, ready to hand to a
+// range kernel over slot-ordered arrays. Runs are merged across gaps of up
+// to mergeGap() slots and may span the point itself, so the caller still
+// applies the exact cutoff and skips the point.
+class VerletList
+{
+public:
+  explicit VerletList(double skin = 0.06);
+
+  double skin() const { return m_skin; }
+  // Changing the skin invalidates the lists.
+  void setSkin(double skin);
+
+  // Number of slots in the last build
+  int size() const { return m_slotPoint.size(); }
+  bool isValid() const { return m_valid; }
+  void invalidate() { m_valid = false; }
+
+  // Builds completed since construction
+  quint64 numRebuilds() const { return m_numRebuilds; }
+  // Times a build has had to grow its buffers since construction
+  quint64 numAllocations() const
+  {
+    return m_numAllocations + m_cellList.numAllocations();
+  }
+
+  // List the points within cutoff[i] + skin() of each point i, for count
+  // points at (x[i], y[i], z[i]), and assign the slots. Runs on pool.
+  void build(const double *x, const double *y, const double *z,
+             const double *cutoff, int count, WorkPool &pool);
+
+  // Point i of the last build is in slot slotOf(i); slot s holds point
+  // pointAt(s).
+  int slotOf(int point) const { return m_pointSlot[point]; }
+  int pointAt(int slot) const { return m_slotPoint[slot]; }
+
+  // Largest distance a slot has moved from its position at the last build,
+  // given the current positions in slot order.
+  double maxDisplacement(const double *x, const double *y,
+                         const double *z) const
+  {
+    return this->maxDisplacement(x, y, z, 0, this->size());
+  }
+  // As above, over the slots in [begin, end) only.
+  double maxDisplacement(const double *x, const double *y, const double *z,
+                         int begin, int end) const;
+  // True if the lists may be missing a pair at the given positions.
+  bool needsRebuild(const double *x, const double *y, const double *z) const
+  {
+    return !m_valid || 2. * this->maxDisplacement(x, y, z) > m_skin;
+  }
+
+  // The runs of slot are [runBegin(k), runEnd(k)) for k in
+  // [firstRun(slot), firstRun(slot + 1)).
+  int firstRun(int slot) const { return m_rowStart[slot]; }
+  int runBegin(int run) const { return m_runs[2 * run]; }
+  int runEnd(int run) const { return m_runs[2 * run + 1]; }
+  int numRuns() const { return m_runs.size() / 2; }
+  // Slots covered by all runs, including merged gaps
+  qint64 numEntries() const { return m_numEntries; }
+
+  static int mergeGap() { return 8; }
+
+private:
+  // Rows [begin, end) are scanned into a chunk's own buffers, then copied
+  // into place once every chunk's size is known.
+  struct Chunk
+  {
+    int begin;
+    int end;
+    QVector<int> runs;
+    QVector<int> rowRuns;
+    // Times runs grew while it was filled
+    int numAllocations;
+  };
+  struct ScanFunctor;
+  friend struct ScanFunctor;
+
+  double m_skin;
+  bool m_valid;
+  quint64 m_numRebuilds;
+  quint64 m_numAllocations;
+  qint64 m_numEntries;
+
+  QVector<int> m_pointSlot;
+  QVector<int> m_slotPoint;
+
+  // Runs m_rowStart[s] .. m_rowStart[s+1] belong to slot s; m_runs holds
+  // begin, end pairs.
+  QVector<int> m_rowStart;
+  QVector<int> m_runs;
+
+  // Slot positions and cutoffs at the last build
+  QVector<double> m_x;
+  QVector<double> m_y;
+  QVector<double> m_z;
+  QVector<double> m_cutoff;
+  CellList m_cellList;
+  QVector<Chunk> m_chunks;
+};
+
+#endif // VERLETLIST_H
@@ -0,0 +1,231 @@
+#include "workpool.h"
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+#include "trace.h"
+
+namespace {
+// Chunks dealt to each thread per call, so that stealing has something to
+// balance with.
+const int chunksPerThread = 8;
+
+inline quint64 packSpan(quint32 front, quint32 back)
+{
+  return (static_cast<quint64>(front) << 32) | back;
+}
+} // end anon namespace
+
+class WorkPool::Worker : public QThread
+{
+public:
+  Worker(WorkPool *p, int s, quint64 g) : pool(p), self(s), generation(g)
+  {
+    this->setObjectName(QString("WorkPool worker %1").arg(s));
+  }
+  WorkPool *pool;
+  int self;
+  // The last call this worker may ignore
+  quint64 generation;
+
+protected:
+  void run()
+  {
+    pool->workerLoop(self, generation);
+  }
+};
+
+WorkPool::WorkPool(int numThreads)
+  : m_numThreads(0),
+    m_spans(0),
+    m_function(0),
+    m_context(0),
+    m_count(0),
+    m_grain(1),
+    m_generation(0),
+    m_pending(0),
+    m_quit(false),
+    m_numSteals(0)
+{
+  this->setNumThreads(numThreads);
+}
+
+WorkPool::~WorkPool()
+{
+  this->stopThreads();
+  delete[] m_spans;
+}
+
+void WorkPool::setNumThreads(int numThreads)
+{
+  QMutexLocker call(&m_callMutex);
+  if (numThreads <= 0)
+    numThreads = QThread::idealThreadCount();
+  numThreads = qMax(1, numThreads);
+  if (numThreads == m_numThreads)
+    return;
+
+  this->stopThreads();
+  delete[] m_spans;
+  m_numThreads = numThreads;
+  m_spans = new Span[m_numThreads];
+  this->startThreads();
+}
+
+int WorkPool::grainSize(int count, int minGrain) const
+{
+  const int chunks = m_numThreads * chunksPerThread;
+  return qMax(qMax(1, minGrain), (count + chunks - 1) / chunks);
+}
+
+void WorkPool::startThreads()
+{
+  m_quit = false;
+  // The calling thread is participant 0.
+  for (int t = 1; t < m_numThreads; ++t) {
+    Worker *worker = new Worker(this, t, m_generation);
+    m_threads.push_back(worker);
+    worker->start();
+  }
+}
+
+void WorkPool::stopThreads()
+{
+  {
+    QMutexLocker locker(&m_mutex);
+    m_quit = true;
+    m_wake.wakeAll();
+  }
+  foreach (QThread *thread, m_threads) {
+    thread->wait();
+    delete thread;
+  }
+  m_threads.clear();
+}
+
+int WorkPool::numChunks(int count, int minGrain) const
+{
+  const int grain = this->grainSize(count, minGrain);
+  return (count + grain - 1) / grain;
+}
+
+void WorkPool::run(int count, int grain, ChunkFunction function,
+                   void *context)
+{
+  QMutexLocker call(&m_callMutex);
+  const int numChunks = (count + grain - 1) / grain;
+
+  m_function = function;
+  m_context = context;
+  m_count = count;
+  m_grain = grain;
+
+  if (m_threads.isEmpty() || numChunks == 1) {
+    for (int c = 0; c < numChunks; ++c)
+      this->runChunk(c, false);
+    return;
+  }
+
+  // Deal contiguous spans of chunks so each thread starts on its own part
+  // of the arrays.
+  for (int t = 0; t < m_numThreads; ++t) {
+    const quint32 front =
+        static_cast<quint32>(qint64(numChunks) * t / m_numThreads);
+    const quint32 back =
+        static_cast<quint32>(qint64(numChunks) * (t + 1) / m_numThreads);
+    m_spans[t].range.storeRelease(packSpan(front, back));
+  }
+
+  {
+    QMutexLocker locker(&m_mutex);
+    m_pending = m_threads.size();
+    ++m_generation;
+    m_wake.wakeAll();
+  }
+
+  this->participate(0);
+
+  TraceSpan span("pool", "wait for workers");
+  QMutexLocker locker(&m_mutex);
+  while (m_pending > 0)
+    m_done.wait(&m_mutex);
+}
+
+void WorkPool::workerLoop(int self, quint64 seen)
+{
+  forever {
+    {
+      QMutexLocker locker(&m_mutex);
+      while (m_generation == seen && !m_quit)
+        m_wake.wait(&m_mutex);
+      if (m_quit)
+        return;
+      seen = m_generation;
+    }
+
+    this->participate(self);
+
+    QMutexLocker locker(&m_mutex);
+    if (--m_pending == 0)
+      m_done.wakeAll();
+  }
+}
+
+void WorkPool::participate(int self)
+{
+  int chunk;
+  while (this->takeOwn(self, &chunk))
+    this->runChunk(chunk, false);
+
+  quint64 stolen = 0;
+  for (int v = 1; v < m_numThreads; ++v) {
+    const int victim = (self + v) % m_numThreads;
+    while (this->steal(victim, &chunk)) {
+      this->runChunk(chunk, true);
+      ++stolen;
+    }
+  }
+  if (stolen > 0)
+    m_numSteals.fetchAndAddRelaxed(stolen);
+}
+
+bool WorkPool::takeOwn(int self, int *chunk)
+{
+  QAtomicInteger<quint64> &range = m_spans[self].range;
+  quint64 current = range.loadAcquire();
+  forever {
+    const quint32 front = static_cast<quint32>(current >> 32);
+    const quint32 back = static_cast<quint32>(current);
+    if (front >= back)
+      return false;
+    if (range.testAndSetOrdered(current, packSpan(front + 1, back), current)) {
+      *chunk = static_cast<int>(front);
+      return true;
+    }
+  }
+}
+
+bool WorkPool::steal(int victim, int *chunk)
+{
+  QAtomicInteger<quint64> &range = m_spans[victim].range;
+  quint64 current = range.loadAcquire();
+  forever {
+    const quint32 front = static_cast<quint32>(current >> 32);
+    const quint32 back = static_cast<quint32>(current);
+    if (front >= back)
+      return false;
+    if (range.testAndSetOrdered(current, packSpan(front, back - 1), current)) {
+      *chunk = static_cast<int>(back - 1);
+      return true;
+    }
+  }
+}
+
+void WorkPool::runChunk(int chunk, bool stolen)
+{
+  const int begin = chunk * m_grain;
+  const int end = qMin(m_count, begin + m_grain);
+  TraceSpan span("pool", stolen ? "stolen chunk" : "chunk");
+  span.setArgs("chunk", chunk, "items", end - begin);
+  m_function(m_context, chunk, begin, end);
+}
@@ -0,0 +1,184 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QMutex>
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
+
+class QThread;
+
+// A fixed set of worker threads for the engine's data parallel phases.
+//
+// A call splits [0, count) into chunks of an adaptive grain size and deals
+// each participant (the workers plus the calling thread) a contiguous span
+// of chunks. Participants take chunks from the front of their own span and,
+// once it is empty, steal from the back of the others'. The chunking only
+// depends on count, the minimum grain and the thread count, so
+// parallelReduce() combines the same partial results in the same order no
+// matter which thread ran them.
+//
+// Calls block until every chunk is done. They are serialized, and must not
+// be made from inside a chunk.
+class WorkPool
+{
+public:
+  // numThreads includes the calling thread; 0 picks
+  // QThread::idealThreadCount().
+  explicit WorkPool(int numThreads = 0);
+  ~WorkPool();
+
+  int numThreads() const { return m_numThreads; }
+  void setNumThreads(int numThreads);
+
+  // The grain used for count items: about eight chunks per thread, and no
+  // fewer than minGrain items per chunk.
+  int grainSize(int count, int minGrain) const;
+  // The number of ranges a call splits [0, count) into.
+  int numChunks(int count, int minGrain) const;
+
+  // Call f(begin, end) over ranges covering [0, count).
+  template <typename Functor>
+  void parallelFor(int count, Functor &f, int minGrain = 1);
+  // As parallelFor(), but call f(chunk, begin, end), where chunk numbers
+  // the ranges in order from 0 to numChunks(). Lets the caller keep
+  // per-chunk results in buffers it reuses from call to call.
+  template <typename Functor>
+  void parallelForChunks(int count, Functor &f, int minGrain = 1);
+
+  // map(begin, end, &partial) folds a range into a partial result that
+  // starts as identity; combine(&total, partial) then merges the partials
+  // into identity in range order. The partials are kept on the stack for
+  // up to 32 threads.
+  template <typename T, typename MapFunctor, typename CombineFunctor>
+  T parallelReduce(int count, const T &identity, MapFunctor &map,
+                   CombineFunctor &combine, int minGrain = 1);
+
+  // Chunks run by a thread other than the one they were dealt to, since
+  // construction. A rough measure of load imbalance.
+  quint64 numSteals() const { return m_numSteals.loadAcquire(); }
+
+private:
+  typedef void (*ChunkFunction)(void *context, int chunk, int begin, int end);
+
+  // Run function over the chunks of [0, count) and wait for them.
+  void run(int count, int grain, ChunkFunction function, void *context);
+  void participate(int self);
+  bool takeOwn(int self, int *chunk);
+  bool steal(int victim, int *chunk);
+  // stolen is only used to label the chunk in traces.
+  void runChunk(int chunk, bool stolen);
+
+  void startThreads();
+  void stopThreads();
+
+  class Worker;
+  friend class Worker;
+  void workerLoop(int self, quint64 seen);
+
+  template <typename Functor>
+  static void forChunk(void *context, int chunk, int begin, int end);
+  template <typename Functor>
+  static void forNumberedChunk(void *context, int chunk, int begin, int end);
+  template <typename T, typename MapFunctor>
+  struct ReduceContext;
+  template <typename T, typename MapFunctor>
+  static void reduceChunk(void *context, int chunk, int begin, int end);
+
+  int m_numThreads;
+  QVector<QThread *> m_threads;
+
+  // Chunk spans packed as front << 32 | back, one per participant
+  struct Span
+  {
+    QAtomicInteger<quint64> range;
+    // Keep each span on its own cache line
+    char padding[56];
+  };
+  Span *m_spans;
+
+  // The current call
+  ChunkFunction m_function;
+  void *m_context;
+  int m_count;
+  int m_grain;
+
+  QMutex m_callMutex;
+  QMutex m_mutex;
+  QWaitCondition m_wake;
+  QWaitCondition m_done;
+  quint64 m_generation;
+  int m_pending;
+  bool m_quit;
+  QAtomicInteger<quint64> m_numSteals;
+};
+
+template <typename Functor>
+void WorkPool::forChunk(void *context, int chunk, int begin, int end)
+{
+  Q_UNUSED(chunk);
+  (*static_cast<Functor *>(context))(begin, end);
+}
+
+template <typename Functor>
+void WorkPool::parallelFor(int count, Functor &f, int minGrain)
+{
+  if (count <= 0)
+    return;
+  this->run(count, this->grainSize(count, minGrain), &forChunk<Functor>, &f);
+}
+
+template <typename Functor>
+void WorkPool::forNumberedChunk(void *context, int chunk, int begin, int end)
+{
+  (*static_cast<Functor *>(context))(chunk, begin, end);
+}
+
+template <typename Functor>
+void WorkPool::parallelForChunks(int count, Functor &f, int minGrain)
+{
+  if (count <= 0)
+    return;
+  this->run(count, this->grainSize(count, minGrain),
+            &forNumberedChunk<Functor>, &f);
+}
+
+template <typename T, typename MapFunctor>
+struct WorkPool::ReduceContext
+{
+  MapFunctor *map;
+  T *partials;
+};
+
+template <typename T, typename MapFunctor>
+void WorkPool::reduceChunk(void *context, int chunk, int begin, int end)
+{
+  ReduceContext<T, MapFunctor> *c =
+      static_cast<ReduceContext<T, MapFunctor> *>(context);
+  (*c->map)(begin, end, c->partials + chunk);
+}
+
+template <typename T, typename MapFunctor, typename CombineFunctor>
+T WorkPool::parallelReduce(int count, const T &identity, MapFunctor &map,
+                           CombineFunctor &combine, int minGrain)
+{
+  T total = identity;
+  if (count <= 0)
+    return total;
+
+  const int grain = this->grainSize(count, minGrain);
+  QVarLengthArray<T, 256> partials((count + grain - 1) / grain);
+  for (int c = 0; c < partials.size(); ++c)
+    partials[c] = identity;
+  ReduceContext<T, MapFunctor> context;
+  context.map = &map;
+  context.partials = partials.data();
+  this->run(count, grain, &reduceChunk<T, MapFunctor>, &context);
+
+  for (int c = 0; c < partials.size(); ++c)
+    combine(&total, partials[c]);
+  return total;
+}
+
+#endif // WORKPOOL_H